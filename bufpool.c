@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bufpool.h"
+
+/* idle rings, linked through a small header kept outside the ring */
+struct bufpool_idle
+{
+    struct msgbuf * mbuf;
+    struct bufpool_idle * next;
+};
+
+static pthread_mutex_t bufpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bufpool_idle * bufpool_idle[BUFPOOL_CLASSES];
+static struct bufpool_idle * bufpool_spare;         // unused list entries
+static struct bufpool_stats bufpool_stats;
+static int bufpool_warned;
+
+static int bufpool_class(int len);
+static int bufpool_reclaim(uint64_t len);
+
+/***********************************************************************/
+void bufpool_set_budget(uint64_t budget)
+{
+    pthread_mutex_lock(&bufpool_lock);
+    bufpool_stats.budget = budget;
+    pthread_mutex_unlock(&bufpool_lock);
+}
+
+/***********************************************************************/
+struct msgbuf * bufpool_get(int size)
+{
+    static long page;
+    struct bufpool_idle * idle;
+    struct msgbuf * mbuf = NULL;
+    int len, class;
+
+    if (page == 0)
+        page = sysconf(_SC_PAGESIZE);
+    len = (size + page - 1) / page * page;
+    class = bufpool_class(len);
+    pthread_mutex_lock(&bufpool_lock);
+    // rings of a class usually all have the same size, but a switch's
+    //  largest ring is cut to its buffer size
+    idle = bufpool_idle[class];
+    if (idle && idle->mbuf->len == len)
+    {
+        mbuf = idle->mbuf;
+        bufpool_idle[class] = idle->next;
+        idle->next = bufpool_spare;
+        bufpool_spare = idle;
+    }
+    else if (bufpool_reclaim(len))
+    {
+        mbuf = msgbuf_try_new(len);
+        if (mbuf)
+        {
+            bufpool_stats.mapped += mbuf->len;
+            if (bufpool_stats.mapped > bufpool_stats.peak)
+                bufpool_stats.peak = bufpool_stats.mapped;
+        }
+        else if (!bufpool_warned++)
+            fprintf(stderr, "bufpool: can't map another %d byte ring (%s); switches wait for rings to come back"
+                    " (every ring takes two mappings, see vm.max_map_count)\n", len, strerror(errno));
+    }
+    if (mbuf == NULL)
+        bufpool_stats.refused++;
+    pthread_mutex_unlock(&bufpool_lock);
+    return mbuf;
+}
+
+/***********************************************************************/
+void bufpool_put(struct msgbuf * mbuf)
+{
+    int class = bufpool_class(mbuf->len);
+    struct bufpool_idle * idle;
+
+    assert(!msgbuf_zerocopy_pending(mbuf));
+    msgbuf_reset(mbuf);
+    pthread_mutex_lock(&bufpool_lock);
+    idle = bufpool_spare;
+    if (idle)
+        bufpool_spare = idle->next;
+    else
+    {
+        idle = malloc(sizeof(*idle));
+        assert(idle);
+    }
+    idle->mbuf = mbuf;
+    idle->next = bufpool_idle[class];
+    bufpool_idle[class] = idle;
+    pthread_mutex_unlock(&bufpool_lock);
+}
+
+/***********************************************************************/
+void bufpool_get_stats(struct bufpool_stats * stats)
+{
+    pthread_mutex_lock(&bufpool_lock);
+    *stats = bufpool_stats;
+    bufpool_stats.peak = bufpool_stats.mapped;
+    bufpool_stats.refused = 0;
+    pthread_mutex_unlock(&bufpool_lock);
+}
+
+/***********************************************************************
+ * Smallest class whose rings hold len bytes
+ */
+static int bufpool_class(int len)
+{
+    int class = 0;
+    while (((long) BUFPOOL_MIN << class) < len)
+        class++;
+    assert(class < BUFPOOL_CLASSES);
+    return class;
+}
+
+/***********************************************************************
+ * Unmap idle rings, largest first, until len more bytes fit the budget
+ *  Called with the lock held
+ * @return  1 if they fit, else 0
+ */
+static int bufpool_reclaim(uint64_t len)
+{
+    struct bufpool_idle * idle;
+    int class = BUFPOOL_CLASSES - 1;
+
+    while (bufpool_stats.budget > 0 && bufpool_stats.mapped + len > bufpool_stats.budget)
+    {
+        while (class >= 0 && bufpool_idle[class] == NULL)
+            class--;
+        if (class < 0)
+            return 0;
+        idle = bufpool_idle[class];
+        bufpool_idle[class] = idle->next;
+        bufpool_stats.mapped -= idle->mbuf->len;
+        msgbuf_free(idle->mbuf);
+        idle->next = bufpool_spare;
+        bufpool_spare = idle;
+    }
+    return 1;
+}
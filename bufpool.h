@@ -0,0 +1,45 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdint.h>
+
+#include "msgbuf.h"
+
+#define BUFPOOL_MIN         4096        // smallest ring handed out, one page
+#define BUFPOOL_CLASSES     19          // idle rings are kept by size, BUFPOOL_MIN << 0 .. 18 bytes
+
+/* how much the rings of the pool take */
+struct bufpool_stats
+{
+    uint64_t mapped;                    // bytes of all rings, handed out or idle in the pool
+    uint64_t peak;                      // most bytes mapped at once since the last bufpool_get_stats()
+    uint64_t budget;                    // cap on mapped; 0 = none
+    unsigned long refused;              // rings not handed out since the last bufpool_get_stats()
+};
+
+/* Rings shared by all switches of all threads
+ *  A switch only holds an output ring while it has data queued, so
+ *  idle switches cost no ring at all and busy ones recycle each other's.
+ *  Once the budget is reached, idle rings of other sizes are unmapped
+ *  to make room; if that is not enough, the request is refused and the
+ *  switch waits, like a switch whose output buffer is full.
+ */
+
+/*** Cap the bytes mapped for rings
+ * @param budget    Bytes; 0 = no cap (the default)
+ */
+void bufpool_set_budget(uint64_t budget);
+
+/*** Take an empty ring from the pool, mapping a new one if none is idle
+ * @param size      Capacity in bytes; rounded up to a multiple of the page size
+ * @return          The ring, or NULL if the budget (or the kernel) refuses it
+ */
+struct msgbuf * bufpool_get(int size);
+
+/*** Give a ring back to the pool; no zerocopy send from it may be pending */
+void bufpool_put(struct msgbuf * mbuf);
+
+/*** Copy the pool's counters to stats and start the next peak and refused counts */
+void bufpool_get_stats(struct bufpool_stats * stats);
+
+#endif
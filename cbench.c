@@ -21,14 +21,23 @@
 #include "pof.h"
 
 #include "myargs.h"
+#include "bufpool.h"
 #include "cbench.h"
+#include "fairness.h"
 #include "fakeswitch.h"
+#include "histogram.h"
+#include "reflector.h"
+#include "report.h"
+#include "search.h"
+#include "sources.h"
+#include "storm.h"
+#include "worker.h"
 
 
 
 
 struct myargs my_options[] = {
-    {"controller",  'c', "hostname of controller to connect to", MYARGS_STRING, {.string = "localhost"}},
+    {"controller",  'c', "hostname of controller to connect to, optionally with :port; a comma separated list splits the switches among them (or, with --cluster, connects every switch to each)", MYARGS_STRING, {.string = "localhost"}},
     {"debug",       'd', "enable debugging", MYARGS_FLAG, {.flag = 0}},
     {"help",        'h', "print this message", MYARGS_NONE, {.none = 0}},
     {"loops",       'l', "loops per test",   MYARGS_INTEGER, {.integer = 16}},
@@ -46,39 +55,99 @@ struct myargs my_options[] = {
     {"learn-dst-macs",  'L', "send gratuitious ARP replies to learn destination macs before testing", MYARGS_FLAG, {.flag = 0}},
     {"dpid-offset",  'o', "switch DPID offset", MYARGS_INTEGER, {.integer = 1}},
     {"max-send-count",  'x', "maximum number of requests sent to controller per test", MYARGS_INTEGER, {.integer = MAX_SEND_COUNT}},
+    {"threads",  'T', "number of threads driving the fake switches", MYARGS_INTEGER, {.integer = 1}},
+    {"engine",  'e', "I/O engine driving the sockets: poll, epoll or io_uring", MYARGS_STRING, {.string = "poll"}},
+    {"zerocopy",  'Z', "send with MSG_ZEROCOPY once this many bytes are queued (0 = off)", MYARGS_INTEGER, {.integer = 0}},
+    {"rate",  'R', "open loop: offer this many packet_ins per second over all switches (0 = closed loop)", MYARGS_INTEGER, {.integer = 0}},
+    {"buffer-size",  'b', "largest size each switch's output ring buffer grows to while data is queued (in KB)", MYARGS_INTEGER, {.integer = 256}},
+    {"memory-budget",  'B', "cap on the memory all switches' output buffers may take together (in MB; 0 = no cap)", MYARGS_INTEGER, {.integer = 0}},
+    {"storm",  'S', "connect all switches concurrently at this many connections/s and time the handshakes (-1 = all at once, 0 = off)", MYARGS_INTEGER, {.integer = 0}},
+    {"arrivals",  'A', "spacing of the open-loop packet_ins: constant, poisson or trace (the --pcap file's, at -R or its own rate)", MYARGS_STRING, {.string = "constant"}},
+    {"window",  'W', "throughput mode: probes each switch keeps in flight (0 = as many as the buffer takes; the upper bound with --aimd)", MYARGS_INTEGER, {.integer = 0}},
+    {"aimd",  'a', "throughput mode: adapt the window, halving it when RTT rises this many percent over its lowest (0 = off)", MYARGS_INTEGER, {.integer = 0}},
+    {"slo-latency",  'P', "search for the highest open-loop rate whose round trip time stays under this many us (0 = no search; -R is the first rate tried)", MYARGS_INTEGER, {.integer = 0}},
+    {"slo-quantile",  'Q', "search: round trip time quantile the latency limit applies to, in percent", MYARGS_STRING, {.string = "99"}},
+    {"slo-ratio",  'Y', "search: percentage of the offered packet_ins that must be answered", MYARGS_STRING, {.string = "99"}},
+    {"pcap",  'f', "take the packet_in payloads from the Ethernet frames of this pcap file", MYARGS_STRING, {.string = ""}},
+    {"mix",  'X', "send a weighted mix of messages in place of the packet_ins, e.g. packet_in:90,echo:4,port_status:2,flow_removed:2,resource_report:2", MYARGS_STRING, {.string = ""}},
+    {"calibrate",  'K', "measure pof-cbench's own ceiling against a built-in reflector on 127.0.0.1, with every engine and 1..$threads threads", MYARGS_FLAG, {.flag = 0}},
+    {"output",  'O', "also write one record per test and per run to this file", MYARGS_STRING, {.string = ""}},
+    {"output-format",  'F', "format of the --output file: jsonl or csv", MYARGS_STRING, {.string = "jsonl"}},
+    {"cluster",  'G', "connect every switch to every --controller, follow their MASTER/SLAVE roles and time mastership failovers", MYARGS_FLAG, {.flag = 0}},
+    {"source-addrs",  'u', "spread the connections round-robin over these local IPv4 addresses, e.g. 127.0.0.1-127.0.0.8,10.0.0.5", MYARGS_STRING, {.string = ""}},
+    {"reconnect",  'j', "reconnect a switch that lost its connection after this many ms, doubling the wait after each failed attempt (0 = exit instead)", MYARGS_INTEGER, {.integer = 0}},
+    {"reconnect-max",  'J', "reconnect: longest wait between two attempts (in ms)", MYARGS_INTEGER, {.integer = 1000}},
+    {"flow-table",  'E', "emulate an exact-match flow table of this many entries per switch, filled by FLOW_MODs: packets that hit an entry are forwarded instead of sent as packet_ins (0 = off)", MYARGS_INTEGER, {.integer = 0}},
+    {"echo-rate",  'H', "echo lane: send this many ECHO_REQUESTs per second on every connection, their round trip times kept apart from the packet_ins' (0 = off)", MYARGS_INTEGER, {.integer = 0}},
+    {"source-ports",  'U', "bind the connections to local ports from this range, e.g. 20000-59999 (default: the kernel picks)", MYARGS_STRING, {.string = ""}},
     {0, 0, 0, 0}
 };
 
 /*******************************************************************/
-double run_test(int n_fakeswitches, struct fakeswitch * fakeswitches, int mstestlen, int delay)
+double run_test(int n_fakeswitches, struct fakeswitch * fakeswitches, struct worker * workers, int n_workers,
+        int mstestlen, int delay, struct histogram * rtt_hist, struct fairness * fair, struct report * report)
 {
+    struct test_result result;
     struct timeval now, then, diff;
-    struct  pollfd  * pollfds;
-    int i;
+    struct switch_counts * counts;
+    struct io_stats io;
+    struct match_stats match;
+    struct mix_counts mix;
+    struct bufpool_stats pool;
+    struct failover_stats failover;
+    struct reconnect_stats reconnect;
+    struct flow_stats flows;
+    struct echo_stats echo;
+    struct histogram echo_hist;     // round trip times of the echo lane
+    unsigned long syscalls = 0;
+    int messages = 0;
+    int sent = 0;
+    int matched = 0;
+    unsigned long skipped = 0;
+    unsigned long window_increases = 0, window_decreases = 0;
+    int window_min = 0, window_max = 0;
+    double window_sum = 0;
+    long mem_peak_max = 0;
+    double mem_peak_sum = 0;
+    int i, j, k;
     double sum = 0;
+    double cpu_time = 0;
     double passed;
-    int count;
-    int send_count;
+    int n_connections = n_fakeswitches;
+    int group = fakeswitches[0].cluster ? fakeswitches[0].cluster->n_members : 1;
 
     int total_wait = mstestlen + delay;
     time_t tNow;
     struct tm *tmNow;
-    pollfds = malloc(n_fakeswitches * sizeof(struct pollfd));
-    assert(pollfds);
+    counts = malloc(n_fakeswitches * sizeof(struct switch_counts));
+    assert(counts);
     gettimeofday(&then,NULL);
-    while(1)
+    n_workers = workers_run_test(workers, n_workers, fakeswitches, n_fakeswitches, counts, total_wait);
+    gettimeofday(&now, NULL);
+    timersub(&now, &then, &diff);
+    for (i = 0; i < n_connections; i++)
     {
-        gettimeofday(&now, NULL);
-        timersub(&now, &then, &diff);
-        if( (1000* diff.tv_sec  + (float)diff.tv_usec/1000)> total_wait)
-            break;
-        for(i = 0; i< n_fakeswitches; i++)
-            fakeswitch_set_pollfd(&fakeswitches[i], &pollfds[i]);
-
-        poll(pollfds, n_fakeswitches, 1000);      // block until something is ready or 100ms passes
-
-        for(i = 0; i< n_fakeswitches; i++)
-            fakeswitch_handle_io(&fakeswitches[i], &pollfds[i]);
+        fakeswitches[i].totoal_recv_count += counts[i].recv_count;
+        fakeswitches[i].total_send_count += counts[i].send_count;
+    }
+    if (group > 1)
+    {
+        // a switch connected to a controller cluster is one switch
+        n_fakeswitches = n_connections / group;
+        for (i = 0; i < n_fakeswitches; i++)
+        {
+            counts[i] = counts[i * group];
+            for (j = 1; j < group; j++)
+            {
+                counts[i].recv_count += counts[i * group + j].recv_count;
+                counts[i].send_count += counts[i * group + j].send_count;
+                counts[i].mem_peak += counts[i * group + j].mem_peak;
+                if (counts[i * group + j].window > counts[i].window)
+                    counts[i].window = counts[i * group + j].window;
+                if (counts[i * group + j].down_ms > counts[i].down_ms)
+                    counts[i].down_ms = counts[i * group + j].down_ms;
+            }
+        }
     }
     tNow = now.tv_sec;
     tmNow = localtime(&tNow);
@@ -86,25 +155,366 @@ double run_test(int n_fakeswitches, struct fakeswitch * fakeswitches, int mstest
     usleep(100000); // sleep for 100 ms, to let packets queue
     for( i = 0 ; i < n_fakeswitches; i++)
     {
-        count = fakeswitch_get_recv_count(&fakeswitches[i]);
-        send_count = fakeswitch_get_send_count(&fakeswitches[i]);
-        printf("%d", count);
-        printf("/%d  ", send_count);
-        sum += count;
-        fakeswitches[i].totoal_recv_count += count;
-        fakeswitches[i].total_send_count += send_count;
+        printf("%d", counts[i].recv_count);
+        printf("/%d  ", counts[i].send_count);
+        if (i == 0 || counts[i].window < window_min)
+            window_min = counts[i].window;
+        if (counts[i].window > window_max)
+            window_max = counts[i].window;
+        window_sum += counts[i].window;
+        if (counts[i].mem_peak > mem_peak_max)
+            mem_peak_max = counts[i].mem_peak;
+        mem_peak_sum += counts[i].mem_peak;
     }
-    for (i = 0; i < n_fakeswitches; i++) {
-
+    bufpool_get_stats(&pool);
+    // merge the per-thread counters
+    histogram_reset(rtt_hist);
+    memset(&io, 0, sizeof(io));
+    memset(&match, 0, sizeof(match));
+    memset(&mix, 0, sizeof(mix));
+    memset(&failover, 0, sizeof(failover));
+    memset(&reconnect, 0, sizeof(reconnect));
+    memset(&flows, 0, sizeof(flows));
+    memset(&echo, 0, sizeof(echo));
+    histogram_reset(&echo_hist);
+    for (i = 0; i < n_workers; i++)
+    {
+        sum += workers[i].recv_count;
+        matched += workers[i].recv_count;
+        messages += workers[i].recv_count + workers[i].send_count;
+        sent += workers[i].send_count;
+        skipped += workers[i].pace_skipped;
+        histogram_merge(rtt_hist, &workers[i].rtt_hist);
+        io.reads += workers[i].io.reads;
+        io.writes += workers[i].io.writes;
+        io.reaps += workers[i].io.reaps;
+        io.zc_sends += workers[i].io.zc_sends;
+        io.zc_copied += workers[i].io.zc_copied;
+        match.unmatched += workers[i].match.unmatched;
+        match.duplicates += workers[i].match.duplicates;
+        match.late += workers[i].match.late;
+        match.timed_out += workers[i].match.timed_out;
+        for (j = 0; j < WORKLOAD_TYPES; j++)
+        {
+            mix.sent[j] += workers[i].mix.sent[j];
+            mix.answered[j] += workers[i].mix.answered[j];
+        }
+        syscalls += workers[i].event_syscalls;
+        cpu_time += workers[i].cpu_time;
+        window_increases += workers[i].window_increases;
+        window_decreases += workers[i].window_decreases;
+        failover.role_changes += workers[i].failover.role_changes;
+        failover.connections_lost += workers[i].failover.connections_lost;
+        failover.failovers += workers[i].failover.failovers;
+        failover.failover_sum += workers[i].failover.failover_sum;
+        if (workers[i].failover.failover_max > failover.failover_max)
+            failover.failover_max = workers[i].failover.failover_max;
+        failover.with_master += workers[i].failover.with_master;
+        failover.equal_only += workers[i].failover.equal_only;
+        failover.without_master += workers[i].failover.without_master;
+        failover.failing_over += workers[i].failover.failing_over;
+        reconnect_stats_add(&reconnect, &workers[i].reconnect);
+        flows.entries += workers[i].flows.entries;
+        flows.installed += workers[i].flows.installed;
+        flows.removed += workers[i].flows.removed;
+        flows.refused += workers[i].flows.refused;
+        flows.forwarded += workers[i].flows.forwarded;
+        flows.missed += workers[i].flows.missed;
+        flows.converged += workers[i].flows.converged;
+        flows.convergence_sum += workers[i].flows.convergence_sum;
+        if (workers[i].flows.convergence_max > flows.convergence_max)
+            flows.convergence_max = workers[i].flows.convergence_max;
+        echo.sent += workers[i].echo.sent;
+        echo.answered += workers[i].echo.answered;
+        echo.lost += workers[i].echo.lost;
+        histogram_merge(&echo_hist, &workers[i].echo_hist);
     }
+    syscalls += io.reads + io.writes + io.reaps;
     passed = 1000 * diff.tv_sec + (double)diff.tv_usec/1000;   
     passed -= delay;        // don't count the time we intentionally delayed
+    fairness_compute(fair, counts, n_fakeswitches, passed);
+    if (report)
+    {
+        result.n_fakeswitches = n_fakeswitches;
+        result.counts = counts;
+        result.ms = passed;
+        result.responses = sum;
+        result.requests = sent;
+        result.rtt_hist = rtt_hist;
+        result.syscalls = syscalls;
+        result.cpu_time = cpu_time;
+        result.fairness = fair;
+        result.window_min = window_min;
+        result.window_avg = window_sum / n_fakeswitches;
+        result.window_max = window_max;
+        result.match = match;
+        result.mix = fakeswitches[0].workload ? &mix : NULL;
+        result.mem_peak_avg = mem_peak_sum / n_fakeswitches;
+        result.mem_peak_max = mem_peak_max;
+        result.pool = pool;
+        result.failover = group > 1 ? &failover : NULL;
+        result.reconnect = fakeswitches[0].reconnect ? &reconnect : NULL;
+        result.flows = fakeswitches[0].flows.capacity > 0 ? &flows : NULL;
+        result.echo = workers[0].echo_rate > 0 ? &echo : NULL;
+        result.echo_hist = &echo_hist;
+        report_test(report, &result);
+    }
     sum /= passed;  // is now per ms
     printf(" total = %lf per ms \n", sum);
-    free(pollfds);
+    if (workers[0].rate > 0)
+        printf("    open loop: %d packet_in/s offered, %.0lf sent, %lu arrivals skipped"
+                " (switch not ready, out of sends or output buffer full)\n",
+                workers[0].rate, sent * 1000.0 / passed, skipped);
+    if (rtt_hist->count > 0)
+    {
+        printf("    round trip time ");
+        histogram_print_latency(stdout, rtt_hist);
+        printf("\n");
+    }
+    if (workers[0].echo_rate > 0)
+    {
+        // the controller's I/O path alone; a gap to the packet_ins' is application time
+        printf("    echo round trip time ");
+        histogram_print_latency(stdout, &echo_hist);
+        printf("; %lu sent, %lu answered, %lu lost\n", echo.sent, echo.answered, echo.lost);
+    }
+    // latency mode is always a window of 1; only other windows are worth a line
+    if (window_max > 1 || window_increases > 0 || window_decreases > 0)
+        printf("    window: min/avg/max = %d/%.1lf/%d probes in flight, %lu aimd increases, %lu decreases\n",
+                window_min, window_sum / n_fakeswitches, window_max, window_increases, window_decreases);
+    // only matched responses count; the rest would inflate the rate
+    printf("    responses: %d matched, %lu unmatched, %lu duplicate, %lu late (probe timed out); %lu probes timed out\n",
+            matched, match.unmatched, match.duplicates, match.late, match.timed_out);
+    if (fakeswitches[0].workload)
+    {
+        printf("    mix per s:");
+        for (j = 0, k = 0; j < WORKLOAD_TYPES; j++)
+        {
+            if (fakeswitches[0].workload->weights[j] == 0)
+                continue;
+            printf("%s %s %.0lf sent", k++ ? "," : "", workload_type_name(j), mix.sent[j] * 1000.0 / passed);
+            if (workload_type_answered(j))
+                printf(" %.0lf answered (%.1lf%%)", mix.answered[j] * 1000.0 / passed,
+                        mix.sent[j] ? 100.0 * mix.answered[j] / mix.sent[j] : 0.0);
+        }
+        printf("\n");
+    }
+    printf("    memory: peak %.0lf bytes per switch on average, %ld at most; output rings peaked at %.1lf MB",
+            mem_peak_sum / n_fakeswitches, mem_peak_max, pool.peak / 1048576.0);
+    if (pool.budget > 0)
+        printf(" of the %.0lf MB budget", pool.budget / 1048576.0);
+    if (pool.refused > 0)
+        printf(", %lu rings refused", pool.refused);
+    printf("\n");
+    if (group > 1)
+    {
+        printf("    mastership: %d switches probing a MASTER, %d an EQUAL controller, %d without;"
+                " %lu role changes, %lu connections lost",
+                failover.with_master, failover.equal_only, failover.without_master,
+                failover.role_changes, failover.connections_lost);
+        if (failover.failovers > 0)
+            printf("; %lu failovers, responses resumed after %.1lf ms on average, %.1lf ms at most",
+                    failover.failovers, failover.failover_sum / 1e6 / failover.failovers,
+                    failover.failover_max / 1e6);
+        if (failover.failing_over > 0)
+            printf("; %d switches still failing over", failover.failing_over);
+        printf("\n");
+    }
+    if (fakeswitches[0].reconnect)
+    {
+        printf("    reconnects: %lu connections lost, %lu connect attempts, %lu handshakes redone",
+                reconnect.losses, reconnect.attempts, reconnect.handshakes);
+        if (reconnect.handshakes > 0)
+            printf("; down %.1lf ms on average, %.1lf ms at most", reconnect.outage_sum / 1e6 / reconnect.handshakes,
+                    reconnect.outage_max / 1e6);
+        if (reconnect.recoveries > 0)
+            printf("; back to %d%% of their response rate %.1lf ms after the loss on average, %.1lf ms at most",
+                    RECOVERED_PERCENT, reconnect.recovery_sum / 1e6 / reconnect.recoveries, reconnect.recovery_max / 1e6);
+        if (reconnect.down > 0)
+            printf("; %d connections still down", reconnect.down);
+        printf("\n");
+    }
+    if (fakeswitches[0].flows.capacity > 0)
+    {
+        printf("    flow table: %d entries, %lu installed, %lu removed, %lu refused; %lu packets forwarded, %lu missed (%.2lf%%)",
+                flows.entries, flows.installed, flows.removed, flows.refused, flows.forwarded, flows.missed,
+                flows.forwarded + flows.missed ? 100.0 * flows.missed / (flows.forwarded + flows.missed) : 0.0);
+        if (flows.converged > 0)
+            printf("; %lu switches down to %d%% misses after %.1lf ms on average, %.1lf ms at most",
+                    flows.converged, CONVERGED_MISS_PERCENT, flows.convergence_sum / 1e6 / flows.converged,
+                    flows.convergence_max / 1e6);
+        printf("\n");
+    }
+    printf("    fairness: ");
+    fairness_print(stdout, fair, counts);
+    printf("\n");
+    printf("    syscalls per message = %.3lf (%lu read, %lu sendmsg, %lu event loop",
+            messages ? (double) syscalls / messages : 0.0,
+            io.reads, io.writes, syscalls - io.reads - io.writes - io.reaps);
+    if (io.zc_sends > 0 || io.reaps > 0)
+        printf(", %lu zerocopy completion reaps; %lu zerocopy sends, %lu copied by the kernel",
+                io.reaps, io.zc_sends, io.zc_copied);
+    printf(")\n");
+    // compares engines per core rather than per wall-clock second
+    printf("    cpu time = %.3lf s in %d thread(s), %.0lf responses per cpu-second\n",
+            cpu_time, n_workers, cpu_time > 0 ? sum * passed / cpu_time : 0.0);
+    free(counts);
     return sum;
 }
 
+/*******************************************************************
+ * Run tests_per_loop tests and sum up the counted ones, i.e., all but
+ *  the warmup and cooldown tests, into one run record; responses and
+ *  requests are those of all tests of the run
+ * @param run       Filled on return; run->rtt_hist points to run_hist
+ * @param run_hist  Round trip times of the counted tests
+ */
+void run_tests(struct run_result * run, struct histogram * run_hist,
+        int n_fakeswitches, struct fakeswitch * fakeswitches, struct worker * workers, int n_workers,
+        int tests_per_loop, int warmup, int cooldown, int mstestlen, int delay, struct report * report)
+{
+    struct histogram test_hist;     // round trip times of one test
+    struct fairness fair;
+    double * results = malloc(tests_per_loop * sizeof(double));
+    double v;
+    int i, j;
+    int group = fakeswitches[0].cluster ? fakeswitches[0].cluster->n_members : 1;
+
+    assert(results);
+    histogram_reset(run_hist);
+    run->n_fakeswitches = n_fakeswitches / group;  // a switch connected to a cluster is one switch
+    run->counted_tests = tests_per_loop - warmup - cooldown;
+    run->min = DBL_MAX;
+    run->max = run->avg = 0;
+    run->jain_min = 1.0;
+    run->jain_avg = 0;
+    run->cv_max = 0;
+    run->rtt_hist = run_hist;
+    run->responses = run->requests = 0;
+    for (i = 0; i < n_fakeswitches; i++)
+    {
+        run->responses -= fakeswitches[i].totoal_recv_count;
+        run->requests -= fakeswitches[i].total_send_count;
+    }
+    for (j = 0; j < tests_per_loop; j++)
+    {
+        v = 1000.0 * run_test(n_fakeswitches, fakeswitches, workers, n_workers, mstestlen, delay,
+                &test_hist, &fair, report);
+        delay = 0;      // only delay on the first run
+        results[j] = v;
+        if (j < warmup || j >= tests_per_loop - cooldown)
+            continue;
+        histogram_merge(run_hist, &test_hist);
+        run->avg += v / run->counted_tests;
+        if (v < run->min)
+            run->min = v;
+        if (v > run->max)
+            run->max = v;
+        run->jain_avg += fair.jain / run->counted_tests;
+        if (fair.jain < run->jain_min)
+            run->jain_min = fair.jain;
+        if (fair.cv > run->cv_max)
+            run->cv_max = fair.cv;
+    }
+    run->stdev = 0;
+    for (j = warmup; j < tests_per_loop - cooldown; j++)
+        run->stdev += pow(results[j] - run->avg, 2) / run->counted_tests;
+    run->stdev = sqrt(run->stdev);
+    for (i = 0; i < n_fakeswitches; i++)
+    {
+        run->responses += fakeswitches[i].totoal_recv_count;
+        run->requests += fakeswitches[i].total_send_count;
+    }
+    if (report)
+        report_run(report, run);
+    free(results);
+}
+
+/*******************************************************************
+ * Saturation search: run tests_per_loop tests at every rate the search
+ *  picks, and judge the counted tests of each step against the SLO
+ * @return  Highest rate that met the SLO, 0 if none did
+ */
+int run_search(struct search * search, int n_fakeswitches, struct fakeswitch * fakeswitches,
+        struct worker * workers, int n_workers, enum arrival_process arrivals,
+        int tests_per_loop, int warmup, int cooldown, int mstestlen, int delay, struct report * report)
+{
+    struct histogram step_hist;     // round trip times of the counted tests of a step
+    struct run_result run;
+    double ratio;
+    int met;
+
+    while (!search->done)
+    {
+        workers_set_rate(workers, n_workers, search->rate, arrivals);
+        if (report)
+            report_param_int(report, "rate", search->rate);
+        run_tests(&run, &step_hist, n_fakeswitches, fakeswitches, workers, n_workers,
+                tests_per_loop, warmup, cooldown, mstestlen, delay, report);
+        delay = 0;
+        // what came back against what the schedule offered
+        ratio = run.avg / search->rate;
+        printf("SEARCH: step %d: %d packet_in/s offered, %.0lf answered/s (%.2lf%%), p%g round trip time = %.1lf us",
+                search->steps + 1, search->rate, run.avg, 100.0 * ratio, 100.0 * search->quantile,
+                histogram_quantile(&step_hist, search->quantile) / 1000.0);
+        met = search_judge(search, &step_hist, ratio);
+        printf(": SLO %s\n", met ? "met" : "missed");
+    }
+    return search->passed;
+}
+
+/*******************************************************************
+ * Calibration: run tests_per_loop tests against the built-in reflector
+ *  with every compiled-in engine and 1, 2, 4, ... max_workers threads,
+ *  and report the best
+ */
+void run_calibration(int n_fakeswitches, struct fakeswitch * fakeswitches, struct worker * workers, int max_workers,
+        int rate, enum arrival_process arrivals,
+        int tests_per_loop, int warmup, int cooldown, int mstestlen, int delay, struct report * report)
+{
+    struct histogram run_hist;
+    struct run_result run;
+    double best = 0;
+    int best_engine = ENGINE_POLL, best_workers = 1;
+    int engine, n;
+
+    if (max_workers > n_fakeswitches)
+        max_workers = n_fakeswitches;   // more threads than switches would sit idle
+    for (engine = ENGINE_POLL; engine <= ENGINE_URING; engine++)
+    {
+        if (!io_engine_available(engine))
+            continue;
+        for (n = 1; n <= max_workers; n = n < max_workers && n * 2 > max_workers ? max_workers : n * 2)
+        {
+            workers_init(workers, n, engine);
+            workers_set_rate(workers, n, rate, arrivals);
+            if (report)
+            {
+                report_param_string(report, "engine", io_engine_name(engine));
+                report_param_int(report, "threads", n);
+            }
+            run_tests(&run, &run_hist, n_fakeswitches, fakeswitches, workers, n,
+                    tests_per_loop, warmup, cooldown, mstestlen, delay, report);
+            delay = 0;
+            printf("CALIBRATION: %d switches %s engine %d thread(s) %d tests "
+                    "min/max/avg/stdev = %.2lf/%.2lf/%.2lf/%.2lf responses/s, round trip time ",
+                    n_fakeswitches, io_engine_name(engine), n, run.counted_tests,
+                    run.min, run.max, run.avg, run.stdev);
+            histogram_print_latency(stdout, &run_hist);
+            printf("\n");
+            if (run.avg > best)
+            {
+                best = run.avg;
+                best_engine = engine;
+                best_workers = n;
+            }
+        }
+    }
+    printf("CEILING: %d switches %.2lf responses/s with the %s engine and %d thread(s),"
+            " sharing the CPUs with the reflector\n",
+            n_fakeswitches, best, io_engine_name(best_engine), best_workers);
+}
+
 /********************************************************************************/
 
 int timeout_connect(int fd, const char * hostname, int port, int mstimeout) {
@@ -183,10 +593,9 @@ int timeout_connect(int fd, const char * hostname, int port, int mstimeout) {
 }
 
 /********************************************************************************/
-int make_tcp_connection_from_port(const char * hostname, unsigned short port, unsigned short sport,
+int make_tcp_connection_from(const char * hostname, unsigned short port, struct sources * sources,
         int mstimeout, int nodelay)
 {
-    struct sockaddr_in local;
     int s;
     int err;
     int zero = 0;
@@ -202,14 +611,9 @@ int make_tcp_connection_from_port(const char * hostname, unsigned short port, un
         fprintf(stderr,"make_tcp_connection::Unable to disable Nagle's algorithm\n");
         exit(1);
     }
-    local.sin_family=PF_INET;
-    local.sin_addr.s_addr=INADDR_ANY;
-    local.sin_port=htons(sport);
-
-    err=bind(s,(struct sockaddr *)&local, sizeof(local));
-    if(err)
+    if(sources_bind(sources, s) < 0)
     {
-        perror("make_tcp_connection_from_port::bind");
+        close(s);
         return -4;
     }
 
@@ -227,7 +631,41 @@ int make_tcp_connection_from_port(const char * hostname, unsigned short port, un
 /********************************************************************************/
 int make_tcp_connection(const char * hostname, unsigned short port, int mstimeout, int nodelay)
 {
-    return make_tcp_connection_from_port(hostname,port, INADDR_ANY, mstimeout, nodelay);
+    struct sources any;
+
+    memset(&any, 0, sizeof(any));
+    return make_tcp_connection_from(hostname,port, &any, mstimeout, nodelay);
+}
+
+/********************************************************************************
+ * Where a switch reconnects to: the controller it first connected to
+ */
+void reconnect_policy_init(struct reconnect_policy * policy, const char * hostname, int port,
+        struct sources * sources, int backoff_min, int backoff_max)
+{
+    struct addrinfo hints;
+    struct addrinfo * res = NULL;
+    char sport[16];
+    int err;
+
+    memset(policy, 0, sizeof(*policy));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    snprintf(sport, sizeof(sport), "%d", port);
+    err = getaddrinfo(hostname, sport, &hints, &res);
+    if (err || res == NULL)
+    {
+        fprintf(stderr, "Error can't resolve %s to reconnect to: %s\n", hostname, gai_strerror(err));
+        exit(1);
+    }
+    memcpy(&policy->addr, res->ai_addr, res->ai_addrlen);
+    policy->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    policy->sources = sources;
+    policy->backoff_min = backoff_min;
+    policy->backoff_max = backoff_max;
 }
 
 /********************************************************************************/
@@ -242,14 +680,17 @@ int count_bits(int n)
 }
 /********************************************************************************/
 
-int raw_controller_hostname_split(char * raw_controller_hostname, char * controller_hostname_list[]) {
+int raw_controller_hostname_split(char * raw_controller_hostname, char *** controller_hostname_list) {
     char * split = ",";
-    char * substr = strtok(raw_controller_hostname, split);
+    char * substr;
 
     int controller_numbers = 0;
 
+    *controller_hostname_list = malloc(((strlen(raw_controller_hostname) + 1) / 2 + 1) * sizeof(char *));   // names are at least one character
+    assert(*controller_hostname_list);
+    substr = strtok(raw_controller_hostname, split);
     while(substr != NULL) {
-        controller_hostname_list[controller_numbers] = substr;
+        (*controller_hostname_list)[controller_numbers] = substr;
         controller_numbers++;
         substr = strtok(NULL, split);
     }
@@ -262,11 +703,21 @@ int raw_controller_hostname_split(char * raw_controller_hostname, char * control
 int main(int argc, char * argv[])
 {
     struct  fakeswitch *fakeswitches;
+    struct  worker *workers;
 
     char *  controller_hostname = myargs_get_default_string(my_options,"controller");
-    char *  controller_hostname_list[10];  // all controller_hostname string in array
-    char    controller_hostname_array[200];
+    char ** controller_hostname_list;   // all controller_hostname string in array
+    char *  controller_hostname_array;
+    int *   controller_port_list;       // --port, unless the name came with its own
     int     controller_numbers;
+    int     cluster = myargs_get_default_flag(my_options, "cluster");
+    int     members = 1;                // connections per switch
+    struct  mastership * masterships = NULL;
+    int     reconnect = myargs_get_default_integer(my_options, "reconnect");
+    int     reconnect_max = myargs_get_default_integer(my_options, "reconnect-max");
+    struct  reconnect_policy * policies = NULL;     // one per controller
+    int     flow_table = myargs_get_default_integer(my_options, "flow-table");
+    int     echo_rate = myargs_get_default_integer(my_options, "echo-rate");
     int     controller_port = myargs_get_default_integer(my_options, "port");
     int     n_fakeswitches= myargs_get_default_integer(my_options, "switches");
     int     total_mac_addresses = myargs_get_default_integer(my_options, "mac-addresses");
@@ -282,8 +733,36 @@ int main(int argc, char * argv[])
     int     learn_dst_macs = myargs_get_default_flag(my_options, "learn-dst-macs");
     int     dpid_offset = myargs_get_default_integer(my_options, "dpid-offset");
     int     max_send_count = myargs_get_default_integer(my_options, "max-send-count");
+    int     n_threads = myargs_get_default_integer(my_options, "threads");
+    int     engine = io_engine_from_name(myargs_get_default_string(my_options, "engine"));
+    int     zerocopy = myargs_get_default_integer(my_options, "zerocopy");
+    int     window = myargs_get_default_integer(my_options, "window");
+    int     aimd = myargs_get_default_integer(my_options, "aimd");
+    int     rate = myargs_get_default_integer(my_options, "rate");
+    int     buffer_kb = myargs_get_default_integer(my_options, "buffer-size");
+    int     budget_mb = myargs_get_default_integer(my_options, "memory-budget");
+    int     storm_rate = myargs_get_default_integer(my_options, "storm");
+    int     connect_rate;
+    struct  storm storm;
+    char *  source_addrs = myargs_get_default_string(my_options, "source-addrs");
+    char *  source_ports = myargs_get_default_string(my_options, "source-ports");
+    struct  sources sources;
+    int     slo_us = myargs_get_default_integer(my_options, "slo-latency");
+    double  slo_quantile = atof(myargs_get_default_string(my_options, "slo-quantile"));
+    double  slo_ratio = atof(myargs_get_default_string(my_options, "slo-ratio"));
+    struct  search search;
+    int     calibrate = myargs_get_default_flag(my_options, "calibrate");
+    struct  reflector reflector;
+    char *  mix = myargs_get_default_string(my_options, "mix");
+    char *  pcap = myargs_get_default_string(my_options, "pcap");
+    struct  pcap_trace trace;
+    struct  workload workload;
+    char *  output = myargs_get_default_string(my_options, "output");
+    int     output_format = report_format_from_name(myargs_get_default_string(my_options, "output-format"));
+    struct  report report;
+    int     arrivals = arrival_process_from_name(myargs_get_default_string(my_options, "arrivals"));
     int     mode = MODE_LATENCY;
-    int     i,j,k;
+    int     i,k;
 
     FILE *fp = NULL;
     fp = fopen("result.txt", "a+");
@@ -313,6 +792,15 @@ int main(int argc, char * argv[])
             case 'L':
                 learn_dst_macs = 1;
                 break;
+            case 'K':
+                calibrate = 1;
+                break;
+            case 'X':
+                mix = strdup(optarg);
+                break;
+            case 'f':
+                pcap = strdup(optarg);
+                break;
             case 'l': 
                 tests_per_loop = atoi(optarg);
                 break;
@@ -325,6 +813,21 @@ int main(int argc, char * argv[])
             case 'r':
                 should_test_range = 1;
                 break;
+            case 'G':
+                cluster = 1;
+                break;
+            case 'j':
+                reconnect = atoi(optarg);
+                break;
+            case 'J':
+                reconnect_max = atoi(optarg);
+                break;
+            case 'E':
+                flow_table = atoi(optarg);
+                break;
+            case 'H':
+                echo_rate = atoi(optarg);
+                break;
             case 'p' : 
                 controller_port = atoi(optarg);
                 break;
@@ -355,6 +858,73 @@ int main(int argc, char * argv[])
             case 'x':
                 max_send_count = atoi(optarg);
                 break;
+            case 'T':
+                n_threads = atoi(optarg);
+                break;
+            case 'Z':
+                zerocopy = atoi(optarg);
+                break;
+            case 'W':
+                window = atoi(optarg);
+                break;
+            case 'a':
+                aimd = atoi(optarg);
+                break;
+            case 'P':
+                slo_us = atoi(optarg);
+                break;
+            case 'Q':
+                slo_quantile = atof(optarg);
+                break;
+            case 'Y':
+                slo_ratio = atof(optarg);
+                break;
+            case 'R':
+                rate = atoi(optarg);
+                break;
+            case 'b':
+                buffer_kb = atoi(optarg);
+                break;
+            case 'B':
+                budget_mb = atoi(optarg);
+                break;
+            case 'S':
+                storm_rate = atoi(optarg);
+                break;
+            case 'u':
+                source_addrs = strdup(optarg);
+                break;
+            case 'U':
+                source_ports = strdup(optarg);
+                break;
+            case 'O':
+                output = strdup(optarg);
+                break;
+            case 'F':
+                output_format = report_format_from_name(optarg);
+                if (output_format < 0) {
+                    fprintf(stderr, "Error unknown output format '%s'\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'A':
+                arrivals = arrival_process_from_name(optarg);
+                if (arrivals < 0) {
+                    fprintf(stderr, "Error unknown arrival process '%s'\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'e':
+                engine = io_engine_from_name(optarg);
+                if (engine < 0) {
+                    fprintf(stderr, "Error unknown I/O engine '%s'\n", optarg);
+                    exit(1);
+                }
+                if (!io_engine_available(engine)) {
+                    fprintf(stderr, "Error I/O engine '%s' was not compiled in (needs liburing)\n", optarg);
+                    exit(1);
+                }
+                break;
             default: 
                 myargs_usage(my_options, PROG_TITLE, "help message", NULL, 1);
         }
@@ -364,19 +934,185 @@ int main(int argc, char * argv[])
 		fprintf(stderr, "Error warmup(%d) + cooldown(%d) >= number of tests (%d)\n", warmup, cooldown, tests_per_loop);
 		exit(1);
 	}
+    if(n_threads < 1) {
+        fprintf(stderr, "Error threads(%d) must be at least 1\n", n_threads);
+        exit(1);
+    }
+    if(buffer_kb < 2 * BUFLEN / 1024) {
+        // a full-size message plus the throughput mode backlog must fit
+        fprintf(stderr, "Error buffer size(%d KB) must be at least %d KB\n", buffer_kb, 2 * BUFLEN / 1024);
+        exit(1);
+    }
+    if(budget_mb < 0) {
+        fprintf(stderr, "Error memory budget(%d MB) must not be negative\n", budget_mb);
+        exit(1);
+    }
+    if(reconnect < 0 || (reconnect > 0 && reconnect_max < reconnect)) {
+        fprintf(stderr, "Error reconnect(%d ms) must not be negative, nor more than reconnect-max(%d ms)\n",
+                reconnect, reconnect_max);
+        exit(1);
+    }
+    if(reconnect > 0 && engine == ENGINE_URING) {
+        fprintf(stderr, "Error --reconnect needs the poll or epoll engine\n");
+        exit(1);
+    }
+    if(flow_table < 0 || flow_table > FLOWTABLE_MAX_ENTRIES) {
+        fprintf(stderr, "Error flow table(%d entries) must be between 0 and %d\n", flow_table, FLOWTABLE_MAX_ENTRIES);
+        exit(1);
+    }
+    if(echo_rate < 0) {
+        fprintf(stderr, "Error echo rate(%d) must not be negative\n", echo_rate);
+        exit(1);
+    }
+    memset(&sources, 0, sizeof(sources));
+    if(source_addrs[0] && sources_parse_addrs(&sources, source_addrs) < 0) {
+        fprintf(stderr, "Error malformed source addresses '%s': expected IPv4 addresses or first-last ranges,"
+                " separated by commas, %d at most\n", source_addrs, SOURCES_MAX_ADDRS);
+        exit(1);
+    }
+    if(source_ports[0] && sources_parse_ports(&sources, source_ports) < 0) {
+        fprintf(stderr, "Error malformed source ports '%s': expected a port or a first-last range within 1-65535\n",
+                source_ports);
+        exit(1);
+    }
+    if(storm_rate != 0 && should_test_range) {
+        fprintf(stderr, "Error a connection storm brings up all switches at once; it can't test a range\n");
+        exit(1);
+    }
+    if((window != 0 || aimd != 0) && (mode != MODE_THROUGHPUT || rate > 0 || slo_us > 0)) {
+        fprintf(stderr, "Error --window and --aimd only apply to throughput mode (-t without -R or -P)\n");
+        exit(1);
+    }
+    if(window < 0 || aimd < 0) {
+        fprintf(stderr, "Error window(%d) and aimd(%d) must not be negative\n", window, aimd);
+        exit(1);
+    }
+    if(rate < 0) {
+        fprintf(stderr, "Error rate(%d) must not be negative\n", rate);
+        exit(1);
+    }
+    if(slo_us > 0 && should_test_range) {
+        fprintf(stderr, "Error the saturation search runs with all switches; it can't test a range\n");
+        exit(1);
+    }
+    if(calibrate && (slo_us > 0 || should_test_range)) {
+        fprintf(stderr, "Error calibration runs with all switches; it can't be combined with -P or -r\n");
+        exit(1);
+    }
+    if(calibrate) {
+        // the reflector stands in for the controller
+        reflector_start(&reflector, n_threads);
+        controller_hostname = "127.0.0.1";
+        controller_port = reflector.port;
+    }
+    if(slo_quantile <= 0 || slo_quantile > 100 || slo_ratio < 0 || slo_ratio > 100) {
+        fprintf(stderr, "Error slo-quantile(%g) and slo-ratio(%g) are percentages\n", slo_quantile, slo_ratio);
+        exit(1);
+    }
+
+    if(mix[0] && workload_parse(&workload, mix) < 0) {
+        fprintf(stderr, "Error malformed mix '%s': expected type:weight,... with types packet_in, echo,"
+                " port_status, flow_removed and resource_report, weights summing to at most %d\n",
+                mix, WORKLOAD_MAX_CYCLE);
+        exit(1);
+    }
+
+    if(pcap[0])
+        pcap_trace_open(&trace, pcap);
+    if(arrivals == ARRIVAL_TRACE) {
+        if(!pcap[0] || pcap_trace_rate(&trace) <= 0) {
+            fprintf(stderr, "Error trace arrivals need a --pcap file whose frames span some time\n");
+            exit(1);
+        }
+        if(rate == 0 && slo_us == 0)
+            rate = pcap_trace_rate(&trace) + 0.5 > 1 ? pcap_trace_rate(&trace) + 0.5 : 1;   // as captured
+    }
+
+    controller_hostname_array = strdup(controller_hostname);
+    controller_numbers = raw_controller_hostname_split(controller_hostname_array, &controller_hostname_list);
+    controller_port_list = malloc(controller_numbers * sizeof(int));
+    assert(controller_port_list);
+    for(k = 0; k < controller_numbers; k++) {
+        // one colon is a port; more make an IPv6 address
+        char * colon = strchr(controller_hostname_list[k], ':');
+        controller_port_list[k] = controller_port;
+        if(colon && colon == strrchr(controller_hostname_list[k], ':')) {
+            *colon = 0;
+            controller_port_list[k] = atoi(colon + 1);
+        }
+    }
+    if(cluster) {
+        if(should_test_range || rate > 0 || slo_us > 0 || calibrate) {
+            fprintf(stderr, "Error --cluster runs closed loop with all switches; it can't be combined with -r, -R, -P or -K\n");
+            exit(1);
+        }
+        if(engine == ENGINE_URING) {
+            fprintf(stderr, "Error --cluster needs the poll or epoll engine\n");
+            exit(1);
+        }
+        members = controller_numbers;
+    }
+    if(sources_capacity(&sources) > 0 && sources_capacity(&sources) < (uint64_t) n_fakeswitches * members) {
+        fprintf(stderr, "Error %d connections need more than the %llu source address and port pairs given\n",
+                n_fakeswitches * members, (unsigned long long) sources_capacity(&sources));
+        exit(1);
+    }
+    if(reconnect > 0) {
+        policies = malloc(controller_numbers * sizeof(struct reconnect_policy));
+        assert(policies);
+        for(k = 0; k < controller_numbers; k++)
+            reconnect_policy_init(&policies[k], controller_hostname_list[k], controller_port_list[k],
+                    &sources, reconnect, reconnect_max);
+    }
+
+    char mode_desc[96] = "";
+    char connection_desc[96];
+    char budget_desc[64] = "";
+    char source_desc[160] = "";
+    if(sources_active(&sources))
+        snprintf(source_desc, sizeof(source_desc), " from %d source address(es)%s%s, ports %s",
+                sources.n_addrs > 0 ? sources.n_addrs : 1, source_addrs[0] ? " " : "", source_addrs,
+                source_ports[0] ? source_ports : "picked by the kernel");
+    if(budget_mb > 0)
+        snprintf(budget_desc, sizeof(budget_desc), ", %d MB for all of them", budget_mb);
+    if(storm_rate > 0)
+        snprintf(connection_desc, sizeof(connection_desc), "connection storm at %d connections/s", storm_rate);
+    else if(storm_rate < 0)
+        snprintf(connection_desc, sizeof(connection_desc), "connection storm with all switches at once");
+    else
+        snprintf(connection_desc, sizeof(connection_desc), "connection delay of %dms per %d switch(es)",
+                connect_delay, connect_group_size);
+    if(slo_us > 0)
+        snprintf(mode_desc, sizeof(mode_desc), ": p%g <= %d us with >= %g%% answered, %s arrivals",
+                slo_quantile, slo_us, slo_ratio, arrival_process_name(arrivals));
+    else if(rate > 0)
+        snprintf(mode_desc, sizeof(mode_desc), ": %d packet_in/s, %s arrivals",
+                rate, arrival_process_name(arrivals));
+    else if(aimd > 0)
+        snprintf(mode_desc, sizeof(mode_desc), ": AIMD window up to %d probes, backing off at %d%% RTT rise",
+                window > 0 && window < PROBE_TABLE_MAX ? window : PROBE_TABLE_MAX, aimd);
+    else if(window > 0)
+        snprintf(mode_desc, sizeof(mode_desc), ": window of %d probes", window);
+    if(calibrate)
+        snprintf(mode_desc + strlen(mode_desc), sizeof(mode_desc) - strlen(mode_desc),
+                ", calibrating against the built-in reflector");
 
     fprintf(stderr, "pof-cbench: controller benchmarking tool\n"
-                "   running in mode %s\n"
+                "   running in mode %s%s\n"
                 "   connecting to controller at %s:%d \n"
                 "   faking%s %d switches offset %d :: %d tests each; %d ms per test\n"
                 "   with %d unique source MACs per switch\n"
                 "   %s destination mac addresses before the test\n"
                 "   starting test with %d ms delay after features_reply\n"
                 "   ignoring first %d \"warmup\" and last %d \"cooldown\" loops\n"
-                "   connection delay of %dms per %d switch(es)\n"
+                "   %s%s\n"
                 "   maximum number of requests sent to controller per test is %d\n"
+                "   output buffers growing from %d KB to %d KB per switch while data is queued%s\n"
+                "   driving switches from %d thread(s) with the %s engine\n"
                 "   debugging info is %s\n",
-                mode == MODE_THROUGHPUT? "'throughput'": "'latency'",
+                slo_us > 0 ? "'saturation search'" : rate > 0 ? "'open loop'" :
+                    mode == MODE_THROUGHPUT? "'throughput'": "'latency'",
+                mode_desc,
                 controller_hostname,
                 controller_port,
                 should_test_range ? " from 1 to": "",
@@ -388,37 +1124,113 @@ int main(int argc, char * argv[])
                 learn_dst_macs ? "learning" : "NOT learning",
                 delay,
                 warmup,cooldown,
-                connect_delay,connect_group_size,
+                connection_desc, source_desc,
                 max_send_count,
+                BUFPOOL_MIN / 1024, buffer_kb, budget_desc,
+                n_threads, io_engine_name(engine),
                 debug == 1 ? "on" : "off");
+    if(cluster)
+        fprintf(stderr, "   connecting every switch to each of the %d controllers; probing the MASTER only\n",
+                controller_numbers);
+    if(reconnect > 0)
+        fprintf(stderr, "   reconnecting lost connections after %d ms, backing off up to %d ms\n",
+                reconnect, reconnect_max);
+    if(flow_table > 0)
+        fprintf(stderr, "   emulating a flow table of %d entries per switch; packets hitting one are forwarded\n",
+                flow_table);
+    if(echo_rate > 0)
+        fprintf(stderr, "   sending %d echo requests per second on every connection, timed apart from the packet_ins\n",
+                echo_rate);
+    if(mix[0])
+        fprintf(stderr, "   sending the message mix %s\n", mix);
+    if(pcap[0])
+        fprintf(stderr, "   packet_in payloads from %s: %d frames over %.3lf s (%.0lf per s), %d LLDP/BDDP/runt frames left out\n",
+                pcap, trace.n_frames, trace.duration_ns / 1e9, pcap_trace_rate(&trace), trace.skipped);
     /* done parsing args */
-    fakeswitches = malloc(n_fakeswitches * sizeof(struct fakeswitch));
+    bufpool_set_budget((uint64_t) budget_mb << 20);
+    fakeswitches = malloc(n_fakeswitches * members * sizeof(struct fakeswitch));
     assert(fakeswitches);
+    if(cluster) {
+        masterships = malloc(n_fakeswitches * sizeof(struct mastership));
+        assert(masterships);
+    }
+    workers = malloc(n_threads * sizeof(struct worker));
+    assert(workers);
+    workers_init(workers, n_threads, engine);
+    workers_set_rate(workers, n_threads, rate, arrivals);
+    workers_set_echo_rate(workers, n_threads, echo_rate);
+    if(pcap[0])
+        workers_set_trace(workers, n_threads, &trace);
+    if(output[0]) {
+        report_open(&report, output, output_format);
+        report_param_string(&report, "mode", slo_us > 0 ? "saturation search" : rate > 0 ? "open loop" :
+                mode == MODE_THROUGHPUT ? "throughput" : "latency");
+        report_param_string(&report, "controller", controller_hostname);
+        report_param_int(&report, "port", controller_port);
+        report_param_int(&report, "ms_per_test", mstestlen);
+        report_param_int(&report, "loops", tests_per_loop);
+        report_param_int(&report, "warmup", warmup);
+        report_param_int(&report, "cooldown", cooldown);
+        report_param_int(&report, "mac_addresses", total_mac_addresses);
+        report_param_int(&report, "delay", delay);
+        report_param_int(&report, "max_send_count", max_send_count);
+        report_param_int(&report, "threads", n_threads);
+        report_param_string(&report, "engine", io_engine_name(engine));
+        report_param_int(&report, "rate", rate);
+        report_param_string(&report, "arrivals", arrival_process_name(arrivals));
+        report_param_int(&report, "buffer_kb", buffer_kb);
+        report_param_int(&report, "memory_budget_mb", budget_mb);
+        report_param_int(&report, "zerocopy", zerocopy);
+        report_param_int(&report, "window", window);
+        report_param_int(&report, "aimd", aimd);
+        report_param_int(&report, "slo_latency_us", slo_us);
+        report_param_int(&report, "calibrate", calibrate);
+        report_param_string(&report, "mix", mix);
+        report_param_string(&report, "pcap", pcap);
+        report_param_double(&report, "slo_quantile", slo_quantile);
+        report_param_double(&report, "slo_ratio", slo_ratio);
+        report_param_int(&report, "storm", storm_rate);
+        report_param_int(&report, "cluster", cluster);
+        report_param_int(&report, "reconnect_ms", reconnect);
+        report_param_int(&report, "reconnect_max_ms", reconnect_max);
+        report_param_int(&report, "flow_table", flow_table);
+        report_param_int(&report, "echo_rate", echo_rate);
+        report_param_string(&report, "source_addrs", source_addrs);
+        report_param_string(&report, "source_ports", source_ports);
+    }
 
-    double *results;
-    double  min = DBL_MAX;
-    double  max = 0.0;
+    struct histogram run_hist;      // round trip times of the counted tests of a run
+    struct run_result run;
     double  v;
-    results = malloc(tests_per_loop * sizeof(double));
 
-    strcpy(controller_hostname_array, controller_hostname);
-    controller_numbers = raw_controller_hostname_split(controller_hostname_array, controller_hostname_list);
     int n_sub_fakeswitches = n_fakeswitches / controller_numbers;  // had better to integer times
     int temp_sub_fakeswitches = 0;
     int temp_contoller_number = 1;
     controller_hostname = controller_hostname_list[0];
+    // switches connect non-blocking through the storm machinery, quietly
+    //  and paced by the connection delay unless a storm was asked for;
+    //  only a ranged test, which tests between connects, still connects
+    //  one switch at a time
+    connect_rate = storm_rate;
+    if(storm_rate == 0 && !should_test_range)
+        connect_rate = connect_delay <= 0 ? -1 :
+            connect_group_size * 1000 / connect_delay > 0 ? connect_group_size * 1000 / connect_delay : 1;
+    if(connect_rate != 0)
+        storm_init(&storm, n_fakeswitches * members, connect_rate, &sources);
 
-    for( i = 0; i < n_fakeswitches; i++)
+    // in a cluster, connection i is the one of switch i / members to controller i % members
+    for( i = 0; i < n_fakeswitches * members; i++)
     {
-        int sock;
-        double sum = 0;
-        if (connect_delay != 0 && i != 0 && (i % connect_group_size == 0)) {
+        int sock, port, controller;
+        if (connect_rate == 0 && connect_delay != 0 && i != 0 && (i % connect_group_size == 0)) {
             if(debug)
                 fprintf(stderr,"Delaying connection by %dms...", connect_delay*1000);
             usleep(connect_delay*1000);
         }
 
-        if(temp_sub_fakeswitches == n_sub_fakeswitches) {
+        if(cluster)
+            controller_hostname = controller_hostname_list[i % members];
+        else if(temp_sub_fakeswitches == n_sub_fakeswitches) {
             /* if it's not integer times, let remaining switches connect to last controller*/
             if(temp_contoller_number < controller_numbers - 1) {
                 controller_hostname = controller_hostname_list[temp_contoller_number++];
@@ -429,76 +1241,108 @@ int main(int argc, char * argv[])
             }
         }
         temp_sub_fakeswitches++;
+        controller = cluster ? i % members : temp_contoller_number - 1;
+        port = controller_port_list[controller];
 
-        sock = make_tcp_connection(controller_hostname, controller_port,3000, mode!=MODE_THROUGHPUT );
+        if(connect_rate != 0)
+            sock = storm_connect(&storm, controller_hostname, port);
+        else
+            sock = make_tcp_connection_from(controller_hostname, port, &sources, 3000, mode!=MODE_THROUGHPUT );
         if(sock < 0 )
         {
             fprintf(stderr, "make_nonblock_tcp_connection :: returned %d", sock);
             exit(1);
         }
+        if(i+1 == n_fakeswitches * members && sources.in_use > 0)
+            fprintf(stderr, "Warning %lu source address and port pairs were in use and skipped\n", sources.in_use);
         if(debug)
             fprintf(stderr,"Initializing switch %d ... ", i+1);
         fflush(stderr);
-        fakeswitch_init(&fakeswitches[i],dpid_offset+i,sock,BUFLEN, debug, delay, mode, total_mac_addresses, learn_dst_macs, max_send_count);
+        fakeswitch_init(&fakeswitches[i],dpid_offset+i/members,sock,buffer_kb * 1024, debug, delay, mode, total_mac_addresses, learn_dst_macs, max_send_count);
+        if(zerocopy > 0)
+            fakeswitch_enable_zerocopy(&fakeswitches[i], zerocopy);
+        if(window > 0 || aimd > 0)
+            fakeswitch_set_window(&fakeswitches[i], window, aimd);
+        if(mix[0])
+            fakeswitch_set_workload(&fakeswitches[i], &workload);
+        if(pcap[0])
+            fakeswitch_set_trace(&fakeswitches[i], &trace);
+        if(flow_table > 0)
+            fakeswitch_set_flow_table(&fakeswitches[i], flow_table);
+        if(cluster)
+            fakeswitch_join_cluster(&fakeswitches[i], &masterships[i / members], i % members);
+        if(reconnect > 0)
+            fakeswitch_set_reconnect(&fakeswitches[i], &policies[controller]);
         if(debug)
             fprintf(stderr," :: done.\n");
         fflush(stderr);
+        if(connect_rate != 0) {
+            storm_add(&storm, &fakeswitches[i]);
+            if(i+1 != n_fakeswitches * members)
+                continue;
+            k = storm_finish(&storm, storm_rate != 0 ? stdout : NULL);
+            if(k > 0 && storm_rate == 0)
+                fprintf(stderr, "Warning %d switches did not get through the handshake within %d ms\n",
+                        k, STORM_TIMEOUT_MS);
+            delay = 0;      // the storm already waited for every switch to get ready
+        }
         if(count_bits(i+1) == 0)  // only test for 1,2,4,8,16 switches
             continue;
-        if(!should_test_range && ((i+1) != n_fakeswitches)) // only if testing range or this is last
+        if(!should_test_range && ((i+1) != n_fakeswitches * members)) // only if testing range or this is last
+            continue;
+        if(calibrate) {
+            run_calibration(i+1, fakeswitches, workers, n_threads, rate, arrivals,
+                    tests_per_loop, warmup, cooldown, mstestlen, delay, output[0] ? &report : NULL);
             continue;
-        for( j = 0; j < tests_per_loop; j ++) {
-            if ( j > 0 )
-                delay = 0;      // only delay on the first run
-            v = 1000.0 * run_test(i+1, fakeswitches, mstestlen, delay);
-            results[j] = v;
-			if(j<warmup || j >= tests_per_loop-cooldown) 
-				continue;
-            sum += v;
-            if (v > max)
-              max = v;
-            if (v < min)
-              min = v;
-        }
-
-		int counted_tests = (tests_per_loop - warmup - cooldown);
-        // compute std dev
-        double avg = sum / counted_tests;
-        sum = 0.0;
-        for (j = warmup; j < tests_per_loop-cooldown; ++j) {
-          sum += pow(results[j] - avg, 2);
         }
-        sum = sum / (double)(counted_tests);
-        double std_dev = sqrt(sum);
-
-        int total_recv_count = 0;
-        int total_send_cunt = 0;
-        for (k = 0; k < n_fakeswitches; k++) {
-            total_recv_count += fakeswitches[k].totoal_recv_count;
-            total_send_cunt += fakeswitches[k].total_send_count;
+        if(slo_us > 0) {
+            search_init(&search, rate, slo_us * 1000ull, slo_quantile / 100, slo_ratio / 100);
+            v = run_search(&search, i+1, fakeswitches, workers, n_threads, arrivals,
+                    tests_per_loop, warmup, cooldown, mstestlen, delay, output[0] ? &report : NULL);
+            if(v > 0)
+                printf("CAPACITY: %d switches %d steps %d packet_in/s sustained with p%g round trip time <= %d us"
+                        " and >= %g%% answered\n", i+1, search.steps, search.passed, slo_quantile, slo_us, slo_ratio);
+            else
+                printf("CAPACITY: %d switches %d steps no rate down to %d packet_in/s met p%g <= %d us"
+                        " with >= %g%% answered\n", i+1, search.steps, search.failed, slo_quantile, slo_us, slo_ratio);
+            continue;
         }
-        printf("Total Count: responses/requests =  %d/%d\n", total_recv_count, total_send_cunt);
+        run_tests(&run, &run_hist, i+1, fakeswitches, workers, n_threads,
+                tests_per_loop, warmup, cooldown, mstestlen, delay, output[0] ? &report : NULL);
+        delay = 0;      // only delay on the first run
 
-
-        double total_response_avg = total_recv_count / (double)tests_per_loop;
-        double total_request_avg = total_send_cunt / (double)tests_per_loop;
+        printf("Total Count: responses/requests =  %d/%d\n", run.responses, run.requests);
+        double total_response_avg = run.responses / (double)tests_per_loop;
+        double total_request_avg = run.requests / (double)tests_per_loop;
         printf("Total Average: responses/requests = %.2lf/%.2lf\n",
                total_response_avg, total_request_avg);
 
-
         printf("RESULT: %d switches %d tests "
             "min/max/avg/stdev = %.2lf/%.2lf/%.2lf/%.2lf responses/s\n",
-                i+1,
-                counted_tests,
-                min, max, avg, std_dev);
+                run.n_fakeswitches, run.counted_tests,
+                run.min, run.max, run.avg, run.stdev);
+        printf("LATENCY: %d switches %d tests round trip time ", run.n_fakeswitches, run.counted_tests);
+        histogram_print_latency(stdout, &run_hist);
+        printf("\n");
+        printf("FAIRNESS: %d switches %d tests jain min/avg = %.4lf/%.4lf, cv max = %.3lf\n",
+                run.n_fakeswitches, run.counted_tests, run.jain_min, run.jain_avg, run.cv_max);
 
-        fprintf(fp, "%d\t %d\t %.2lf\t %.2lf\t %.2lf\t %.2lf\t %d\t %d\t %.2lf\t %.2lf\n",
-                i+1, counted_tests,
-                min, max, avg, std_dev,
-                total_recv_count, total_send_cunt,
-                total_response_avg, total_request_avg);
+        fprintf(fp, "%d\t %d\t %.2lf\t %.2lf\t %.2lf\t %.2lf\t %d\t %d\t %.2lf\t %.2lf"
+                "\t %.1lf\t %.1lf\t %.1lf\t %.1lf\t %.1lf\t %.1lf\n",
+                run.n_fakeswitches, run.counted_tests,
+                run.min, run.max, run.avg, run.stdev,
+                run.responses, run.requests,
+                total_response_avg, total_request_avg,
+                run_hist.min / 1000.0,
+                histogram_quantile(&run_hist, 0.50) / 1000.0,
+                histogram_quantile(&run_hist, 0.90) / 1000.0,
+                histogram_quantile(&run_hist, 0.99) / 1000.0,
+                histogram_quantile(&run_hist, 0.999) / 1000.0,
+                run_hist.max / 1000.0);
     }
 
+    if(output[0])
+        report_close(&report);
     return 0;
 }
 
@@ -1,6 +1,9 @@
 #ifndef CBENCH_H
 #define CBENCH_H
 
+#include <stdint.h>
+#include <time.h>
+
 #ifndef BUFLEN
 #define BUFLEN 65536
 #endif
@@ -9,4 +12,12 @@
 #define MAX_SEND_COUNT 0x7fffffff
 #endif
 
+/* monotonic clock in ns, for measuring round trip times */
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 #endif
@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "fairness.h"
+
+static int fairness_compare(const void * a, const void * b);
+
+/**********************************************************************/
+void fairness_compute(struct fairness * f, const struct switch_counts * counts, int n_fakeswitches, double ms)
+{
+    double * rates;
+    double sum = 0, sum_squares = 0;
+    int i, j;
+
+    f->n_fakeswitches = n_fakeswitches;
+    f->n_worst = 0;
+    rates = malloc(n_fakeswitches * sizeof(double));
+    assert(rates);
+    for (i = 0; i < n_fakeswitches; i++)
+    {
+        rates[i] = counts[i].recv_count * 1000.0 / ms;
+        sum += rates[i];
+        sum_squares += rates[i] * rates[i];
+        // insertion into the short list of the lowest counts; ties keep the lower index
+        for (j = f->n_worst; j > 0 && counts[f->worst[j - 1]].recv_count > counts[i].recv_count; j--)
+            if (j < FAIRNESS_WORST)
+                f->worst[j] = f->worst[j - 1];
+        if (j < FAIRNESS_WORST)
+        {
+            f->worst[j] = i;
+            if (f->n_worst < FAIRNESS_WORST)
+                f->n_worst++;
+        }
+    }
+    qsort(rates, n_fakeswitches, sizeof(double), fairness_compare);
+    f->min = rates[0];
+    f->max = rates[n_fakeswitches - 1];
+    if (n_fakeswitches % 2)
+        f->median = rates[n_fakeswitches / 2];
+    else
+        f->median = (rates[n_fakeswitches / 2 - 1] + rates[n_fakeswitches / 2]) / 2;
+    f->mean = sum / n_fakeswitches;
+    if (sum > 0)
+    {
+        // population variance; clamp the rounding error of equal rates
+        double variance = sum_squares / n_fakeswitches - f->mean * f->mean;
+        f->cv = variance > 0 ? sqrt(variance) / f->mean : 0;
+        f->jain = sum * sum / (n_fakeswitches * sum_squares);
+    }
+    else
+    {
+        // nobody got anything: equally (un)served
+        f->cv = 0;
+        f->jain = 1;
+    }
+    free(rates);
+}
+
+/**********************************************************************/
+void fairness_print(FILE * out, const struct fairness * f, const struct switch_counts * counts)
+{
+    int i, k;
+    fprintf(out, "min/median/max = %.2lf/%.2lf/%.2lf responses/s per switch, cv = %.3lf, jain = %.4lf",
+            f->min, f->median, f->max, f->cv, f->jain);
+    if (f->n_fakeswitches < 2)
+        return;
+    fprintf(out, "; worst:");
+    for (i = 0; i < f->n_worst; i++)
+    {
+        k = f->worst[i];
+        fprintf(out, "%s switch %d (%d/%d)", i ? "," : "", counts[k].id,
+                counts[k].recv_count, counts[k].send_count);
+    }
+}
+
+/**********************************************************************/
+static int fairness_compare(const void * a, const void * b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,38 @@
+#ifndef FAIRNESS_H
+#define FAIRNESS_H
+
+#include <stdio.h>
+
+#include "fakeswitch.h"
+#include "worker.h"
+
+#define FAIRNESS_WORST  3       // how many of the worst served switches are named
+
+/* How evenly the controller served the switches during one test,
+ *  from the responses per second each switch got
+ */
+struct fairness
+{
+    int n_fakeswitches;
+    double min, median, max;            // responses per second of a single switch
+    double mean;
+    double cv;                          // coefficient of variation: stdev / mean
+    double jain;                        // Jain's index: 1 = all equal, 1/n = one switch got everything
+    int n_worst;
+    int worst[FAIRNESS_WORST];          // switches with the fewest responses, worst first
+};
+
+/*** Compute the rate distribution of one test
+ * @param f                 Filled on return
+ * @param counts            Per-switch responses/requests of the test
+ * @param n_fakeswitches    Number of entries in counts
+ * @param ms                Length of the test
+ */
+void fairness_compute(struct fairness * f, const struct switch_counts * counts, int n_fakeswitches, double ms);
+
+/*** Print "min/median/max = ... responses/s per switch, cv = ..., jain = ...;
+ *  worst: switch <dpid> (recv/send), ..."
+ */
+void fairness_print(FILE * out, const struct fairness * f, const struct switch_counts * counts);
+
+#endif
@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,9 +16,21 @@
 #include <netinet/in.h>
 
 #include "pof.h"
+#include "bufpool.h"
 #include "cbench.h"
 #include "fakeswitch.h"
 
+#define OUTBUF_CONTROL_RESERVE 4096     // output space probes leave free for handshake and echo replies
+#define CONTROL_BUFLEN  512             // holds any message the switch builds itself
+#define CARRY_KEEP      1024            // a carry buffer bigger than this is freed once it is empty
+
+#ifndef MIN
+#define MIN(x,y)  (((x) < (y))? (x) : (y))
+#endif
+
+/* remember when the handshake first got to this step */
+#define HANDSHAKE_STAMP(fs, step) do { if ((fs)->handshake.step == 0) (fs)->handshake.step = now_ns(); } while (0)
+
 static int debug_msg(struct fakeswitch * fs, char * msg, ...);
 static int make_features_reply(int switch_id, int xid, char * buf, int buflen);
 //static int make_stats_desc_reply(struct ofp_stats_request * req, char * buf, int buflen);
@@ -24,9 +38,46 @@ static int parse_set_config(struct pof_header * msg);
 static int make_config_reply(int id, int xid, char * buf, int buflen);
 //static int make_vendor_reply(int xid, char * buf, int buflen);
 static int make_packet_in(int switch_id, int xid, int buffer_id, char * buf, int buflen, int mac_address);
+static int make_echo_request(int xid, char * buf, int buflen);
+static int make_flow_removed(int xid, char * buf, int buflen);
 static int packet_out_is_lldp(struct pof_packet_out * po);
-static void fakeswitch_handle_write(struct fakeswitch *fs);
+static void fakeswitch_take_input(struct fakeswitch *fs, char * data, int len);
+static int fakeswitch_carry_need(struct fakeswitch *fs);
+static void fakeswitch_carry(struct fakeswitch *fs, const char * data, int count);
+static int fakeswitch_parse_frames(struct fakeswitch *fs, char * data, int len);
+static void fakeswitch_count_responses(struct fakeswitch *fs, int responses);
+static void fakeswitch_handle_control(struct fakeswitch *fs, struct pof_header * pofh);
+static void fakeswitch_connection_lost(struct fakeswitch *fs, int err);
+static void fakeswitch_set_role(struct fakeswitch *fs, int role);
+static void fakeswitch_elect(struct mastership * cluster);
+static void fakeswitch_give_up_probes(struct fakeswitch *fs);
+static void fakeswitch_send_hello(struct fakeswitch *fs);
+static void fakeswitch_reconnect(struct fakeswitch *fs);
+static void fakeswitch_back_up(struct fakeswitch *fs);
+static void fakeswitch_rate_sample(struct fakeswitch *fs, int responses);
+static void fakeswitch_flow_mod(struct fakeswitch *fs, pof_flow_entry * fm, int msglen);
+static int fakeswitch_flow_lookup(struct fakeswitch *fs, char * msg, int size, uint64_t now);
+static void fakeswitch_echo_answered(struct fakeswitch *fs, uint32_t xid, uint64_t now);
+static void fakeswitch_give_up_echoes(struct fakeswitch *fs);
 static void fakeswitch_learn_dstmac(struct fakeswitch *fs);
+static void fakeswitch_probe_sent(struct fakeswitch *fs, uint32_t xid, uint32_t buffer_id, uint64_t now);
+static int fakeswitch_queue_probes(struct fakeswitch *fs, int count, uint64_t now);
+static void fakeswitch_queue_messages(struct fakeswitch *fs, int count, uint64_t now);
+static int fakeswitch_stamp_trace_packet_in(struct fakeswitch *fs, char * buf);
+static int fakeswitch_trace_packet_in_size(struct fakeswitch *fs);
+static void fakeswitch_update_size_max(struct fakeswitch *fs);
+static int fakeswitch_probe_room(struct fakeswitch *fs);
+static int fakeswitch_outbuf_room(struct fakeswitch *fs, int count);
+static void fakeswitch_outbuf_put(struct fakeswitch *fs, struct msgbuf * mbuf);
+static inline void fakeswitch_mem_add(struct fakeswitch *fs, long bytes);
+static void fakeswitch_push(struct fakeswitch *fs, char * buf, int count);
+static inline void fakeswitch_stamp_packet_in(struct fakeswitch *fs, char * buf);
+static void fakeswitch_flush(struct fakeswitch *fs);
+static int fakeswitch_probe_answered(struct fakeswitch *fs, uint32_t xid, uint32_t buffer_id, uint64_t now);
+static struct probe_record * fakeswitch_probe_find(struct fakeswitch *fs, uint32_t xid, uint32_t buffer_id);
+static void fakeswitch_probe_grow(struct fakeswitch *fs);
+static void fakeswitch_probe_advance(struct fakeswitch *fs);
+static void fakeswitch_window_sample(struct fakeswitch *fs, uint64_t rtt);
 void fakeswitch_change_status_now (struct fakeswitch *fs, int new_status);
 void fakeswitch_change_status (struct fakeswitch *fs, int new_status);
 
@@ -51,16 +102,23 @@ static inline uint64_t ntohll(uint64_t n)
 
 void fakeswitch_init(struct fakeswitch *fs, int dpid, int sock, int bufsize, int debug, int delay, enum test_mode mode, int total_mac_addresses, int learn_dstmac, int max_send_count)
 {
-    char buf[BUFLEN];
-    struct pof_header pofph;
+    char buf[CONTROL_BUFLEN];
+    long page = sysconf(_SC_PAGESIZE);
     fs->sock = sock;
     fs->debug = debug;
     fs->id = dpid;
-    fs->inbuf = msgbuf_new(bufsize);
-    fs->outbuf = msgbuf_new(bufsize);
+    fs->outbuf = NULL;      // taken from the pool once there is something to send
+    fs->outbuf_max = (bufsize + page - 1) / page * page;
+    fs->carry = NULL;
+    fs->carry_len = fs->carry_cap = 0;
     fs->probe_state = 0;
     fs->mode = mode;
-    fs->probe_size = make_packet_in(fs->id, 0, 0, buf, BUFLEN, fs->current_mac_address++);
+    // pre-serialize this switch's packet_in; probes are stamped from it
+    fs->probe_size = make_packet_in(fs->id, 0, 0, buf, sizeof(buf), 0);
+    fs->probe_template = malloc(fs->probe_size);
+    assert(fs->probe_template);
+    memcpy(fs->probe_template, buf, fs->probe_size);
+    fs->probe_size_max = fs->probe_size;
     fs->max_send_count = max_send_count;
     fs->send_count = 0;
     fs->recv_count = 0;
@@ -73,14 +131,62 @@ void fakeswitch_init(struct fakeswitch *fs, int dpid, int sock, int bufsize, int
     fs->xid = 1;
     fs->learn_dstmac = learn_dstmac;
     fs->current_buffer_id = 1;
-  
+    fs->probe_slots = PROBE_TABLE_MIN;
+    fs->probes = calloc(fs->probe_slots, sizeof(struct probe_record));
+    assert(fs->probes);
+    fs->probe_head = fs->probe_tail = 0;
+    fs->rtt_hist = NULL;
+    fs->paced = 0;
+    fs->zerocopy_min = 0;
+    memset(&fs->io, 0, sizeof(fs->io));
+    memset(&fs->handshake, 0, sizeof(fs->handshake));
+    memset(&fs->window, 0, sizeof(fs->window));
+    memset(&fs->match, 0, sizeof(fs->match));
+    fs->workload = NULL;
+    memset(&fs->mix, 0, sizeof(fs->mix));
+    fs->trace = NULL;
+    fs->trace_pos = 0;
+    fs->mem_bytes = fs->mem_peak = 0;
+    fs->cluster = NULL;
+    fs->member = 0;
+    fs->role = ROLE_EQUAL;
+    fs->down = 0;
+    fs->reconnect = NULL;
+    fs->sock_generation = 0;
+    fs->backoff = 0;
+    fs->reconnect_at = fs->outage_start = fs->down_since = fs->recovering = 0;
+    fs->rate_bucket_start = 0;
+    fs->rate_bucket_count = 0;
+    fs->rate = 0;
+    memset(&fs->reconnects, 0, sizeof(fs->reconnects));
+    flowtable_init(&fs->flows, 0);
+    fs->table = &fs->flows;
+    fs->flows_start = fs->flows_cycle_start = 0;
+    fs->flows_cycle_packets = fs->flows_cycle_missed = 0;
+    fs->flows_converged = 0;
+    fs->flows_idle = 0;
+    memset(&fs->flow_stats, 0, sizeof(fs->flow_stats));
+    fs->echo_sent = NULL;
+    fs->echo_seq = 0;
+    fs->echo_hist = NULL;
+    memset(&fs->echo, 0, sizeof(fs->echo));
+    fakeswitch_mem_add(fs, sizeof(*fs) + fs->probe_size + fs->probe_slots * sizeof(struct probe_record));
+    if (mode == MODE_LATENCY)
+        fs->window.size = fs->window.max = 1;   // one probe outstanding at a time
+    fakeswitch_send_hello(fs);
+}
+
+/***********************************************************************/
+static void fakeswitch_send_hello(struct fakeswitch *fs)
+{
+    struct pof_header pofph;
     pofph.version = POF_VERSION;
     pofph.type = POFT_HELLO;
     pofph.length = htons(sizeof(pofph));
     pofph.xid   = htonl(1);
 
     // Send HELLO
-    msgbuf_push(fs->outbuf,(char * ) &pofph, sizeof(pofph));
+    fakeswitch_push(fs,(char * ) &pofph, sizeof(pofph));
     debug_msg(fs, " sent hello");
 }
 
@@ -115,7 +221,8 @@ void fakeswitch_learn_dstmac(struct fakeswitch *fs)
     pkt_in->header.version = POF_VERSION;
     pkt_in->header.type = POFT_PACKET_IN;
     pkt_in->header.length = htons(len);
-    pkt_in->header.xid = htonl(fs->xid++);
+    pkt_in->header.xid = htonl(fs->xid);
+    fs->xid = NEXT_XID(fs->xid);
 
     pkt_in->buffer_id = -1;
     pkt_in->total_len = htons(sizeof(gratuitous_arp_reply));
@@ -136,7 +243,7 @@ void fakeswitch_learn_dstmac(struct fakeswitch *fs)
     memcpy ( arp_reply + 18, mac_address_to_learn, 6);
     memcpy ( arp_reply + 24, ip_address_to_learn, 4);
 
-    msgbuf_push(fs->outbuf,(char * ) pkt_in, len);
+    fakeswitch_push(fs,(char * ) pkt_in, len);
     debug_msg(fs, " sent gratuitous ARP reply to learn about mac address: version %d length %d type %d eth: %x arp: %x ", pkt_in->header.version, len, buf[1], eth, arp_reply);
 }
 
@@ -145,10 +252,13 @@ void fakeswitch_learn_dstmac(struct fakeswitch *fs)
 
 void fakeswitch_set_pollfd(struct fakeswitch *fs, struct pollfd *pfd)
 {
-    pfd->events = POLLIN|POLLOUT;
-    /* if(msgbuf_count_buffered(fs->outbuf) > 0)
-        pfd->events |= POLLOUT; */
-    pfd->fd = fs->sock;
+    pfd->events = POLLIN;
+    // while the output ring is full there is nothing to write: sleep
+    //  until input or a zerocopy completion (POLLERR) frees space;
+    //  the handshake states still need a turn every time around
+    if(fakeswitch_want_write(fs) || fs->switch_status != READY_TO_SEND)
+        pfd->events |= POLLOUT;
+    pfd->fd = fs->down ? -1 : fs->sock;     // poll() skips negative fds
 }
 
 /***********************************************************************/
@@ -157,7 +267,7 @@ int fakeswitch_get_recv_count(struct fakeswitch *fs)
 {
     int ret = fs->recv_count;
     fs->recv_count = 0;
-    fs->probe_state = 0;        // reset packet state
+    fakeswitch_give_up_probes(fs);
     /*int count;
     int msglen;
     struct pof_header * pofph;
@@ -186,6 +296,112 @@ int fakeswitch_get_send_count(struct fakeswitch *fs) {
     return ret;
 }
 
+/***********************************************************************
+ * Forget the outstanding probes: they count as timed out, and their
+ *  responses as late
+ */
+static void fakeswitch_give_up_probes(struct fakeswitch *fs)
+{
+    fs->probe_state = 0;        // reset packet state
+    for (; fs->probe_head != fs->probe_tail; fs->probe_head++)
+    {
+        struct probe_record * probe = &fs->probes[fs->probe_head & (fs->probe_slots - 1)];
+        if (probe->sent > PROBE_TIMED_OUT)
+        {
+            probe->sent = PROBE_TIMED_OUT;
+            fs->match.timed_out++;
+        }
+    }
+    fs->window.round_rtt = 0;   // its probes are forgotten
+    fs->window.round_samples = 0;
+}
+
+/***********************************************************************/
+void fakeswitch_join_cluster(struct fakeswitch *fs, struct mastership * cluster, int member)
+{
+    if (member == 0)
+    {
+        memset(cluster, 0, sizeof(*cluster));
+        cluster->members = fs;
+    }
+    assert(cluster->members + member == fs);
+    cluster->n_members = member + 1;
+    fs->cluster = cluster;
+    fs->member = member;
+    fs->table = &cluster->members->flows;  // one switch, one table, whichever controller fills it
+    fakeswitch_elect(cluster);
+}
+
+/***********************************************************************/
+void fakeswitch_get_failover_stats(struct fakeswitch *fs, struct failover_stats *stats)
+{
+    struct mastership * cluster = fs->cluster;
+    if (cluster == NULL || fs->member != 0)
+        return;
+    stats->role_changes += cluster->stats.role_changes;
+    stats->connections_lost += cluster->stats.connections_lost;
+    stats->failovers += cluster->stats.failovers;
+    stats->failover_sum += cluster->stats.failover_sum;
+    if (cluster->stats.failover_max > stats->failover_max)
+        stats->failover_max = cluster->stats.failover_max;
+    if (cluster->active < 0)
+        stats->without_master++;
+    else if (cluster->members[cluster->active].role == ROLE_MASTER)
+        stats->with_master++;
+    else
+        stats->equal_only++;
+    if (cluster->lost)
+        stats->failing_over++;
+    memset(&cluster->stats, 0, sizeof(cluster->stats));
+}
+
+/***********************************************************************
+ * Take a role a controller asked for on this connection; like a real
+ *  switch, make the connection that was MASTER before a SLAVE
+ */
+static void fakeswitch_set_role(struct fakeswitch *fs, int role)
+{
+    struct mastership * cluster = fs->cluster;
+    int i;
+
+    if (role != ROLE_EQUAL && role != ROLE_MASTER && role != ROLE_SLAVE)
+        return;     // ROLE_NOCHANGE, or nothing we know
+    if (role == fs->role)
+        return;
+    cluster->stats.role_changes++;
+    if (role == ROLE_MASTER)
+        for (i = 0; i < cluster->n_members; i++)
+            if (cluster->members[i].role == ROLE_MASTER)
+                cluster->members[i].role = ROLE_SLAVE;
+    fs->role = role;
+    fakeswitch_elect(cluster);
+}
+
+/***********************************************************************
+ * Pick the connection probes go through: the master's if there is one,
+ *  else the first EQUAL one still up.  A connection that stops being
+ *  active gives up its outstanding probes, so its controller's late
+ *  answers don't count.
+ */
+static void fakeswitch_elect(struct mastership * cluster)
+{
+    int i, active = -1;
+
+    for (i = 0; i < cluster->n_members && active < 0; i++)
+        if (!cluster->members[i].down && cluster->members[i].role == ROLE_MASTER)
+            active = i;
+    for (i = 0; i < cluster->n_members && active < 0; i++)
+        if (!cluster->members[i].down && cluster->members[i].role == ROLE_EQUAL)
+            active = i;
+    if (active == cluster->active)
+        return;
+    if (cluster->active >= 0 && cluster->active < cluster->n_members)
+        fakeswitch_give_up_probes(&cluster->members[cluster->active]);
+    if (active >= 0)
+        debug_msg(&cluster->members[active], "probing through the connection to controller %d", active);
+    cluster->active = active;
+}
+
 /***********************************************************************/
 static int parse_set_config(struct pof_header * msg) {
 	/*struct ofp_switch_config * sc;
@@ -200,12 +416,14 @@ static int parse_set_config(struct pof_header * msg) {
 /***********************************************************************/
 static int make_config_reply(int id, int xid, char * buf, int buflen) {
 	int len = sizeof(struct pof_switch_config);
+	struct pof_switch_config * config = (struct pof_switch_config *) buf;
 	assert(buflen >= len);
-	Switch_config.header.type = POFT_GET_CONFIG_REPLY;
-    Switch_config.header.length = htons(len);
-	Switch_config.header.xid = xid;
-    Switch_config.dev_id = htonl(id);
-	memcpy(buf, &Switch_config, len);
+	// work on a copy: switches may be driven from several threads
+	memcpy(config, &Switch_config, len);
+	config->header.type = POFT_GET_CONFIG_REPLY;
+    config->header.length = htons(len);
+	config->header.xid = xid;
+    config->dev_id = htonl(id);
 
 	return len;
 }
@@ -290,6 +508,43 @@ static int make_port_status_reply(int xid, char * buf, int buflen)
     return sizeof(fake);
 }
 
+/***********************************************************************/
+static int make_echo_request(int xid, char * buf, int buflen)
+{
+    struct pof_header * echo = (struct pof_header *) buf;
+
+    assert(buflen > sizeof(*echo));
+    memset(echo, 0, sizeof(*echo));
+    echo->version = POF_VERSION;
+    echo->type = POFT_ECHO_REQUEST;
+    echo->length = htons(sizeof(*echo));
+    echo->xid = htonl(xid);
+    return sizeof(*echo);
+}
+
+/***********************************************************************
+ * An idle timeout of a flow the controller installed: table 0,
+ *  alive for 10 s, 10 packets of 98 bytes
+ */
+static int make_flow_removed(int xid, char * buf, int buflen)
+{
+    pof_flow_removed * fr = (pof_flow_removed *) buf;
+
+    assert(buflen > sizeof(*fr));
+    memset(fr, 0, sizeof(*fr));
+    fr->header.version = POF_VERSION;
+    fr->header.type = POFT_FLOW_REMOVED;
+    fr->header.length = htons(sizeof(*fr));
+    fr->header.xid = htonl(xid);
+    fr->priority = htons(1);
+    fr->reason = POFRR_IDLE_TIMEOUT;
+    fr->duration_sec = htonl(10);
+    fr->idle_timeout = htons(5);
+    fr->packet_count = htonll(10);
+    fr->byte_count = htonll(980);
+    return sizeof(*fr);
+}
+
 /***********************************************************************
  *  return 1 if the embedded packet in the packet_out is lldp or bddp
  * 
@@ -349,11 +604,31 @@ static int make_packet_in(int switch_id, int xid, int buffer_id, char * buf, int
     return sizeof(fake);
 }
 
+/***********************************************************************
+ * Copy the switch's packet_in template to buf and patch in the fields
+ *  that change from probe to probe: xid, buffer_id and the source mac
+ */
+static inline void fakeswitch_stamp_packet_in(struct fakeswitch *fs, char * buf)
+{
+    struct pof_packet_in * pi = (struct pof_packet_in *) buf;
+    struct ether_header * eth = (struct ether_header * ) pi->data;
+    memcpy(buf, fs->probe_template, fs->probe_size);
+    pi->header.xid = htonl(fs->xid);
+    pi->buffer_id = htonl(fs->current_buffer_id);
+    // same bytes make_packet_in() patches; ether_shost[5] is already the switch id
+    memcpy(&eth->ether_shost[1], &fs->current_mac_address, sizeof(fs->current_mac_address));
+}
+
 void fakeswitch_change_status_now (struct fakeswitch *fs, int new_status) {
     fs->switch_status = new_status;
     if(new_status == READY_TO_SEND) {
-        fs->recv_count = 0;
+        HANDSHAKE_STAMP(fs, ready);
+        if (fs->outage_start)
+            fakeswitch_back_up(fs);     // the responses from before the outage still count
+        else
+            fs->recv_count = 0;
         fs->probe_state = 0;
+        fs->flows_idle = 0;
     }
         
 }
@@ -377,165 +652,569 @@ void fakeswitch_change_status(struct fakeswitch *fs, int new_status) {
 /***********************************************************************/
 void fakeswitch_handle_read(struct fakeswitch *fs)
 {
+    // shared by all switches of the thread: what a switch keeps of a
+    //  read goes to its carry buffer
+    static __thread char buf[BUFLEN];
     int count;
-    struct pof_header * pofh;
-    struct pof_header echo;
-    struct pof_role_reply role_reply;
-    //struct ofp_header barrier;
-    char buf[BUFLEN];
-    count = msgbuf_read(fs->inbuf, fs->sock);   // read any queued data
-    if (count <= 0)
+    if (fs->down)
+        return;
+    do
+    {
+        count = read(fs->sock, buf, sizeof(buf));   // read any queued data
+        fs->io.reads++;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;     // socket drained
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+        {
+            fakeswitch_connection_lost(fs, count < 0 ? errno : 0);
+            return;
+        }
+        fakeswitch_take_input(fs, buf, count);
+    } while (count == sizeof(buf));   // a short read means the socket is drained
+}
+
+/***********************************************************************/
+void fakeswitch_handle_input(struct fakeswitch *fs, const char * data, int len)
+{
+    if (fs->down)
+        return;
+    if (len <= 0)
+    {
+        fakeswitch_connection_lost(fs, -len);
+        return;
+    }
+    fakeswitch_take_input(fs, (char *) data, len);     // straight from the engine's buffer
+}
+
+/***********************************************************************/
+static void fakeswitch_connection_lost(struct fakeswitch *fs, int err)
+{
+    struct mastership * cluster = fs->cluster;
+    uint64_t now;
+
+    if (cluster == NULL && fs->reconnect == NULL)
     {
-        fprintf(stderr, "controller msgbuf_read() = %d:  ", count);
-        if(count < 0)
-            perror("msgbuf_read");
+        fprintf(stderr, "controller msgbuf_read() = %d:  ", err ? -1 : 0);
+        if(err)
+            fprintf(stderr, "msgbuf_read: %s", strerror(err));
         else
             fprintf(stderr, " closed connection ");
         fprintf(stderr, "... exiting\n");
         exit(1);
     }
-    while((count= msgbuf_count_buffered(fs->inbuf)) >= sizeof(struct pof_header ))
+    now = now_ns();
+    if (fs->outage_start == 0)
+    {
+        // not just a failed reconnect attempt: the switch goes down
+        if (cluster)
+            fprintf(stderr, "switch %d: lost the connection to controller %d: %s%s\n", fs->id, fs->member,
+                    err ? strerror(err) : "closed", fs->reconnect ? "; reconnecting" : "");
+        else
+            fprintf(stderr, "switch %d: lost the connection: %s; reconnecting\n",
+                    fs->id, err ? strerror(err) : "closed");
+        fs->outage_start = fs->down_since = now;
+        fs->recovering = 0;
+        fs->reconnects.losses++;
+        if (cluster)
+        {
+            cluster->stats.connections_lost++;
+            if (cluster->active == fs->member && cluster->lost == 0)
+                cluster->lost = now;
+        }
+    }
+    fs->down = 1;
+    if (fs->outbuf)
+    {
+        msgbuf_reset(fs->outbuf);   // nobody will read it, nor report on its zerocopy sends
+        fakeswitch_outbuf_put(fs, fs->outbuf);
+        fs->outbuf = NULL;
+    }
+    fs->carry_len = 0;
+    fakeswitch_give_up_probes(fs);
+    fakeswitch_give_up_echoes(fs);
+    if (fs->reconnect)
+    {
+        close(fs->sock);
+        fs->sock = -1;
+        fs->switch_status = START;
+        fs->reconnect_at = now + fs->backoff * 1000000ull;
+        fs->backoff = MIN(fs->backoff * 2, fs->reconnect->backoff_max);
+    }
+    // without reconnects, the socket stays open, so the event loops'
+    //  registrations stay valid
+    if (cluster)
+        fakeswitch_elect(cluster);
+}
+
+/***********************************************************************/
+void fakeswitch_set_reconnect(struct fakeswitch *fs, const struct reconnect_policy * policy)
+{
+    fs->reconnect = policy;
+    fs->backoff = policy->backoff_min;
+}
+
+/***********************************************************************
+ * Open a new connection once the backoff has passed and start the
+ *  handshake over; a failed attempt backs off further
+ */
+static void fakeswitch_reconnect(struct fakeswitch *fs)
+{
+    const struct reconnect_policy * policy = fs->reconnect;
+    uint64_t now = now_ns();
+    int one = 1;
+    int sock;
+
+    if (now < fs->reconnect_at)
+        return;
+    fs->reconnects.attempts++;
+    sock = socket(policy->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0)
+    {
+        perror("reconnect: socket");
+        exit(1);
+    }
+    if (sources_bind(policy->sources, sock) < 0 ||
+            (connect(sock, (struct sockaddr *) &policy->addr, policy->addrlen) < 0 && errno != EINPROGRESS))
+    {
+        debug_msg(fs, "reconnect failed: %s", strerror(errno));
+        close(sock);
+        fs->reconnect_at = now + fs->backoff * 1000000ull;
+        fs->backoff = MIN(fs->backoff * 2, policy->backoff_max);
+        return;
+    }
+    debug_msg(fs, "reconnecting");
+    fs->sock = sock;
+    fs->sock_generation++;
+    fs->down = 0;
+    fs->switch_status = START;
+    memset(&fs->handshake, 0, sizeof(fs->handshake));
+    fs->handshake.connect_start = now;
+    if (fs->zerocopy_min > 0 && setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+        fs->zerocopy_min = 0;
+    fakeswitch_send_hello(fs);
+    if (fs->cluster)
+    {
+        fs->role = ROLE_EQUAL;      // a new connection starts out equal
+        fakeswitch_elect(fs->cluster);
+    }
+}
+
+/***********************************************************************
+ * The handshake after an outage is done: probes go out again, and the
+ *  rate they come back at tells when the switch has recovered
+ */
+static void fakeswitch_back_up(struct fakeswitch *fs)
+{
+    uint64_t now = fs->handshake.ready;
+    uint64_t outage = now - fs->outage_start;
+
+    fs->reconnects.handshakes++;
+    fs->reconnects.outage_sum += outage;
+    if (outage > fs->reconnects.outage_max)
+        fs->reconnects.outage_max = outage;
+    fs->reconnects.downtime += now - fs->down_since;
+    fs->down_since = 0;
+    fs->recovering = fs->outage_start;
+    fs->outage_start = 0;
+    fs->backoff = fs->reconnect->backoff_min;
+    fs->rate_bucket_start = now;
+    fs->rate_bucket_count = 0;
+    debug_msg(fs, "back up after %.1lf ms", outage / 1e6);
+}
+
+/***********************************************************************
+ * Count responses in buckets of RATE_BUCKET_MS; a smoothed rate is kept
+ *  while the switch is healthy, and a recovering switch is compared to it
+ */
+static void fakeswitch_rate_sample(struct fakeswitch *fs, int responses)
+{
+    uint64_t now = now_ns();
+    uint64_t elapsed, recovery;
+    double rate;
+
+    if (fs->rate_bucket_start == 0)
+        fs->rate_bucket_start = now;
+    fs->rate_bucket_count += responses;
+    elapsed = now - fs->rate_bucket_start;
+    if (elapsed < RATE_BUCKET_MS * 1000000ull)
+        return;
+    rate = fs->rate_bucket_count / (double) elapsed;
+    if (fs->recovering == 0)
+        fs->rate = fs->rate > 0 ? 0.75 * fs->rate + 0.25 * rate : rate;
+    else if (rate >= fs->rate * RECOVERED_PERCENT / 100)
+    {
+        recovery = now - fs->recovering;
+        fs->reconnects.recoveries++;
+        fs->reconnects.recovery_sum += recovery;
+        if (recovery > fs->reconnects.recovery_max)
+            fs->reconnects.recovery_max = recovery;
+        fs->recovering = 0;
+    }
+    fs->rate_bucket_start = now;
+    fs->rate_bucket_count = 0;
+}
+
+/***********************************************************************/
+void reconnect_stats_add(struct reconnect_stats *sum, const struct reconnect_stats *stats)
+{
+    sum->losses += stats->losses;
+    sum->attempts += stats->attempts;
+    sum->handshakes += stats->handshakes;
+    sum->recoveries += stats->recoveries;
+    sum->outage_sum += stats->outage_sum;
+    if (stats->outage_max > sum->outage_max)
+        sum->outage_max = stats->outage_max;
+    sum->recovery_sum += stats->recovery_sum;
+    if (stats->recovery_max > sum->recovery_max)
+        sum->recovery_max = stats->recovery_max;
+    sum->downtime += stats->downtime;
+    sum->down += stats->down;
+}
+
+/***********************************************************************/
+void fakeswitch_get_reconnect_stats(struct fakeswitch *fs, struct reconnect_stats *stats)
+{
+    uint64_t now = now_ns();
+
+    if (fs->down_since)
+    {
+        fs->reconnects.downtime += now - fs->down_since;
+        fs->down_since = now;   // the rest counts in the next period
+    }
+    reconnect_stats_add(stats, &fs->reconnects);
+    if (fs->outage_start)
+        stats->down++;
+    memset(&fs->reconnects, 0, sizeof(fs->reconnects));
+}
+
+/***********************************************************************
+ * Handle received bytes where they are; only a frame split across
+ *  reads is copied, into fs->carry, and handled from there once the
+ *  rest of it arrives
+ */
+static void fakeswitch_take_input(struct fakeswitch *fs, char * data, int len)
+{
+    int used = 0;
+    int need;
+    if (fs->handshake.connected == 0)
+        fakeswitch_connected(fs);   // the controller may talk before we could send
+    fs->flows_idle = 0;             // it may have changed the flow table, or answered probes
+    while (fs->carry_len > 0 && used < len)
     {
-        pofh = msgbuf_peek(fs->inbuf);
-        if(count < ntohs(pofh->length))
-            return;     // msg not all there yet
-        msgbuf_pull(fs->inbuf, NULL, ntohs(pofh->length));
-        pof_flow_entry * fm;
-        pof_packet_out * po;
-        pof_role_request * rr;
-        switch(pofh->type)
+        need = MIN(fakeswitch_carry_need(fs) - fs->carry_len, len - used);
+        fakeswitch_carry(fs, data + used, need);
+        used += need;
+        if (fs->carry_len < fakeswitch_carry_need(fs))
+            continue;   // that was only the header
+        fakeswitch_parse_frames(fs, fs->carry, fs->carry_len);
+        fs->carry_len = 0;
+        if (fs->carry_cap > CARRY_KEEP)
+        {
+            fakeswitch_mem_add(fs, -fs->carry_cap);
+            free(fs->carry);
+            fs->carry = NULL;
+            fs->carry_cap = 0;
+        }
+    }
+    if (fs->carry_len > 0)
+        return;
+    used += fakeswitch_parse_frames(fs, data + used, len - used);   // all frames in one pass
+    if (used < len)
+        fakeswitch_carry(fs, data + used, len - used);   // the trailing partial frame
+}
+
+/***********************************************************************
+ * How long the carry has to get before the frame in it can be handled:
+ *  first the header, which then tells the frame's length
+ */
+static int fakeswitch_carry_need(struct fakeswitch *fs)
+{
+    int msglen;
+    if (fs->carry_len < sizeof(struct pof_header))
+        return sizeof(struct pof_header);
+    msglen = ntohs(((struct pof_header *) fs->carry)->length);
+    // fakeswitch_parse_frames() rejects a frame shorter than its header
+    return msglen > sizeof(struct pof_header) ? msglen : sizeof(struct pof_header);
+}
+
+/***********************************************************************/
+static void fakeswitch_carry(struct fakeswitch *fs, const char * data, int count)
+{
+    if (fs->carry_len + count > fs->carry_cap)
+    {
+        int cap = fs->carry_len + count;
+        if (cap < fakeswitch_carry_need(fs))
+            cap = fakeswitch_carry_need(fs);
+        fs->carry = realloc(fs->carry, cap);
+        assert(fs->carry);
+        fakeswitch_mem_add(fs, cap - fs->carry_cap);
+        fs->carry_cap = cap;
+    }
+    memcpy(fs->carry + fs->carry_len, data, count);
+    fs->carry_len += count;
+}
+
+/***********************************************************************
+ * Walk all complete frames in data in one pass, without copying them.
+ *  Responses to our probes, which make up nearly all of the traffic,
+ *  are handled right here; anything else goes to
+ *  fakeswitch_handle_control().  All frames of a batch share one
+ *  arrival time.
+ * @return  Bytes used up; the trailing partial frame is left to the caller
+ */
+static int fakeswitch_parse_frames(struct fakeswitch *fs, char * data, int len)
+{
+    struct pof_header * pofh;
+    pof_packet_out * po;
+    pof_flow_entry * fm;
+    int off = 0;
+    int msglen;
+    int responses = 0;
+    uint64_t now = 0;
+
+    while (len - off >= sizeof(struct pof_header))
+    {
+        pofh = (struct pof_header *) (data + off);
+        msglen = ntohs(pofh->length);
+        if (msglen < sizeof(struct pof_header))
+        {
+            fprintf(stderr, "switch %d: controller sent a message of length %d ... exiting\n",
+                    fs->id, msglen);
+            exit(1);
+        }
+        if (len - off < msglen)
+            break;      // msg not all there yet
+        off += msglen;
+        switch (pofh->type)
         {
             case POFT_PACKET_OUT:
                 po = (pof_packet_out *) pofh;
-                if ( fs->switch_status == READY_TO_SEND && ! packet_out_is_lldp(po)) { 
-                    // assume this is in response to what we sent
-                    fs->recv_count++;        // got response to what we went
-                    fs->probe_state--;
-                }
+                if (fs->switch_status != READY_TO_SEND || packet_out_is_lldp(po))
+                    break;
+                if (now == 0)
+                    now = now_ns();
+                responses += fakeswitch_probe_answered(fs, ntohl(pofh->xid), ntohl(po->bufferId), now);
                 break;
             case POFT_FLOW_MOD:
                 fm = (pof_flow_entry *) pofh;
-                if(fs->switch_status == READY_TO_SEND && (fm->command == htons(POFFC_ADD) ||
-                        fm->command == htons(POFFC_MODIFY_STRICT)))
+                if (fs->table->capacity > 0)
+                    fakeswitch_flow_mod(fs, fm, msglen);
+                if (fs->switch_status != READY_TO_SEND || (fm->command != POFFC_ADD &&
+                        fm->command != POFFC_MODIFY_STRICT))
+                    break;
+                if (now == 0)
+                    now = now_ns();
+                // flow_mods carry no buffer_id
+                responses += fakeswitch_probe_answered(fs, ntohl(pofh->xid), 0xffffffff, now);
+                break;
+            case POFT_ECHO_REPLY:
+                if (now == 0)
+                    now = now_ns();
+                if (ntohl(pofh->xid) & ECHO_LANE_XID)
+                {
+                    fakeswitch_echo_answered(fs, ntohl(pofh->xid), now);
+                    break;
+                }
+                // else only the echo requests of a workload mix are answered
+                if (fs->switch_status != READY_TO_SEND)
+                    break;
+                if (fakeswitch_probe_answered(fs, ntohl(pofh->xid), PROBE_ECHO, now))
                 {
-                    fs->recv_count++;        // got response to what we went
+                    fs->mix.answered[WORKLOAD_ECHO]++;
                     fs->probe_state--;
                 }
                 break;
-            case POFT_TABLE_MOD:
-                debug_msg(fs, "Got table_mode message");
-                printf("Got table_mode message\n");
-                break;
-            case POFT_FEATURES_REQUEST:
-                // pull msgs out of buffer
-                debug_msg(fs, "got feature_req");
-                // Send features reply
-                count = make_features_reply(fs->id, pofh->xid, buf, BUFLEN);
-                msgbuf_push(fs->outbuf, buf, count);
-                debug_msg(fs, "sent feature_rsp");
-                fakeswitch_change_status(fs, fs->learn_dstmac ? LEARN_DSTMAC : READY_TO_SEND);
-                break;
-            case POFT_SET_CONFIG:
-                // pull msgs out of buffer
-                debug_msg(fs, "parsing set_config");
-                parse_set_config(pofh);
-                break;
-            case POFT_GET_CONFIG_REQUEST:
-                // pull msgs out of buffer
-                debug_msg(fs, "got get_config_request");
-                count = make_config_reply(fs->id, pofh->xid, buf, BUFLEN);
-                msgbuf_push(fs->outbuf, buf, count);
-                debug_msg(fs, "sent get_config_reply");
-
-                count = make_table_resource_reply(pofh->xid, buf, BUFLEN);
-                msgbuf_push(fs->outbuf, buf, count);
-                debug_msg(fs, "send table resource report, length: %d", count);
-
-                //the fake switch has two port, thus we need to send two port status message.
-                count = make_port_status_reply(pofh->xid, buf, BUFLEN);
-                msgbuf_push(fs->outbuf, buf, count);
-                debug_msg(fs, "sent port status, length: %d", count);
-                msgbuf_push(fs->outbuf, buf, count);
-                debug_msg(fs, "sent port status, length: %d", count);
-
-
-                if ((fs->mode == MODE_LATENCY)  && ( fs->probe_state == 1 )) {
-                    fs->probe_state = 0;        // restart probe state b/c some
-                                                // controllers block on config
-                    debug_msg(fs, "reset probe state b/c of get_config_reply");
+            default:
+                if (responses > 0)
+                {
+                    // control messages may look at probe_state
+                    fakeswitch_count_responses(fs, responses);
+                    responses = 0;
                 }
-                break;
-            case POFT_HELLO:
-                debug_msg(fs, "got hello");
-                // we already sent our own HELLO; don't respond
-                break;
-            case POFT_ECHO_REQUEST:
-                debug_msg(fs, "got echo, sent echo_resp");
-                echo.version= POF_VERSION;
-                echo.length = htons(sizeof(echo));
-                echo.type   = POFT_ECHO_REPLY;
-                echo.xid = pofh->xid;
-                msgbuf_push(fs->outbuf,(char *) &echo, sizeof(echo));
-                break;
-            case POFT_ROLE_REQUEST:
-                debug_msg(fs, "got role_request, sent role_reply");
-                rr = (pof_role_request *) pofh;
-                role_reply.header.version = POF_VERSION;
-                // pay attention: sizeof(role_reply) = 12, but the real length of role_reply is 9 bytes.
-                role_reply.header.length = htons(9);
-                role_reply.header.type = POFT_ROLE_REPLY;
-                role_reply.header.xid = pofh->xid;
-                role_reply.role = rr->role;
-                msgbuf_push(fs->outbuf,(char *) &role_reply, 9);
-                break;
-            default: 
-    //            if(fs->debug)
-                    fprintf(stderr, "Ignoring POF message type %d\n", pofh->type);
-        };
-        if(fs->probe_state < 0)
-        {
-                debug_msg(fs, "WARN: Got more responses than probes!!: : %d",
-                            fs->probe_state);
-                fs->probe_state =0;
+                fakeswitch_handle_control(fs, pofh);
         }
     }
+    fakeswitch_count_responses(fs, responses);
+    return off;
 }
+
 /***********************************************************************/
-static void fakeswitch_handle_write(struct fakeswitch *fs)
+static void fakeswitch_count_responses(struct fakeswitch *fs, int responses)
+{
+    struct mastership * cluster = fs->cluster;
+    uint64_t gap;
+    if (cluster && cluster->lost && responses > 0)
+    {
+        // the first answer of the new master ends the failover
+        gap = now_ns() - cluster->lost;
+        cluster->lost = 0;
+        cluster->stats.failovers++;
+        cluster->stats.failover_sum += gap;
+        if (gap > cluster->stats.failover_max)
+            cluster->stats.failover_max = gap;
+    }
+    if (fs->reconnect && responses > 0)
+        fakeswitch_rate_sample(fs, responses);
+    fs->recv_count += responses;        // got response to what we went
+    if (fs->workload)
+        fs->mix.answered[WORKLOAD_PACKET_IN] += responses;
+    fs->probe_state -= responses;
+    if(fs->probe_state < 0)
+    {
+            debug_msg(fs, "WARN: Got more responses than probes!!: : %d",
+                        fs->probe_state);
+            fs->probe_state =0;
+    }
+}
+
+/***********************************************************************/
+static void fakeswitch_handle_control(struct fakeswitch *fs, struct pof_header * pofh)
+{
+    int count;
+    struct pof_header echo;
+    struct pof_role_reply role_reply;
+    //struct ofp_header barrier;
+    char buf[CONTROL_BUFLEN];
+    pof_role_request * rr;
+
+    switch(pofh->type)
+    {
+        case POFT_TABLE_MOD:
+            debug_msg(fs, "Got table_mode message");
+            printf("Got table_mode message\n");
+            break;
+        case POFT_FEATURES_REQUEST:
+            // pull msgs out of buffer
+            debug_msg(fs, "got feature_req");
+            HANDSHAKE_STAMP(fs, features_request);
+            // Send features reply
+            count = make_features_reply(fs->id, pofh->xid, buf, sizeof(buf));
+            fakeswitch_push(fs, buf, count);
+            debug_msg(fs, "sent feature_rsp");
+            fakeswitch_change_status(fs, fs->learn_dstmac ? LEARN_DSTMAC : READY_TO_SEND);
+            break;
+        case POFT_SET_CONFIG:
+            // pull msgs out of buffer
+            debug_msg(fs, "parsing set_config");
+            parse_set_config(pofh);
+            break;
+        case POFT_GET_CONFIG_REQUEST:
+            // pull msgs out of buffer
+            debug_msg(fs, "got get_config_request");
+            HANDSHAKE_STAMP(fs, get_config_request);
+            count = make_config_reply(fs->id, pofh->xid, buf, sizeof(buf));
+            fakeswitch_push(fs, buf, count);
+            debug_msg(fs, "sent get_config_reply");
+
+            count = make_table_resource_reply(pofh->xid, buf, sizeof(buf));
+            fakeswitch_push(fs, buf, count);
+            debug_msg(fs, "send table resource report, length: %d", count);
+
+            //the fake switch has two port, thus we need to send two port status message.
+            count = make_port_status_reply(pofh->xid, buf, sizeof(buf));
+            fakeswitch_push(fs, buf, count);
+            debug_msg(fs, "sent port status, length: %d", count);
+            fakeswitch_push(fs, buf, count);
+            debug_msg(fs, "sent port status, length: %d", count);
+
+
+            if ((fs->mode == MODE_LATENCY)  && ( fs->probe_state == 1 )) {
+                fs->probe_state = 0;        // restart probe state b/c some
+                                            // controllers block on config
+                debug_msg(fs, "reset probe state b/c of get_config_reply");
+            }
+            break;
+        case POFT_HELLO:
+            debug_msg(fs, "got hello");
+            HANDSHAKE_STAMP(fs, hello);
+            // we already sent our own HELLO; don't respond
+            break;
+        case POFT_ECHO_REQUEST:
+            debug_msg(fs, "got echo, sent echo_resp");
+            echo.version= POF_VERSION;
+            echo.length = htons(sizeof(echo));
+            echo.type   = POFT_ECHO_REPLY;
+            echo.xid = pofh->xid;
+            fakeswitch_push(fs,(char *) &echo, sizeof(echo));
+            break;
+        case POFT_ROLE_REQUEST:
+            debug_msg(fs, "got role_request, sent role_reply");
+            rr = (pof_role_request *) pofh;
+            if (fs->cluster)
+                fakeswitch_set_role(fs, rr->role);
+            role_reply.header.version = POF_VERSION;
+            // pay attention: sizeof(role_reply) = 12, but the real length of role_reply is 9 bytes.
+            role_reply.header.length = htons(9);
+            role_reply.header.type = POFT_ROLE_REPLY;
+            role_reply.header.xid = pofh->xid;
+            role_reply.role = fs->cluster ? fs->role : rr->role;     // alone, we agree to anything
+            fakeswitch_push(fs,(char *) &role_reply, 9);
+            break;
+        default: 
+//            if(fs->debug)
+                fprintf(stderr, "Ignoring POF message type %d\n", pofh->type);
+    };
+}
+/***********************************************************************/
+int fakeswitch_want_write(struct fakeswitch *fs)
+{
+    if (fs->down)
+        return 0;
+    if (fakeswitch_count_buffered(fs) > 0)
+        return 1;
+    if (fs->switch_status != READY_TO_SEND || fs->paced || !fakeswitch_may_probe(fs))
+        return 0;
+    if (fs->flows_idle)
+        return 0;           // all forwarded: nothing for the socket to pace
+    if (fakeswitch_probe_room(fs) == 0)
+        return 0;           // output buffer full: wait for the socket to drain it
+    if (fs->window.size > 0 && fs->probe_state >= fs->window.size)
+        return 0;           // wait for responses
+    return fs->max_send_count > fs->send_count;
+}
+
+/***********************************************************************/
+void fakeswitch_handle_write(struct fakeswitch *fs)
+{
+    if (fakeswitch_reconnecting(fs))
+        fakeswitch_reconnect(fs);
+    if (fs->down)
+        return;
+    fakeswitch_queue_output(fs);
+    // send any data if it's queued
+    fakeswitch_flush(fs);
+}
+
+/***********************************************************************/
+void fakeswitch_queue_output(struct fakeswitch *fs)
 {
-    char buf[BUFLEN];
-    int count ;
     int send_count = 0 ;
     int throughput_buffer = BUFLEN;
-    int i;
     int buffer_capacity;
     if( fs->switch_status == READY_TO_SEND) 
     {
-        if ((fs->mode == MODE_LATENCY)  && ( fs->probe_state == 0 ))      
-            send_count = 1;                 // just send one packet
-        else if ((fs->mode == MODE_THROUGHPUT) &&
-                 (msgbuf_count_buffered(fs->outbuf) < throughput_buffer) &&
+        if (fs->paced || !fakeswitch_may_probe(fs))
+            ;                               // the arrival schedule or another connection decides
+        else if (fs->flows_idle)
+            ;                               // the data plane forwarded a whole cycle, see fakeswitch_queue_messages()
+        else if ((fakeswitch_count_buffered(fs) < throughput_buffer) &&
                  (fs->max_send_count > fs->send_count))
         {
-            // keep buffer full
-            buffer_capacity = (throughput_buffer - msgbuf_count_buffered(fs->outbuf)) / fs->probe_size;
+            // keep buffer full, up to the window
+            buffer_capacity = (throughput_buffer - fakeswitch_count_buffered(fs)) /
+                fs->probe_size_max;
+            if (buffer_capacity > fakeswitch_probe_room(fs))
+                buffer_capacity = fakeswitch_probe_room(fs);    // the ring only grows so far
             send_count = fs->max_send_count - fs->send_count;
             if (buffer_capacity < send_count)
                 send_count = buffer_capacity;
+            if (fs->window.size > 0 && fs->window.size - fs->probe_state < send_count)
+                send_count = fs->window.size - fs->probe_state;
         }
-        for (i = 0; i < send_count; i++)
-        {
-            // queue up packet
-            
-            fs->probe_state++;
-            // TODO come back and remove this copy
-            count = make_packet_in(fs->id, fs->xid++, fs->current_buffer_id, buf, BUFLEN, fs->current_mac_address);
-            fs->current_mac_address = ( fs->current_mac_address + 1 ) % fs->total_mac_addresses;
-            fs->current_buffer_id =  ( fs->current_buffer_id + 1 ) % NUM_BUFFER_IDS;
-            msgbuf_push(fs->outbuf, buf, count);
-            debug_msg(fs, "send message %d", i);
-        }
-        fs->send_count = fs->send_count + send_count;
+        if (send_count > 0)
+            fakeswitch_queue_probes(fs, send_count, now_ns());  // the whole batch is queued at once
     } else if( fs->switch_status == WAITING) 
     {
         struct timeval now;
@@ -552,16 +1231,797 @@ static void fakeswitch_handle_write(struct fakeswitch *fs)
         fakeswitch_learn_dstmac(fs);
         fakeswitch_change_status(fs, READY_TO_SEND);
     }
-    // send any data if it's queued
-    if( msgbuf_count_buffered(fs->outbuf) > 0)
-        msgbuf_write(fs->outbuf, fs->sock, 0);
 }
+
+/***********************************************************************/
+int fakeswitch_queue_probe(struct fakeswitch *fs, uint64_t scheduled)
+{
+    if (fs->switch_status != READY_TO_SEND || fs->send_count >= fs->max_send_count ||
+            !fakeswitch_may_probe(fs) || fakeswitch_probe_room(fs) == 0)
+        return 0;
+    return fakeswitch_queue_probes(fs, 1, scheduled);
+}
+
+/***********************************************************************
+ * How many probes fit into the output buffer once it has grown as far
+ *  as it may, keeping some space for the replies the controller's
+ *  requests need; the pool's budget may still allow fewer
+ */
+static int fakeswitch_probe_room(struct fakeswitch *fs)
+{
+    int space = fs->outbuf_max - OUTBUF_CONTROL_RESERVE;
+    if (fs->outbuf)
+        space -= fs->outbuf->len - msgbuf_count_free(fs->outbuf);
+    return space > 0 ? space / fs->probe_size_max : 0;
+}
+
+/***********************************************************************
+ * Make sure count more bytes fit into the output buffer: take a ring
+ *  from the pool, or move what is queued into one twice the size (or
+ *  more), up to outbuf_max.  Zerocopy sends still in flight pin the
+ *  ring, so it stays as it is until they complete.
+ * @return  Free bytes in the output buffer; less than count if it can't
+ *          grow any further or the pool refused a ring
+ */
+static int fakeswitch_outbuf_room(struct fakeswitch *fs, int count)
+{
+    struct msgbuf * bigger;
+    int buffered = fakeswitch_count_buffered(fs);
+    int size = fs->outbuf ? fs->outbuf->len * 2 : BUFPOOL_MIN;
+
+    if (fs->outbuf && (msgbuf_count_free(fs->outbuf) >= count || fs->outbuf->len >= fs->outbuf_max ||
+                msgbuf_zerocopy_pending(fs->outbuf)))
+        return msgbuf_count_free(fs->outbuf);
+    while (size < buffered + count && size < fs->outbuf_max)
+        size *= 2;
+    bigger = bufpool_get(size < fs->outbuf_max ? size : fs->outbuf_max);
+    if (bigger == NULL)
+        return fs->outbuf ? msgbuf_count_free(fs->outbuf) : 0;
+    fakeswitch_mem_add(fs, bigger->len);
+    if (fs->outbuf)
+    {
+        msgbuf_push(bigger, &fs->outbuf->buf[fs->outbuf->start], buffered);
+        fakeswitch_outbuf_put(fs, fs->outbuf);
+    }
+    fs->outbuf = bigger;
+    return msgbuf_count_free(bigger);
+}
+
+/***********************************************************************
+ * Hand a ring of the switch back to the pool
+ */
+static void fakeswitch_outbuf_put(struct fakeswitch *fs, struct msgbuf * mbuf)
+{
+    fs->io.zc_copied += mbuf->zc_copied;
+    fakeswitch_mem_add(fs, -mbuf->len);
+    bufpool_put(mbuf);
+}
+
+/***********************************************************************/
+static inline void fakeswitch_mem_add(struct fakeswitch *fs, long bytes)
+{
+    fs->mem_bytes += bytes;
+    if (fs->mem_bytes > fs->mem_peak)
+        fs->mem_peak = fs->mem_bytes;
+}
+
+/***********************************************************************/
+long fakeswitch_get_mem_peak(struct fakeswitch *fs)
+{
+    long peak = fs->mem_peak;
+    fs->mem_peak = fs->mem_bytes;
+    return peak;
+}
+
+/***********************************************************************/
+struct msgbuf * fakeswitch_take_output(struct fakeswitch *fs)
+{
+    struct msgbuf * mbuf = fs->outbuf;
+    fs->outbuf = NULL;
+    return mbuf;
+}
+
+/***********************************************************************/
+void fakeswitch_sent_output(struct fakeswitch *fs, struct msgbuf * mbuf)
+{
+    if (msgbuf_count_buffered(mbuf) == 0)
+    {
+        fakeswitch_outbuf_put(fs, mbuf);
+        return;
+    }
+    if (fs->outbuf)
+    {
+        // unsent bytes go first, then whatever was queued meanwhile
+        if (msgbuf_push(mbuf, &fs->outbuf->buf[fs->outbuf->start], msgbuf_count_buffered(fs->outbuf)) < 0)
+            fprintf(stderr, "switch %d: output buffer full, dropped %d bytes\n",
+                    fs->id, msgbuf_count_buffered(fs->outbuf));
+        fakeswitch_outbuf_put(fs, fs->outbuf);
+    }
+    fs->outbuf = mbuf;
+}
+
+/***********************************************************************
+ * Queue a protocol message; the output buffer only grows so far, so if
+ *  even the reserve is used up (or the pool has no ring to spare) the
+ *  message is dropped, like an overloaded switch would
+ */
+static void fakeswitch_push(struct fakeswitch *fs, char * buf, int count)
+{
+    if (fakeswitch_outbuf_room(fs, count) < count || msgbuf_push(fs->outbuf, buf, count) < 0)
+        fprintf(stderr, "switch %d: output buffer full, dropped a %d byte message\n", fs->id, count);
+}
+
+/***********************************************************************
+ * Stamp count probes straight into the output buffer
+ *  and remember now as their send time
+ * @return  Probes queued: count, unless the pool refused a big enough ring
+ */
+static int fakeswitch_queue_probes(struct fakeswitch *fs, int count, uint64_t now)
+{
+    char * probe;
+    int i;
+    // callers check fakeswitch_probe_room(); the budget may still leave less
+    i = fakeswitch_outbuf_room(fs, count * fs->probe_size_max) / fs->probe_size_max;
+    if (i < count)
+        count = i;
+    if (count == 0)
+        return 0;
+    if (fs->workload || fs->trace || fs->table->capacity > 0)
+    {
+        fakeswitch_queue_messages(fs, count, now);
+        return count;
+    }
+    probe = msgbuf_reserve(fs->outbuf, count * fs->probe_size);
+    assert(probe);
+    for (i = 0; i < count; i++, probe += fs->probe_size)
+    {
+        // queue up packet
+        fs->probe_state++;
+        fakeswitch_probe_sent(fs, fs->xid, fs->current_buffer_id, now);
+        fakeswitch_stamp_packet_in(fs, probe);
+        fs->xid = NEXT_XID(fs->xid);
+        fs->current_mac_address = ( fs->current_mac_address + 1 ) % fs->total_mac_addresses;
+        fs->current_buffer_id =  ( fs->current_buffer_id + 1 ) % NUM_BUFFER_IDS;
+        debug_msg(fs, "send message %d", i);
+    }
+    fs->send_count = fs->send_count + count;
+    return count;
+}
+
+/***********************************************************************
+ * Like fakeswitch_queue_probes(), but for messages that differ in size:
+ *  each one is the next of the workload cycle (or a packet_in without
+ *  one), and packet_ins may carry captured frames.  Packet_ins and echo
+ *  requests are probes and take consecutive xids and buffer_ids;
+ *  notifications go out with xid 0.  A packet_in that hits a flow takes
+ *  its arrival slot when paced, but no probe slot in a closed loop: the
+ *  next packet is looked at instead, for up to one cycle of the
+ *  generated traffic.  If a whole cycle hit and nothing was queued, no
+ *  write is left to pace the switch, so it stays idle until the
+ *  controller sends something.
+ */
+static void fakeswitch_queue_messages(struct fakeswitch *fs, int count, uint64_t now)
+{
+    enum workload_type type = WORKLOAD_PACKET_IN;
+    char * msg;
+    int size;
+    int cycle = fs->trace ? fs->trace->n_frames : fs->total_mac_addresses;
+    int forwarded = 0;      // closed loop: lookups that hit, at most one cycle
+    int queued = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (fs->workload)
+        {
+            type = fs->workload->cycle[fs->workload_pos];
+            if (++fs->workload_pos == fs->workload->cycle_len)
+                fs->workload_pos = 0;
+            fs->mix.sent[type]++;
+        }
+        if (type == WORKLOAD_PACKET_IN)
+        {
+            size = fs->trace ? fakeswitch_trace_packet_in_size(fs) : fs->probe_size;
+            msg = msgbuf_reserve(fs->outbuf, size);
+            assert(msg);    // fakeswitch_queue_probes() made room for as many of the largest message
+            if (fs->trace)
+                fakeswitch_stamp_trace_packet_in(fs, msg);
+            else
+                fakeswitch_stamp_packet_in(fs, msg);
+            fs->current_mac_address = ( fs->current_mac_address + 1 ) % fs->total_mac_addresses;
+            if (fs->table->capacity > 0 && fakeswitch_flow_lookup(fs, msg, size, now))
+            {
+                // the emulated data plane forwards it; the controller never sees it
+                msgbuf_unreserve(fs->outbuf, size);
+                if (fs->workload)
+                    fs->mix.sent[type]--;
+                if (fs->paced)
+                    continue;       // it took its arrival slot
+                if (++forwarded == cycle)
+                    break;          // a whole cycle hit
+                i--;                // ... it takes no probe slot
+                continue;
+            }
+            fakeswitch_probe_sent(fs, fs->xid, fs->current_buffer_id, now);
+            fs->send_count++;
+            queued++;
+        }
+        else
+        {
+            msg = msgbuf_reserve(fs->outbuf, fs->mix_sizes[type]);
+            assert(msg);
+            memcpy(msg, fs->mix_templates[type], fs->mix_sizes[type]);
+            queued++;
+            if (type != WORKLOAD_ECHO)
+                continue;
+            fakeswitch_probe_sent(fs, fs->xid, PROBE_ECHO, now);
+            ((struct pof_header *) msg)->xid = htonl(fs->xid);
+        }
+        fs->probe_state++;
+        fs->xid = NEXT_XID(fs->xid);
+        fs->current_buffer_id =  ( fs->current_buffer_id + 1 ) % NUM_BUFFER_IDS;
+    }
+    fs->flows_idle = (queued == 0 && forwarded == cycle);
+}
+
+/***********************************************************************
+ * Write until the output buffer is empty or the socket would block,
+ *  so a short write doesn't cost another trip through the event loop
+ */
+static void fakeswitch_flush(struct fakeswitch *fs)
+{
+    int count;
+    int zerocopy;
+    int force_copy = 0;
+
+    if (fs->outbuf == NULL)
+        return;
+    if (msgbuf_zerocopy_pending(fs->outbuf))
+        fs->io.reaps += msgbuf_reap_zerocopy(fs->outbuf, fs->sock);
+    while (msgbuf_count_buffered(fs->outbuf) > 0)
+    {
+        zerocopy = !force_copy && fs->zerocopy_min > 0 &&
+            msgbuf_count_buffered(fs->outbuf) >= fs->zerocopy_min;
+        count = msgbuf_send(fs->outbuf, fs->sock, zerocopy);
+        fs->io.writes++;
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS && zerocopy)
+            {
+                force_copy = 1;     // too many pages pinned: copy this time
+                continue;
+            }
+            break;      // EAGAIN; real errors show up on the next read
+        }
+        if (zerocopy)
+            fs->io.zc_sends++;
+        if (fs->handshake.connected == 0)
+            fakeswitch_connected(fs);
+    }
+    if (msgbuf_count_buffered(fs->outbuf) == 0 && !msgbuf_zerocopy_pending(fs->outbuf))
+    {
+        fakeswitch_outbuf_put(fs, fs->outbuf);    // all sent: the ring goes back until the next message
+        fs->outbuf = NULL;
+    }
+}
+
+/***********************************************************************/
+void fakeswitch_connected(struct fakeswitch *fs)
+{
+    HANDSHAKE_STAMP(fs, connected);
+}
+
+/***********************************************************************/
+void fakeswitch_enable_zerocopy(struct fakeswitch *fs, int min_bytes)
+{
+    int one = 1;
+    if (setsockopt(fs->sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+    {
+        perror("setsockopt(SO_ZEROCOPY)");
+        fprintf(stderr, "switch %d: sending without MSG_ZEROCOPY\n", fs->id);
+        return;
+    }
+    fs->zerocopy_min = min_bytes;
+}
+
+/***********************************************************************/
+void fakeswitch_get_io_stats(struct fakeswitch *fs, struct io_stats *stats)
+{
+    stats->reads += fs->io.reads;
+    stats->writes += fs->io.writes;
+    stats->reaps += fs->io.reaps;
+    stats->zc_sends += fs->io.zc_sends;
+    stats->zc_copied += fs->io.zc_copied;
+    memset(&fs->io, 0, sizeof(fs->io));
+    if (fs->outbuf)
+    {
+        stats->zc_copied += fs->outbuf->zc_copied;
+        fs->outbuf->zc_copied = 0;
+    }
+}
+
+/***********************************************************************/
+void fakeswitch_set_workload(struct fakeswitch *fs, const struct workload * workload)
+{
+    char buf[CONTROL_BUFLEN];
+    int i;
+
+    fs->workload = workload;
+    fs->workload_pos = fs->id % workload->cycle_len;    // don't let all switches send the same type at once
+    for (i = 0; i < WORKLOAD_TYPES; i++)
+    {
+        switch (i)
+        {
+            case WORKLOAD_PACKET_IN:
+                fs->mix_templates[i] = fs->probe_template;
+                fs->mix_sizes[i] = fs->probe_size;
+                break;
+            case WORKLOAD_ECHO:
+                fs->mix_sizes[i] = make_echo_request(0, buf, sizeof(buf));
+                break;
+            case WORKLOAD_PORT_STATUS:
+                fs->mix_sizes[i] = make_port_status_reply(0, buf, sizeof(buf));
+                break;
+            case WORKLOAD_FLOW_REMOVED:
+                fs->mix_sizes[i] = make_flow_removed(0, buf, sizeof(buf));
+                break;
+            case WORKLOAD_RESOURCE_REPORT:
+                fs->mix_sizes[i] = make_table_resource_reply(0, buf, sizeof(buf));
+                break;
+        }
+        if (i != WORKLOAD_PACKET_IN)
+        {
+            fs->mix_templates[i] = malloc(fs->mix_sizes[i]);
+            assert(fs->mix_templates[i]);
+            memcpy(fs->mix_templates[i], buf, fs->mix_sizes[i]);
+            fakeswitch_mem_add(fs, fs->mix_sizes[i]);
+        }
+    }
+    fakeswitch_update_size_max(fs);
+}
+
+/***********************************************************************/
+void fakeswitch_set_trace(struct fakeswitch *fs, const struct pcap_trace * trace)
+{
+    fs->trace = trace;
+    // spread the switches over the capture
+    fs->trace_pos = (uint64_t) fs->id * 2654435761u % trace->n_frames;
+    fakeswitch_update_size_max(fs);
+}
+
+/***********************************************************************
+ * Room in the output buffer is counted in messages of this size
+ */
+static void fakeswitch_update_size_max(struct fakeswitch *fs)
+{
+    int i;
+    fs->probe_size_max = fs->trace ? (int) offsetof(pof_packet_in, data) +
+        (fs->trace->max_caplen < POF_PACKET_IN_MAX_LENGTH ? fs->trace->max_caplen : POF_PACKET_IN_MAX_LENGTH) :
+        fs->probe_size;
+    if (fs->workload == NULL)
+        return;
+    if (fs->workload->weights[WORKLOAD_PACKET_IN] == 0)
+        fs->probe_size_max = 0;
+    for (i = 0; i < WORKLOAD_TYPES; i++)
+        if (i != WORKLOAD_PACKET_IN && fs->workload->weights[i] > 0 && fs->mix_sizes[i] > fs->probe_size_max)
+            fs->probe_size_max = fs->mix_sizes[i];
+}
+
+/***********************************************************************/
+static int fakeswitch_trace_packet_in_size(struct fakeswitch *fs)
+{
+    uint32_t caplen = fs->trace->frames[fs->trace_pos].caplen;
+    return offsetof(pof_packet_in, data) + (caplen < POF_PACKET_IN_MAX_LENGTH ? caplen : POF_PACKET_IN_MAX_LENGTH);
+}
+
+/***********************************************************************
+ * A packet_in around the frame at trace_pos, which moves on to the next
+ *  frame; the frame goes out as captured, MAC addresses and all
+ * @return  Bytes written, fakeswitch_trace_packet_in_size() before the call
+ */
+static int fakeswitch_stamp_trace_packet_in(struct fakeswitch *fs, char * buf)
+{
+    const struct pcap_frame * frame = &fs->trace->frames[fs->trace_pos];
+    pof_packet_in * pi = (pof_packet_in *) buf;
+    int size = fakeswitch_trace_packet_in_size(fs);
+
+    memcpy(buf, fs->probe_template, offsetof(pof_packet_in, data));
+    pi->header.length = htons(size);
+    pi->header.xid = htonl(fs->xid);
+    pi->buffer_id = htonl(fs->current_buffer_id);
+    pi->total_len = htons(frame->len < 0xffff ? frame->len : 0xffff);
+    memcpy(pi->data, frame->data, size - offsetof(pof_packet_in, data));
+    if (++fs->trace_pos == fs->trace->n_frames)
+        fs->trace_pos = 0;
+    return size;
+}
+
+/***********************************************************************/
+void fakeswitch_set_flow_table(struct fakeswitch *fs, int capacity)
+{
+    flowtable_init(&fs->flows, capacity);
+}
+
+/***********************************************************************
+ * Add, change or delete the entry of a FLOW_MOD; priorities,
+ *  instructions and timeouts are not emulated
+ */
+static void fakeswitch_flow_mod(struct fakeswitch *fs, pof_flow_entry * fm, int msglen)
+{
+    long bytes = flowtable_bytes(fs->table);
+    int n_match = fm->match_field_num;
+
+    if (msglen < offsetof(pof_flow_entry, match) + n_match * sizeof(pof_match_x))
+    {
+        fs->flow_stats.refused++;
+        return;
+    }
+    switch (fm->command)
+    {
+        case POFFC_ADD:
+        case POFFC_MODIFY:
+        case POFFC_MODIFY_STRICT:
+            switch (flowtable_insert(fs->table, fm->match, n_match))
+            {
+                case 1:
+                    fs->flow_stats.installed++;
+                    break;
+                case -1:
+                    fs->flow_stats.refused++;
+                    break;
+            }
+            break;
+        case POFFC_DELETE:
+        case POFFC_DELETE_STRICT:
+            fs->flow_stats.removed += flowtable_remove(fs->table, fm->match, n_match);
+            break;
+    }
+    fakeswitch_mem_add(fs, flowtable_bytes(fs->table) - bytes);
+}
+
+/***********************************************************************
+ * Look up the frame of a packet_in about to be queued, and tell when
+ *  the table has converged: when a whole cycle of the generated
+ *  traffic (every source MAC, or every frame of the trace, once) went
+ *  through with no more than CONVERGED_MISS_PERCENT misses, the
+ *  controller had installed flows for nearly all of it by the time
+ *  that cycle began
+ * @return  1 if an entry forwards it, 0 if it goes to the controller
+ */
+static int fakeswitch_flow_lookup(struct fakeswitch *fs, char * msg, int size, uint64_t now)
+{
+    pof_packet_in * pi = (pof_packet_in *) msg;
+    int hit = flowtable_lookup(fs->table, (uint8_t *) pi->data, size - offsetof(pof_packet_in, data));
+    int cycle = fs->trace ? fs->trace->n_frames : fs->total_mac_addresses;
+    uint64_t convergence;
+
+    if (hit)
+        fs->flow_stats.forwarded++;
+    else
+        fs->flow_stats.missed++;
+    if (fs->flows_converged)
+        return hit;
+    if (fs->flows_start == 0)
+        fs->flows_start = now;
+    if (fs->flows_cycle_packets == 0)
+        fs->flows_cycle_start = now;
+    fs->flows_cycle_missed += !hit;
+    if (++fs->flows_cycle_packets < cycle)
+        return hit;
+    if (fs->flows_cycle_missed * 100L <= (long) cycle * CONVERGED_MISS_PERCENT)
+    {
+        convergence = fs->flows_cycle_start - fs->flows_start;
+        fs->flows_converged = 1;
+        fs->flow_stats.converged++;
+        fs->flow_stats.convergence_sum += convergence;
+        if (convergence > fs->flow_stats.convergence_max)
+            fs->flow_stats.convergence_max = convergence;
+        debug_msg(fs, "flow table converged after %.1lf ms", convergence / 1e6);
+    }
+    fs->flows_cycle_packets = fs->flows_cycle_missed = 0;
+    return hit;
+}
+
+/***********************************************************************/
+void fakeswitch_get_flow_stats(struct fakeswitch *fs, struct flow_stats *stats)
+{
+    if (fs->table == &fs->flows)
+        stats->entries += fs->flows.n_entries;      // a cluster's table counts once
+    stats->installed += fs->flow_stats.installed;
+    stats->removed += fs->flow_stats.removed;
+    stats->refused += fs->flow_stats.refused;
+    stats->forwarded += fs->flow_stats.forwarded;
+    stats->missed += fs->flow_stats.missed;
+    stats->converged += fs->flow_stats.converged;
+    stats->convergence_sum += fs->flow_stats.convergence_sum;
+    if (fs->flow_stats.convergence_max > stats->convergence_max)
+        stats->convergence_max = fs->flow_stats.convergence_max;
+    memset(&fs->flow_stats, 0, sizeof(fs->flow_stats));
+}
+
+/***********************************************************************/
+int fakeswitch_send_echo(struct fakeswitch *fs, uint64_t now)
+{
+    char buf[CONTROL_BUFLEN];
+    uint64_t * sent;
+    int count;
+
+    if (fs->down || fs->switch_status != READY_TO_SEND)
+        return 0;
+    if (fs->echo_sent == NULL)
+    {
+        fs->echo_sent = calloc(ECHO_LANE_SLOTS, sizeof(uint64_t));
+        assert(fs->echo_sent);
+        fakeswitch_mem_add(fs, ECHO_LANE_SLOTS * sizeof(uint64_t));
+    }
+    sent = &fs->echo_sent[fs->echo_seq & (ECHO_LANE_SLOTS - 1)];
+    if (*sent)
+        fs->echo.lost++;        // ECHO_LANE_SLOTS requests ago, and still unanswered
+    // behind the probes already queued, like any message on the connection
+    count = make_echo_request(ECHO_LANE_XID | (fs->echo_seq & ~ECHO_LANE_XID), buf, sizeof(buf));
+    fakeswitch_push(fs, buf, count);
+    *sent = now;
+    fs->echo_seq++;
+    fs->echo.sent++;
+    return 1;
+}
+
+/***********************************************************************
+ * Record the round trip time of an echo lane request; a reply that
+ *  answers none of the last ECHO_LANE_SLOTS requests, or one already
+ *  answered or given up on, is ignored
+ */
+static void fakeswitch_echo_answered(struct fakeswitch *fs, uint32_t xid, uint64_t now)
+{
+    uint32_t back = (fs->echo_seq - xid) & ~ECHO_LANE_XID;    // 1 = the last request sent
+    uint64_t * sent = NULL;
+
+    if (back > 0 && back <= ECHO_LANE_SLOTS && back <= fs->echo_seq)
+        sent = &fs->echo_sent[xid & (ECHO_LANE_SLOTS - 1)];
+    if (sent == NULL || *sent == 0)
+    {
+        debug_msg(fs, "ignoring echo reply %08x", xid);
+        return;
+    }
+    if (fs->echo_hist)
+        histogram_record(fs->echo_hist, now - *sent);
+    *sent = 0;
+    fs->echo.answered++;
+}
+
+/***********************************************************************
+ * The connection is gone: its echo lane requests will never be answered
+ */
+static void fakeswitch_give_up_echoes(struct fakeswitch *fs)
+{
+    int i;
+    if (fs->echo_sent == NULL)
+        return;
+    for (i = 0; i < ECHO_LANE_SLOTS; i++)
+        if (fs->echo_sent[i])
+        {
+            fs->echo_sent[i] = 0;
+            fs->echo.lost++;
+        }
+}
+
+/***********************************************************************/
+void fakeswitch_get_echo_stats(struct fakeswitch *fs, struct echo_stats *stats)
+{
+    stats->sent += fs->echo.sent;
+    stats->answered += fs->echo.answered;
+    stats->lost += fs->echo.lost;
+    memset(&fs->echo, 0, sizeof(fs->echo));
+}
+
+/***********************************************************************/
+void fakeswitch_get_mix_counts(struct fakeswitch *fs, struct mix_counts *counts)
+{
+    int i;
+    for (i = 0; i < WORKLOAD_TYPES; i++)
+    {
+        counts->sent[i] += fs->mix.sent[i];
+        counts->answered[i] += fs->mix.answered[i];
+    }
+    memset(&fs->mix, 0, sizeof(fs->mix));
+}
+
+/***********************************************************************/
+void fakeswitch_get_match_stats(struct fakeswitch *fs, struct match_stats *stats)
+{
+    stats->unmatched += fs->match.unmatched;
+    stats->duplicates += fs->match.duplicates;
+    stats->late += fs->match.late;
+    stats->timed_out += fs->match.timed_out;
+    memset(&fs->match, 0, sizeof(fs->match));
+}
+/***********************************************************************
+ * Remember a probe in the slot its sequence number picks; the table
+ *  doubles while every slot holds an outstanding probe, and past
+ *  PROBE_TABLE_MAX the oldest one is given up on instead
+ */
+static void fakeswitch_probe_sent(struct fakeswitch *fs, uint32_t xid, uint32_t buffer_id, uint64_t now)
+{
+    struct probe_record * probe;
+    if (fs->probe_tail - fs->probe_head == fs->probe_slots)
+    {
+        if (fs->probe_slots < PROBE_TABLE_MAX)
+            fakeswitch_probe_grow(fs);
+        else
+        {
+            fs->probes[fs->probe_head & (fs->probe_slots - 1)].sent = PROBE_TIMED_OUT;
+            fs->match.timed_out++;
+            fakeswitch_probe_advance(fs);
+        }
+    }
+    probe = &fs->probes[fs->probe_tail++ & (fs->probe_slots - 1)];
+    probe->xid = xid;
+    probe->buffer_id = buffer_id;
+    probe->sent = now;
+}
+
+/***********************************************************************
+ * Double the probe table; answered and timed out probes move along, so
+ *  their duplicate and late responses are still recognized
+ */
+static void fakeswitch_probe_grow(struct fakeswitch *fs)
+{
+    unsigned int slots = fs->probe_slots * 2;
+    struct probe_record * probes = calloc(slots, sizeof(struct probe_record));
+    unsigned int seq;
+    assert(probes);
+    fakeswitch_mem_add(fs, (slots - fs->probe_slots) * sizeof(struct probe_record));
+    seq = fs->probe_tail < fs->probe_slots ? 0 : fs->probe_tail - fs->probe_slots;
+    for (; seq != fs->probe_tail; seq++)
+        probes[seq & (slots - 1)] = fs->probes[seq & (fs->probe_slots - 1)];
+    free(fs->probes);
+    fs->probes = probes;
+    fs->probe_slots = slots;
+}
+
+/***********************************************************************
+ * Move probe_head past the probes that are no longer outstanding
+ */
+static void fakeswitch_probe_advance(struct fakeswitch *fs)
+{
+    while (fs->probe_head != fs->probe_tail &&
+            fs->probes[fs->probe_head & (fs->probe_slots - 1)].sent <= PROBE_TIMED_OUT)
+        fs->probe_head++;
+}
+
+/***********************************************************************
+ * Look up the probe a response names.  Probes get consecutive xids and
+ *  buffer_ids, so how far an id lies behind the next one to be sent is
+ *  how many probes ago it went out, which picks its slot without any
+ *  search.  Match on buffer_id when the response carries one, on xid
+ *  otherwise; buffer_id PROBE_ECHO looks for an echo request.
+ * @return  The probe, or NULL if none of the last probe_slots probes has the id
+ */
+static struct probe_record * fakeswitch_probe_find(struct fakeswitch *fs, uint32_t xid, uint32_t buffer_id)
+{
+    struct probe_record * probe;
+    uint32_t back;      // 1 = the last probe sent
+
+    if (buffer_id < NUM_BUFFER_IDS)
+        back = (fs->current_buffer_id + NUM_BUFFER_IDS - buffer_id) % NUM_BUFFER_IDS;
+    else
+        back = (fs->xid - xid) & (ECHO_LANE_XID - 1);   // xids wrap below ECHO_LANE_XID
+    if (back == 0 || back > fs->probe_slots || back > fs->probe_tail)
+        return NULL;
+    probe = &fs->probes[(fs->probe_tail - back) & (fs->probe_slots - 1)];
+    if (buffer_id < NUM_BUFFER_IDS ? probe->buffer_id != buffer_id :
+            probe->xid != xid || (probe->buffer_id == PROBE_ECHO) != (buffer_id == PROBE_ECHO))
+        return NULL;    // e.g. the controller made up an id, or answered an echo with a flow_mod
+    return probe;
+}
+
+/***********************************************************************
+ * Match a response to its probe and record the round trip time
+ *  Responses that answer no outstanding probe are only counted in fs->match
+ * @return  1 if the response answered an outstanding probe, else 0
+ */
+static int fakeswitch_probe_answered(struct fakeswitch *fs, uint32_t xid, uint32_t buffer_id, uint64_t now)
+{
+    struct probe_record * probe = fakeswitch_probe_find(fs, xid, buffer_id);
+
+    if (probe == NULL)
+    {
+        fs->match.unmatched++;
+        return 0;
+    }
+    if (probe->sent == 0)
+    {
+        fs->match.duplicates++;
+        return 0;
+    }
+    if (probe->sent == PROBE_TIMED_OUT)
+    {
+        fs->match.late++;
+        return 0;
+    }
+    if (probe->buffer_id != PROBE_ECHO)
+    {
+        // round trip times are those of packet_ins
+        if (fs->rtt_hist)
+            histogram_record(fs->rtt_hist, now - probe->sent);
+        if (fs->window.rise > 0)
+            fakeswitch_window_sample(fs, now - probe->sent);
+    }
+    probe->sent = 0;
+    fakeswitch_probe_advance(fs);
+    return 1;
+}
+
+/***********************************************************************
+ * AIMD: a round is a window's worth of responses, about one round trip
+ */
+static void fakeswitch_window_sample(struct fakeswitch *fs, uint64_t rtt)
+{
+    struct window_control * wc = &fs->window;
+    uint64_t mean;
+
+    wc->round_rtt += rtt;
+    if (++wc->round_samples < wc->size)
+        return;
+    mean = wc->round_rtt / wc->round_samples;
+    wc->round_rtt = 0;
+    wc->round_samples = 0;
+    if (wc->base_rtt == 0 || mean < wc->base_rtt)
+        wc->base_rtt = mean;
+    if (mean * 100 <= wc->base_rtt * (100 + wc->rise))
+    {
+        if (wc->size < wc->max)
+        {
+            wc->size++;
+            wc->increases++;
+        }
+    }
+    else if (wc->size > 1)
+    {
+        wc->size /= 2;
+        wc->decreases++;
+    }
+    else
+        wc->base_rtt = mean;    // nothing of ours queues behind a single probe: the controller got slower
+    debug_msg(fs, "round mean rtt %lu ns (base %lu): window %d", (unsigned long) mean,
+            (unsigned long) wc->base_rtt, wc->size);
+}
+
+/***********************************************************************/
+void fakeswitch_set_window(struct fakeswitch *fs, int window, int aimd_rise)
+{
+    fs->window.rise = aimd_rise;
+    if (aimd_rise > 0)
+    {
+        fs->window.size = 1;
+        fs->window.max = window > 0 && window < PROBE_TABLE_MAX ? window : PROBE_TABLE_MAX;
+    }
+    else
+        fs->window.size = fs->window.max = window;
+}
+
+/***********************************************************************/
+int fakeswitch_get_window(struct fakeswitch *fs, unsigned long * increases, unsigned long * decreases)
+{
+    *increases += fs->window.increases;
+    *decreases += fs->window.decreases;
+    fs->window.increases = fs->window.decreases = 0;
+    return fs->window.size;
+}
+
 /***********************************************************************/
 void fakeswitch_handle_io(struct fakeswitch *fs, const struct pollfd *pfd)
 {
-    if(pfd->revents & POLLIN)
+    if (fs->down)
+    {
+        fakeswitch_handle_write(fs);    // no socket to poll; maybe time to reconnect
+        return;
+    }
+    if(pfd->revents & (POLLIN | POLLHUP))
         fakeswitch_handle_read(fs);
-    if(pfd->revents & POLLOUT)
+    if(pfd->revents & (POLLOUT | POLLERR))
         fakeswitch_handle_write(fs);
 }
 /************************************************************************/
@@ -3,9 +3,28 @@
 
 #include <poll.h>
 
+#include <stdint.h>
+
+#include <sys/socket.h>
+
+#include "histogram.h"
 #include "msgbuf.h"
+#include "pcap.h"
+#include "flowtable.h"
+#include "sources.h"
+#include "workload.h"
 
 #define NUM_BUFFER_IDS 100000
+#define PROBE_TABLE_MIN 64          // slots of a switch's probe table at first; power of 2
+#define PROBE_TABLE_MAX 65536       // the table doesn't grow past this; power of 2, below NUM_BUFFER_IDS
+#define PROBE_TIMED_OUT 1           // send time of a probe given up on
+#define PROBE_ECHO 0xfffffffe       // buffer_id of a probe that is an echo request
+#define ECHO_LANE_SLOTS 256         // echo lane requests a connection keeps track of; power of 2
+#define ECHO_LANE_XID 0x80000000    // xid bit of the echo lane's requests; probes' xids stay below it
+#define NEXT_XID(xid) (((xid) + 1) & (ECHO_LANE_XID - 1))  // xid after this one, wrapping below ECHO_LANE_XID
+#define RATE_BUCKET_MS 10           // responses are counted in buckets this long to tell a switch's rate
+#define CONVERGED_MISS_PERCENT 1    // a flow table has converged once a cycle of the traffic misses no more than this share
+#define RECOVERED_PERCENT 90        // a reconnected switch has recovered once its rate is back to this share
 
 enum test_mode 
 {
@@ -19,12 +38,154 @@ enum handshake_status {
     WAITING = 101
 };
     
+/* system calls made on behalf of a switch */
+struct io_stats
+{
+    unsigned long reads;                // read() calls
+    unsigned long writes;               // sendmsg() calls
+    unsigned long reaps;                // recvmsg(MSG_ERRQUEUE) calls for zerocopy completions
+    unsigned long zc_sends;             // sendmsg() calls with MSG_ZEROCOPY
+    unsigned long zc_copied;            // zerocopy sends the kernel copied anyway
+};
+
+/* when a switch got through each step of the handshake (ns, from now_ns()); 0 = not yet */
+struct handshake_times
+{
+    uint64_t connect_start;             // connect() was called (set by whoever connects)
+    uint64_t connected;                 // first successful send: the TCP handshake is done
+    uint64_t hello;                     // controller's HELLO arrived
+    uint64_t features_request;
+    uint64_t get_config_request;
+    uint64_t ready;                     // READY_TO_SEND reached
+};
+
+/* How many probes a switch keeps in flight
+ *  Latency mode is a fixed window of 1.  With AIMD, the window grows by
+ *  one probe per round (a window's worth of responses) while the round's
+ *  mean RTT stays within rise percent of the lowest round mean seen,
+ *  and halves when it rises above that.
+ */
+struct window_control
+{
+    int size;                           // probes allowed in flight; 0 = as many as the output buffer takes
+    int max;                            // AIMD doesn't grow the window past this
+    int rise;                           // AIMD: RTT rise (in percent) that signals queueing; 0 = fixed window
+    uint64_t base_rtt;                  // lowest mean RTT of a round so far (ns)
+    uint64_t round_rtt;                 // sum of the RTTs of the current round
+    int round_samples;
+    unsigned long increases, decreases; // AIMD steps since the last fakeswitch_get_window()
+};
+
+/* responses that answer no outstanding probe, and probes that got no answer */
+struct match_stats
+{
+    unsigned long unmatched;            // no probe sent recently has the response's id
+    unsigned long duplicates;           // the probe was already answered
+    unsigned long late;                 // the probe had already timed out
+    unsigned long timed_out;            // probes given up on: outstanding at the end of a test,
+                                        //  or pushed out by PROBE_TABLE_MAX newer ones
+};
+
+/* how the switches of a controller cluster fared, see struct mastership */
+struct failover_stats
+{
+    unsigned long role_changes;         // ROLE_REQUESTs that changed a connection's role
+    unsigned long connections_lost;
+    unsigned long failovers;            // packet_in responses resumed after the active connection went down
+    uint64_t failover_sum;              // ns from losing the active connection to the first response after
+    uint64_t failover_max;
+    int with_master;                    // switches probing a MASTER controller when collected
+    int equal_only;                     // ... probing an EQUAL one, as no controller claimed mastership
+    int without_master;                 // ... with nobody to probe
+    int failing_over;                   // ... that lost their active connection and got no response since
+};
+
+/* A switch connected to every member of a controller cluster
+ *  Each connection is a fakeswitch of its own with the same DPID and
+ *  its own handshake; the controllers settle their roles with
+ *  ROLE_REQUESTs.  Probes only go out through the active connection:
+ *  the one whose controller is MASTER or, while none has claimed
+ *  mastership, the first EQUAL one.  So only the current master's
+ *  responses count.  When the active connection goes down, the
+ *  failover time runs until packet_in responses resume on whichever
+ *  connection becomes active next.
+ */
+struct mastership
+{
+    struct fakeswitch * members;        // the connections, one per controller, next to each other
+    int n_members;
+    int active;                         // member probes go through; -1 = none
+    uint64_t lost;                      // when the active connection went down; 0 = no failover under way
+    struct failover_stats stats;        // since the last fakeswitch_get_failover_stats()
+};
+
+/* Where and how a switch reconnects after losing its connection
+ *  The first attempt waits backoff_min ms; each failed one doubles
+ *  the wait, up to backoff_max.  The new connection goes through the
+ *  whole handshake again before probes resume.
+ */
+struct reconnect_policy
+{
+    struct sockaddr_storage addr;       // the controller
+    int addrlen;
+    struct sources * sources;           // local addresses and ports to connect from
+    int backoff_min;                    // ms
+    int backoff_max;
+};
+
+/* connections lost and how the switches came back, see struct reconnect_policy */
+struct reconnect_stats
+{
+    unsigned long losses;               // outages: connections lost while the switch was up
+    unsigned long attempts;             // connect() calls to get back
+    unsigned long handshakes;           // outages that ended with the handshake done again
+    unsigned long recoveries;           // ... and responses back to RECOVERED_PERCENT of the rate before
+    uint64_t outage_sum, outage_max;    // ns from losing the connection to READY_TO_SEND again
+    uint64_t recovery_sum, recovery_max;    // ns from losing the connection to the rate coming back
+    uint64_t downtime;                  // ns without a working connection
+    int down;                           // switches without a working connection when collected
+};
+
+/* how the emulated flow tables took the controller's FLOW_MODs and the generated packets */
+struct flow_stats
+{
+    int entries;                        // entries in the tables when collected
+    unsigned long installed;            // FLOW_MODs that added an entry
+    unsigned long removed;              // ... that deleted one
+    unsigned long refused;              // ... the table couldn't take: full, or matching on more than the frame
+    unsigned long forwarded;            // generated packets that hit an entry and never reached the controller
+    unsigned long missed;               // ... that missed and went out as packet_ins
+    unsigned long converged;            // switches whose miss rate fell to CONVERGED_MISS_PERCENT
+    uint64_t convergence_sum;           // ns from their first packet until then
+    uint64_t convergence_max;
+};
+
+/* the echo lane's requests and what became of them, see fakeswitch_send_echo() */
+struct echo_stats
+{
+    unsigned long sent;
+    unsigned long answered;
+    unsigned long lost;                 // never answered: the connection went down, or
+                                        //  ECHO_LANE_SLOTS newer requests went out first
+};
+
+/* a probe sent to the controller */
+struct probe_record
+{
+    uint32_t xid;
+    uint32_t buffer_id;
+    uint64_t sent;                      // send time in ns; 0 once answered, PROBE_TIMED_OUT once given up on
+};
+
 struct fakeswitch 
 {
     int id;                             // switch number
     int debug;                          // do we print debug msgs?
     int sock;
-    struct msgbuf * inbuf, * outbuf;    // input,output buffers
+    struct msgbuf * outbuf;             // queued output; NULL while there is none, see bufpool.h
+    int outbuf_max;                     // the output ring grows up to this many bytes
+    char * carry;                       // a frame split across reads, until its rest arrives
+    int carry_len, carry_cap;
     enum test_mode mode;                // are we going for latency or throughput?
     int probe_state;                    // if mode=LATENCY, this is a flag: do we have a packet outstanding?
                                         // if mode=THROUGHPUT, this is the number of outstanding probes
@@ -37,27 +198,94 @@ struct fakeswitch
     int switch_status;                  // are we ready to start sending packet_in's?
     int next_status;                    // if we are waiting, next step to go after delay expires
     int probe_size;                     // how big is the probe (for buffer tuning)
+    char * probe_template;              // pre-serialized packet_in of this switch, probe_size bytes
+    int probe_size_max;                 // largest message fakeswitch_queue_probes() may queue
     int delay;                          // delay between state changes
-    int xid;
+    uint32_t xid;                       // of the next probe; below ECHO_LANE_XID, see NEXT_XID()
     struct timeval  delay_start;        // when did the current delay start - valid if in waiting state
     int total_mac_addresses;
     int current_mac_address;
     int learn_dstmac;
     int current_buffer_id;
+    struct probe_record * probes;       // the last probe_slots probes, indexed by probe sequence number
+    unsigned int probe_slots;           // grows from PROBE_TABLE_MIN while all slots are outstanding
+    unsigned int probe_head;            // sequence number of the oldest outstanding probe
+    unsigned int probe_tail;            // sequence number of the next probe
+    struct histogram * rtt_hist;        // where round trip times get recorded; NULL to skip
+    int paced;                          // open loop: probes only come from fakeswitch_queue_probe()
+    int zerocopy_min;                   // send with MSG_ZEROCOPY from this many buffered bytes; 0 = never
+    struct io_stats io;                 // system calls since the last fakeswitch_get_io_stats()
+    struct handshake_times handshake;
+    struct window_control window;
+    struct match_stats match;           // since the last fakeswitch_get_match_stats()
+    const struct workload * workload;   // what to send in place of packet_ins; NULL = packet_ins only
+    int workload_pos;                   // next message of workload->cycle
+    char * mix_templates[WORKLOAD_TYPES];   // pre-serialized message of each type
+    int mix_sizes[WORKLOAD_TYPES];
+    struct mix_counts mix;              // since the last fakeswitch_get_mix_counts()
+    const struct pcap_trace * trace;    // where packet_in payloads come from; NULL = the template's
+    int trace_pos;                      // frame of the next packet_in
+    long mem_bytes;                     // memory the switch holds now: struct, tables, templates and buffers
+    long mem_peak;                      // most of it held at once since the last fakeswitch_get_mem_peak()
+    struct mastership * cluster;        // the switch's connections to a controller cluster; NULL = just this one
+    int member;                         // this connection's place in cluster->members
+    int role;                           // ROLE_EQUAL, ROLE_MASTER or ROLE_SLAVE, as the controller asked
+    int down;                           // the connection is gone, for good in a cluster without reconnects
+    const struct reconnect_policy * reconnect;  // NULL = losing the connection is fatal (or, in a cluster, final)
+    unsigned int sock_generation;       // bumped with every new socket, for engines that register it
+    int backoff;                        // ms before the next connect() attempt
+    uint64_t reconnect_at;              // when it may be made (ns)
+    uint64_t outage_start;              // when the connection was lost; 0 = up
+    uint64_t down_since;                // start of the downtime not yet counted in reconnect_stats
+    uint64_t recovering;                // outage_start of an outage whose rate hasn't come back; 0 = none
+    uint64_t rate_bucket_start;         // current bucket of responses, see RATE_BUCKET_MS
+    int rate_bucket_count;
+    double rate;                        // responses per ns, smoothed over the buckets while not recovering
+    struct reconnect_stats reconnects;  // since the last fakeswitch_get_reconnect_stats()
+    struct flowtable flows;             // the connection's emulated flow table; capacity 0 = none
+    struct flowtable * table;           // where packets are looked up: flows, or member 0's in a cluster
+    uint64_t flows_start;               // first packet looked up; 0 = none yet
+    uint64_t flows_cycle_start;         // first packet of the current cycle of the generated traffic
+    int flows_cycle_packets;            // lookups so far in the cycle
+    int flows_cycle_missed;
+    int flows_converged;                // a whole cycle missed no more than CONVERGED_MISS_PERCENT
+    int flows_idle;                     // a whole cycle hit and nothing was queued: no more until the controller talks
+    struct flow_stats flow_stats;       // since the last fakeswitch_get_flow_stats()
+    uint64_t * echo_sent;               // send times of the echo lane's last ECHO_LANE_SLOTS requests,
+                                        //  0 = answered; NULL until the first one
+    uint32_t echo_seq;                  // sequence number of the next one, the low bits of its xid
+    struct histogram * echo_hist;       // where the echo lane's round trip times get recorded; NULL to skip
+    struct echo_stats echo;             // since the last fakeswitch_get_echo_stats()
 };
 
+/* bytes of output the switch has queued */
+#define fakeswitch_count_buffered(fs) ((fs)->outbuf ? msgbuf_count_buffered((fs)->outbuf) : 0)
+
+/* is the switch waiting to reconnect? */
+#define fakeswitch_reconnecting(fs) ((fs)->down && (fs)->reconnect)
+
+/* may the switch send probes on this connection? only the active one of a cluster may */
+#define fakeswitch_may_probe(fs) (!(fs)->cluster || (fs)->cluster->active == (fs)->member)
+
 /*** Initialize an already allocated fakeswitch
  * Fill in all of the parameters, 
  *  exchange OFP_HELLO, block waiting on features_request
  *  and send features reply
  * @param fs        Pointer to a fakeswitch
  * @param dpid      DPID
- * @param sock      A non-blocking socket already connected to 
+ * @param sock      A non-blocking socket connected (or still connecting) to
  *                          the controller (will be non-blocking on return)
- * @param bufsize   The initial in and out buffer size
+ * @param bufsize   Largest size of the output buffer (at least 2 * BUFLEN)
  * @param mode      Should we test throughput or latency?
+ *                  (latency is throughput with a window of one probe)
  * @param total_mac_addresses      The total number of unique mac addresses
  *                                 to use for packet ins from this switch
+ * The switch holds no buffers while it is idle: output goes into a ring
+ *  from the shared pool (bufpool.h) that doubles from BUFPOOL_MIN up to
+ *  bufsize bytes while data is queued and goes back once it is sent, and
+ *  input is handled where it was read, except for a frame split across
+ *  reads.  Once the output ring is at bufsize bytes, or the pool's budget
+ *  refuses a bigger one, no more probes are queued until it drains.
  */
 void fakeswitch_init(struct fakeswitch *fs, int dpid, int sock, int bufsize, int debug, int delay, enum test_mode mode, int total_mac_addresses, int learn_dstmac, int max_send_count);
 
@@ -80,9 +308,220 @@ void fakeswitch_set_pollfd(struct fakeswitch *fs, struct pollfd *pfd);
  */
 void fakeswitch_handle_io(struct fakeswitch *fs, const struct pollfd *pfd);
 
+/*** Read everything the controller sent, until the socket would block
+ *  and handle every complete message
+ *  Safe to use with edge-triggered readiness notification
+ * @param fs    Pointer to initalized fakeswitch
+ */
+void fakeswitch_handle_read(struct fakeswitch *fs);
+
+/*** Handle bytes some other mechanism already received from the controller
+ *  For I/O engines that do the socket reads themselves
+ * @param fs    Pointer to initalized fakeswitch
+ * @param data  Received bytes
+ * @param len   Number of bytes, 0 if the controller closed the connection,
+ *              or a negated errno if the read failed
+ */
+void fakeswitch_handle_input(struct fakeswitch *fs, const char * data, int len);
+
+/*** Queue new probes if the test mode allows it and
+ *  send whatever is buffered
+ * @param fs    Pointer to initalized fakeswitch
+ */
+void fakeswitch_handle_write(struct fakeswitch *fs);
+
+/*** Like fakeswitch_handle_write(), but leave the output in fs->outbuf
+ *  For I/O engines that do the socket writes themselves
+ * @param fs    Pointer to initalized fakeswitch
+ */
+void fakeswitch_queue_output(struct fakeswitch *fs);
+
+/*** Take the queued output, for I/O engines that send it on their own
+ *  The switch queues what comes next into a new ring; the taken one
+ *  stays charged to the switch until fakeswitch_sent_output()
+ * @param fs    Pointer to initalized fakeswitch
+ * @return      The ring; NULL if nothing is queued
+ */
+struct msgbuf * fakeswitch_take_output(struct fakeswitch *fs);
+
+/*** Give back a ring taken with fakeswitch_take_output()
+ *  An empty one goes back to the pool; bytes still in it are queued
+ *  again, ahead of whatever the switch queued meanwhile
+ * @param fs    Pointer to initalized fakeswitch
+ * @param mbuf  The ring
+ */
+void fakeswitch_sent_output(struct fakeswitch *fs, struct msgbuf * mbuf);
+
+/*** Queue one probe on behalf of an open-loop arrival schedule
+ *  The probe's round trip time is measured from the scheduled time,
+ *  so time spent behind schedule counts against the controller too
+ * @param fs        Pointer to initalized fakeswitch
+ * @param scheduled When the probe should have been sent (from now_ns())
+ * @return          1 if queued, 0 if the switch is not ready or
+ *                  has reached max_send_count
+ */
+int fakeswitch_queue_probe(struct fakeswitch *fs, uint64_t scheduled);
+
+/*** Does the switch need the socket to become writable?
+ *  True if there is buffered output or if more probes could be queued now
+ * @param fs    Pointer to initalized fakeswitch
+ * @return      1 if fakeswitch_handle_write() has work to do, else 0
+ */
+int fakeswitch_want_write(struct fakeswitch *fs);
+
+/*** Note that the connection to the controller is up, for the handshake times
+ *  Sending or receiving through the fakeswitch notices this by itself;
+ *  I/O engines that send on their own call it after their first send
+ * @param fs    Pointer to initalized fakeswitch
+ */
+void fakeswitch_connected(struct fakeswitch *fs);
+
+/*** Bound the probes in flight of a throughput mode switch
+ * @param fs        Pointer to initalized fakeswitch
+ * @param window    Probes allowed in flight (the upper bound with AIMD); 0 = unbounded
+ * @param aimd_rise Adapt the window, taking an RTT rise of this many
+ *                  percent as queueing in the controller; 0 = fixed window.
+ *                  The adaptive window starts at 1.
+ */
+void fakeswitch_set_window(struct fakeswitch *fs, int window, int aimd_rise);
+
+/*** Get the current window and reset the AIMD step counters
+ * @param fs        Pointer to initalized fakeswitch
+ * @param increases Incremented by the AIMD increases since the last call
+ * @param decreases Incremented by the AIMD decreases since the last call
+ * @return          Probes allowed in flight; 0 = unbounded
+ */
+int fakeswitch_get_window(struct fakeswitch *fs, unsigned long * increases, unsigned long * decreases);
+
+/*** Send a weighted mix of messages wherever a packet_in would go
+ *  Echo requests are tracked like packet_ins, taking a place in the
+ *  window until answered; the notifications expect no answer.
+ *  send_count and recv_count still count packet_ins only.
+ * @param fs        Pointer to initalized fakeswitch
+ * @param workload  The mix; must stay around as long as the switch
+ */
+void fakeswitch_set_workload(struct fakeswitch *fs, const struct workload * workload);
+
+/*** Take packet_in payloads from captured frames
+ *  Each packet_in carries the next frame (truncated to
+ *  POF_PACKET_IN_MAX_LENGTH bytes); switches start at different frames.
+ *  An open-loop schedule may pick the frame instead, through trace_pos.
+ * @param fs        Pointer to initalized fakeswitch
+ * @param trace     The frames; must stay around as long as the switch
+ */
+void fakeswitch_set_trace(struct fakeswitch *fs, const struct pcap_trace * trace);
+
+/*** Make the switch one of the connections of a switch to a controller cluster
+ *  Members join in order, 0 first, and sit next to each other in memory.
+ *  Without a cluster, a lost connection ends the program; in one, the
+ *  connection is given up and mastership may move on.
+ * @param fs        Pointer to initalized fakeswitch
+ * @param cluster   Shared by the connections of the switch; set up when member 0 joins
+ * @param member    Index of the connection (i.e. of its controller)
+ */
+void fakeswitch_join_cluster(struct fakeswitch *fs, struct mastership * cluster, int member);
+
+/*** Reconnect instead of giving up when the connection is lost
+ *  Only the poll and epoll engines follow a switch to its new socket.
+ * @param fs        Pointer to initalized fakeswitch
+ * @param policy    Where to connect to and how long to wait; must stay
+ *                  around as long as the switch
+ */
+void fakeswitch_set_reconnect(struct fakeswitch *fs, const struct reconnect_policy * policy);
+
+/*** Add the switch's reconnect counters to stats and reset them
+ *  Downtime is counted up to now; a switch still down keeps counting.
+ * @param fs        Pointer to initialized fakeswitch
+ * @param stats     Where to add the counters
+ */
+void fakeswitch_get_reconnect_stats(struct fakeswitch *fs, struct reconnect_stats *stats);
+
+/*** Add one set of reconnect counters to another; maxima are kept */
+void reconnect_stats_add(struct reconnect_stats *sum, const struct reconnect_stats *stats);
+
+/*** Emulate a flow table
+ *  Entries come from the controller's FLOW_MODs; a generated packet
+ *  that hits one is forwarded by the emulated data plane and counted,
+ *  instead of going out as a packet_in.  In a closed loop a switch
+ *  whose whole cycle of traffic hits goes idle until the controller
+ *  sends something.  In a cluster the connections
+ *  of a switch share member 0's table, so call it before
+ *  fakeswitch_join_cluster().
+ * @param fs        Pointer to initialized fakeswitch
+ * @param capacity  Most entries; the table is allocated by the first FLOW_MOD
+ */
+void fakeswitch_set_flow_table(struct fakeswitch *fs, int capacity);
+
+/*** Add the switch's flow table counters to stats and reset them
+ *  A convergence is reported in the period it happened in.
+ * @param fs        Pointer to initialized fakeswitch
+ * @param stats     Where to add the counters
+ */
+void fakeswitch_get_flow_stats(struct fakeswitch *fs, struct flow_stats *stats);
+
+/*** Send an ECHO_REQUEST of the echo lane
+ *  The lane runs next to the probes at a rate of its own: the
+ *  controller answers echoes on its I/O path, without any application
+ *  work, so their round trip times tell control channel delay apart
+ *  from packet_in processing.  The requests take no place in the
+ *  window, their xids have ECHO_LANE_XID set, and their round trip
+ *  times go to echo_hist.
+ * @param fs        Pointer to initialized fakeswitch
+ * @param now       Send time (from now_ns())
+ * @return          1 if queued, 0 if the switch is not ready
+ */
+int fakeswitch_send_echo(struct fakeswitch *fs, uint64_t now);
+
+/*** Add the switch's echo lane counters to stats and reset them
+ *  Requests still unanswered count in the period they are given up in.
+ * @param fs        Pointer to initialized fakeswitch
+ * @param stats     Where to add the counters
+ */
+void fakeswitch_get_echo_stats(struct fakeswitch *fs, struct echo_stats *stats);
+
+/*** Add the cluster's failover counters to stats and reset them
+ *  Only member 0 speaks for the switch; other connections add nothing
+ * @param fs        Pointer to initialized fakeswitch
+ * @param stats     Where to add the counters
+ */
+void fakeswitch_get_failover_stats(struct fakeswitch *fs, struct failover_stats *stats);
+
+/*** Add the switch's per-type message counters to counts and reset them
+ * @param fs        Pointer to initialized fakeswitch
+ * @param counts    Where to add the counters
+ */
+void fakeswitch_get_mix_counts(struct fakeswitch *fs, struct mix_counts *counts);
+
+/*** Send large writes with MSG_ZEROCOPY
+ *  Prints a warning and leaves zerocopy off if the socket refuses SO_ZEROCOPY
+ * @param fs        Pointer to initalized fakeswitch
+ * @param min_bytes Use zerocopy once at least this much output is buffered
+ */
+void fakeswitch_enable_zerocopy(struct fakeswitch *fs, int min_bytes);
+
+/*** Add the switch's system call counters to stats and reset them
+ * @param fs    Pointer to initialized fakeswitch
+ * @param stats Where to add the counters
+ */
+void fakeswitch_get_io_stats(struct fakeswitch *fs, struct io_stats *stats);
+
+/*** Add the switch's response matching counters to stats and reset them
+ * @param fs    Pointer to initialized fakeswitch
+ * @param stats Where to add the counters
+ */
+void fakeswitch_get_match_stats(struct fakeswitch *fs, struct match_stats *stats);
+
+/*** Get the most memory the switch held at once since the last call
+ * @param fs    Pointer to initialized fakeswitch
+ * @return      Bytes: the switch itself, its probe table, its templates and its buffers
+ */
+long fakeswitch_get_mem_peak(struct fakeswitch *fs);
+
 /**** Get and reset recv_count
+ *  Also gives up on the outstanding probes, like probe_state:
+ *  they count as timed out, and their responses as late
  * @param fs    Pointer to initialized fakeswitch
- * @return      Number of flow_mod responses since last call
+ * @return      Number of responses that matched a probe since last call
  */
 int fakeswitch_get_recv_count(struct fakeswitch *fs);
 
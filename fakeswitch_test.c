@@ -0,0 +1,125 @@
+/* Checks of fakeswitch behaviour the engines rely on but a controller
+ *  run can't pin down.  fakeswitch.c is compiled in here, as in
+ *  microbench.c, so a switch can be driven without any engine; this is
+ *  the pof-cbench-fakeswitch-test target, run by ctest.
+ */
+#include "fakeswitch.c"
+
+#include <stddef.h>
+
+#include "histogram.h"
+
+#define TEST_MACS       64      // source MACs the switch generates traffic from
+#define TEST_LOOPS      1000    // event loop iterations a switch with nothing to send must sit out
+
+static int failures;
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+/**********************************************************************
+ * Fill in a FLOW_MOD for the source MAC of the switch's mac'th packet_in,
+ *  as a learning switch application installs it
+ */
+static void test_make_flow_mod(struct fakeswitch * fs, pof_flow_entry * fm, int command, int mac)
+{
+    const uint8_t * frame = (const uint8_t *) ((pof_packet_in *) fs->probe_template)->data;
+
+    memset(fm, 0, sizeof(*fm));
+    fm->header.version = POF_VERSION;
+    fm->header.type = POFT_FLOW_MOD;
+    fm->header.length = htons(sizeof(*fm));
+    fm->command = command;
+    fm->match_field_num = 1;
+    fm->match[0].offset = htons(48);
+    fm->match[0].len = htons(48);
+    memcpy(fm->match[0].value, &frame[6], 6);
+    memcpy(&fm->match[0].value[1], &mac, sizeof(mac));  // ether_shost[1..4], see fakeswitch_stamp_packet_in()
+    memset(fm->match[0].mask, 0xff, 6);
+}
+
+/**********************************************************************
+ * A closed-loop switch whose every packet hits an installed flow has
+ *  nothing for the socket to pace: it must stop asking for POLLOUT
+ *  instead of looking up packets as fast as the CPU goes, and pick up
+ *  again once the controller changes the table
+ */
+static void test_flow_table_idle(void)
+{
+    static struct fakeswitch fs;
+    static pof_flow_entry fm;
+    struct histogram hist;
+    unsigned long forwarded;
+    int socks[2];
+    int mac, i, writes;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, socks) < 0)
+    {
+        perror("fakeswitch_test: socketpair");
+        exit(1);
+    }
+    fakeswitch_init(&fs, 1, socks[0], 256 * 1024, 0, 0, MODE_THROUGHPUT, TEST_MACS, 0, MAX_SEND_COUNT);
+    fakeswitch_set_flow_table(&fs, 4 * TEST_MACS);
+    fakeswitch_change_status_now(&fs, READY_TO_SEND);
+    msgbuf_clear(fs.outbuf);            // the HELLO
+    histogram_reset(&hist);
+    fs.rtt_hist = &hist;
+
+    for (mac = 0; mac < TEST_MACS; mac++)
+    {
+        test_make_flow_mod(&fs, &fm, POFFC_ADD, mac);
+        fakeswitch_flow_mod(&fs, &fm, sizeof(fm));
+    }
+    CHECK(fs.flow_stats.installed == TEST_MACS);
+
+    // the first batch goes to the data plane entirely
+    CHECK(fakeswitch_want_write(&fs));
+    fakeswitch_handle_write(&fs);
+    CHECK(fs.flow_stats.forwarded > 0);
+    CHECK(fs.flow_stats.missed == 0);
+    CHECK(fakeswitch_count_buffered(&fs) == 0);
+    CHECK(fs.send_count == 0);
+
+    // ... after which the event loop has nothing to do for the switch
+    forwarded = fs.flow_stats.forwarded;
+    writes = 0;
+    for (i = 0; i < TEST_LOOPS; i++)
+        if (fakeswitch_want_write(&fs))
+        {
+            fakeswitch_handle_write(&fs);
+            writes++;
+        }
+    CHECK(writes == 0);
+    CHECK(fs.flow_stats.forwarded == forwarded);
+
+    // the controller removes the next packet's flow: it goes out as a packet_in again
+    test_make_flow_mod(&fs, &fm, POFFC_DELETE, fs.current_mac_address);
+    fakeswitch_handle_input(&fs, (char *) &fm, sizeof(fm));
+    CHECK(fs.flow_stats.removed == 1);
+    CHECK(fakeswitch_want_write(&fs));
+    fakeswitch_queue_output(&fs);
+    CHECK(fs.flow_stats.missed > 0);
+    CHECK(fakeswitch_count_buffered(&fs) > 0);
+    CHECK(fs.send_count == fs.flow_stats.missed);
+
+    close(socks[0]);
+    close(socks[1]);
+}
+
+/**********************************************************************/
+int main(int argc, char * argv[])
+{
+    test_flow_table_idle();
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pof.h"
+#include "flowtable.h"
+
+OFP_ASSERT(FLOWTABLE_FIELDS == POF_MAX_MATCH_FIELD_NUM);
+OFP_ASSERT(FLOWTABLE_FIELD_BYTES == POF_MAX_FIELD_LENGTH_IN_BYTE);
+
+#define FLOWTABLE_EMPTY     0x00
+#define FLOWTABLE_DELETED   0x01
+#define FLOWTABLE_TAG(hash) ((uint8_t) (0x80 | ((hash) >> 57)))     // full slots have the top bit set
+
+/* the match field values of an entry or a frame, each field at its own 16 bytes */
+#define FLOWTABLE_KEY_WORDS (FLOWTABLE_FIELDS * FLOWTABLE_FIELD_BYTES / 8)
+
+static int flowtable_layout(struct flowtable * table, const struct pof_match_x * match, int n_match, int add);
+static int flowtable_field(const uint8_t * src, int src_len, int offset, int len, uint8_t * out);
+static int flowtable_entry_hash(struct flowtable * table, const struct pof_match_x * match, int n_match,
+        int add, uint64_t * hash);
+static uint64_t flowtable_hash(int layout, const uint64_t * key);
+static int flowtable_find(const struct flowtable * table, uint64_t hash);
+static int flowtable_place(struct flowtable * table, uint64_t hash);
+static void flowtable_alloc(struct flowtable * table);
+static void flowtable_rehash(struct flowtable * table);
+
+/***********************************************************************
+ * Bit mask of the slots of a group whose tag is tag
+ */
+static inline unsigned flowtable_match_tags(const uint8_t * tags, uint8_t tag)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *) tags);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+#else
+    unsigned bits = 0;
+    int i;
+    for (i = 0; i < FLOWTABLE_GROUP; i++)
+        if (tags[i] == tag)
+            bits |= 1u << i;
+    return bits;
+#endif
+}
+
+/***********************************************************************/
+void flowtable_init(struct flowtable * table, int capacity)
+{
+    memset(table, 0, sizeof(*table));
+    table->capacity = capacity;
+}
+
+/***********************************************************************/
+void flowtable_free(struct flowtable * table)
+{
+    free(table->tags);
+    free(table->hashes);
+    flowtable_init(table, table->capacity);
+}
+
+/***********************************************************************/
+int flowtable_insert(struct flowtable * table, const struct pof_match_x * match, int n_match)
+{
+    uint64_t hash;
+
+    if (table->capacity == 0 || flowtable_entry_hash(table, match, n_match, 1, &hash) < 0)
+        return -1;
+    if (table->n_groups == 0)
+        flowtable_alloc(table);
+    if (flowtable_find(table, hash) >= 0)
+        return 0;
+    if (table->n_entries >= table->capacity)
+        return -1;
+    if ((table->n_entries + table->n_deleted + 1) * 8L > table->n_groups * FLOWTABLE_GROUP * 7L)
+        flowtable_rehash(table);    // too many removed entries in the way
+    return flowtable_place(table, hash);
+}
+
+/***********************************************************************/
+int flowtable_remove(struct flowtable * table, const struct pof_match_x * match, int n_match)
+{
+    uint64_t hash;
+    int slot;
+
+    if (table->n_entries == 0 || flowtable_entry_hash(table, match, n_match, 0, &hash) < 0)
+        return 0;
+    slot = flowtable_find(table, hash);
+    if (slot < 0)
+        return 0;
+    table->tags[slot] = FLOWTABLE_DELETED;
+    table->n_entries--;
+    table->n_deleted++;
+    return 1;
+}
+
+/***********************************************************************/
+int flowtable_lookup(const struct flowtable * table, const uint8_t * frame, int len)
+{
+    const struct flowtable_layout * layout;
+    uint64_t key[FLOWTABLE_KEY_WORDS];
+    uint8_t * field;
+    int i, f, b;
+
+    if (table->n_entries == 0)
+        return 0;
+    for (i = 0; i < table->n_layouts; i++)
+    {
+        layout = &table->layouts[i];
+        memset(key, 0, sizeof(key));
+        for (f = 0; f < layout->n_fields; f++)
+        {
+            field = (uint8_t *) key + f * FLOWTABLE_FIELD_BYTES;
+            if (flowtable_field(frame, len, layout->offset[f], layout->len[f], field) < 0)
+                break;      // the frame is too short for this layout
+            for (b = 0; b < (layout->len[f] + 7) / 8; b++)
+                field[b] &= layout->mask[f][b];
+        }
+        if (f == layout->n_fields && flowtable_find(table, flowtable_hash(i, key)) >= 0)
+            return 1;
+    }
+    return 0;
+}
+
+/***********************************************************************/
+long flowtable_bytes(const struct flowtable * table)
+{
+    return (long) table->n_groups * FLOWTABLE_GROUP * (sizeof(uint8_t) + sizeof(uint64_t));
+}
+
+/***********************************************************************
+ * Find the layout of an entry's match fields, adding it if add is set
+ * @return  Its index, or -1 if a field isn't in the frame, there is no
+ *          such layout (add not set) or there is no room for another
+ */
+static int flowtable_layout(struct flowtable * table, const struct pof_match_x * match, int n_match, int add)
+{
+    struct flowtable_layout layout;
+    int i, f;
+
+    if (n_match < 1 || n_match > FLOWTABLE_FIELDS)
+        return -1;      // without match fields an entry would swallow every packet_in
+    memset(&layout, 0, sizeof(layout));
+    layout.n_fields = n_match;
+    for (f = 0; f < n_match; f++)
+    {
+        // 0xffff is metadata, 0x8XXX a table parameter: neither is in a frame
+        if (ntohs(match[f].field_id) >= 0x8000)
+            return -1;
+        layout.offset[f] = ntohs(match[f].offset);
+        layout.len[f] = ntohs(match[f].len);
+        if (layout.len[f] < 1 || layout.len[f] > FLOWTABLE_FIELD_BYTES * 8)
+            return -1;
+        flowtable_field(match[f].mask, sizeof(match[f].mask), 0, layout.len[f], layout.mask[f]);
+    }
+    for (i = 0; i < table->n_layouts; i++)
+        if (!memcmp(&table->layouts[i], &layout, sizeof(layout)))
+            return i;
+    if (!add || table->n_layouts == FLOWTABLE_MAX_LAYOUTS)
+        return -1;
+    table->layouts[table->n_layouts] = layout;
+    return table->n_layouts++;
+}
+
+/***********************************************************************
+ * Copy len bits from offset bits into src to out, left aligned; the
+ *  bits past len in the last byte are cleared
+ * @return  0, or -1 if src ends before the bits do
+ */
+static int flowtable_field(const uint8_t * src, int src_len, int offset, int len, uint8_t * out)
+{
+    int shift = offset & 7;
+    int bytes = (len + 7) / 8;
+    int i;
+
+    src += offset / 8;
+    src_len -= offset / 8;
+    if (src_len * 8 < shift + len)
+        return -1;
+    for (i = 0; i < bytes; i++)
+        out[i] = (uint8_t) (src[i] << shift) | (shift && i + 1 < src_len ? src[i + 1] >> (8 - shift) : 0);
+    if (len & 7)
+        out[bytes - 1] &= (uint8_t) (0xff << (8 - (len & 7)));
+    return 0;
+}
+
+/***********************************************************************
+ * Hash of an entry's masked match field values
+ * @return  0, or -1 if its layout is unusable (see flowtable_layout())
+ */
+static int flowtable_entry_hash(struct flowtable * table, const struct pof_match_x * match, int n_match,
+        int add, uint64_t * hash)
+{
+    uint64_t key[FLOWTABLE_KEY_WORDS];
+    const struct flowtable_layout * layout;
+    uint8_t * field;
+    int i, f, b;
+
+    i = flowtable_layout(table, match, n_match, add);
+    if (i < 0)
+        return -1;
+    layout = &table->layouts[i];
+    memset(key, 0, sizeof(key));
+    for (f = 0; f < layout->n_fields; f++)
+    {
+        field = (uint8_t *) key + f * FLOWTABLE_FIELD_BYTES;
+        flowtable_field(match[f].value, sizeof(match[f].value), 0, layout->len[f], field);
+        for (b = 0; b < (layout->len[f] + 7) / 8; b++)
+            field[b] &= layout->mask[f][b];
+    }
+    *hash = flowtable_hash(i, key);
+    return 0;
+}
+
+/***********************************************************************/
+static uint64_t flowtable_hash(int layout, const uint64_t * key)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull * (layout + 1);
+    int i;
+
+    for (i = 0; i < FLOWTABLE_KEY_WORDS; i++)
+    {
+        h ^= key[i];
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 31;
+    }
+    // splitmix64's finish, so the tag (top bits) and the group (low bits) both depend on every key bit
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+/***********************************************************************
+ * @return  Slot of the entry with this hash, or -1
+ */
+static int flowtable_find(const struct flowtable * table, uint64_t hash)
+{
+    uint8_t tag = FLOWTABLE_TAG(hash);
+    unsigned mask = table->n_groups - 1;
+    unsigned g = hash & mask;
+    unsigned bits;
+    int probes, slot;
+
+    for (probes = 0; probes < table->n_groups; probes++, g = (g + 1) & mask)
+    {
+        const uint8_t * tags = &table->tags[g * FLOWTABLE_GROUP];
+        for (bits = flowtable_match_tags(tags, tag); bits; bits &= bits - 1)
+        {
+            slot = g * FLOWTABLE_GROUP + __builtin_ctz(bits);
+            if (table->hashes[slot] == hash)
+                return slot;
+        }
+        if (flowtable_match_tags(tags, FLOWTABLE_EMPTY))
+            return -1;      // an insert would have stopped here
+    }
+    return -1;
+}
+
+/***********************************************************************
+ * Put a hash that is not in the table yet into the first free slot
+ *  along its probe sequence
+ * @return  1
+ */
+static int flowtable_place(struct flowtable * table, uint64_t hash)
+{
+    unsigned mask = table->n_groups - 1;
+    unsigned g = hash & mask;
+    unsigned bits;
+    int slot;
+
+    for (;; g = (g + 1) & mask)
+    {
+        const uint8_t * tags = &table->tags[g * FLOWTABLE_GROUP];
+        bits = flowtable_match_tags(tags, FLOWTABLE_EMPTY) | flowtable_match_tags(tags, FLOWTABLE_DELETED);
+        if (bits == 0)
+            continue;   // the fill limit leaves a free slot somewhere
+        slot = g * FLOWTABLE_GROUP + __builtin_ctz(bits);
+        if (table->tags[slot] == FLOWTABLE_DELETED)
+            table->n_deleted--;
+        table->tags[slot] = FLOWTABLE_TAG(hash);
+        table->hashes[slot] = hash;
+        table->n_entries++;
+        return 1;
+    }
+}
+
+/***********************************************************************
+ * Slots for capacity entries at 7/8 fill, in a power of two of groups
+ */
+static void flowtable_alloc(struct flowtable * table)
+{
+    long slots = table->capacity * 8L / 7 + 1;
+
+    table->n_groups = 1;
+    while ((long) table->n_groups * FLOWTABLE_GROUP < slots)
+        table->n_groups *= 2;
+    table->tags = aligned_alloc(FLOWTABLE_GROUP, table->n_groups * FLOWTABLE_GROUP);
+    table->hashes = malloc(table->n_groups * FLOWTABLE_GROUP * sizeof(uint64_t));
+    assert(table->tags && table->hashes);
+    memset(table->tags, FLOWTABLE_EMPTY, table->n_groups * FLOWTABLE_GROUP);
+}
+
+/***********************************************************************
+ * Put the entries back without the slots of removed ones in between
+ */
+static void flowtable_rehash(struct flowtable * table)
+{
+    uint8_t * tags = table->tags;
+    uint64_t * hashes = table->hashes;
+    int i;
+
+    flowtable_alloc(table);
+    table->n_entries = table->n_deleted = 0;
+    for (i = 0; i < table->n_groups * FLOWTABLE_GROUP; i++)
+        if (tags[i] & 0x80)
+            flowtable_place(table, hashes[i]);
+    free(tags);
+    free(hashes);
+}
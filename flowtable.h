@@ -0,0 +1,77 @@
+#ifndef FLOWTABLE_H
+#define FLOWTABLE_H
+
+#include <stdint.h>
+
+struct pof_match_x;
+
+#define FLOWTABLE_FIELDS        2       // match fields an entry has at most, POF_MAX_MATCH_FIELD_NUM
+#define FLOWTABLE_FIELD_BYTES   16      // longest match field, POF_MAX_FIELD_LENGTH_IN_BYTE
+#define FLOWTABLE_GROUP         16      // slots whose tags are compared at once, one SSE2 register
+#define FLOWTABLE_MAX_LAYOUTS   4       // distinct sets of match fields (and masks) a table tells apart
+#define FLOWTABLE_MAX_ENTRIES   (1 << 24)
+
+/* which bits of a frame one kind of entry matches on */
+struct flowtable_layout
+{
+    int n_fields;
+    uint16_t offset[FLOWTABLE_FIELDS];  // in bits from the start of the frame
+    uint16_t len[FLOWTABLE_FIELDS];     // in bits
+    uint8_t mask[FLOWTABLE_FIELDS][FLOWTABLE_FIELD_BYTES];
+};
+
+/* Exact-match flow table of an emulated switch
+ *  An entry is the 64-bit hash of its masked match field values (and
+ *  its layout); with tens of thousands of entries a false hit is
+ *  about as likely as a bit flip, and 9 bytes a slot keep the table
+ *  small enough to stay in cache.  Slots are probed a group at a time
+ *  by their tag, the hash's top 7 bits: one SSE2 compare finds the
+ *  candidates among FLOWTABLE_GROUP slots, and an empty slot in the
+ *  group ends the search.  Groups are filled to 7/8 at most.
+ *  Entries whose match fields differ in place or mask go to separate
+ *  layouts; a lookup tries each.  Priorities and instructions are
+ *  not looked at: any entry a frame matches forwards it.
+ */
+struct flowtable
+{
+    int capacity;                       // most entries; 0 = no table
+    int n_entries;
+    int n_deleted;                      // slots of removed entries, reused by inserts
+    int n_groups;                       // a power of two; 0 until the first insert
+    uint8_t * tags;                     // n_groups * FLOWTABLE_GROUP, see FLOWTABLE_EMPTY
+    uint64_t * hashes;
+    int n_layouts;
+    struct flowtable_layout layouts[FLOWTABLE_MAX_LAYOUTS];
+};
+
+/*** Set up an empty table; the slots are only allocated by the first insert
+ * @param capacity  Most entries the table takes; 0 = no table
+ */
+void flowtable_init(struct flowtable * table, int capacity);
+
+/*** Free the slots and forget all entries */
+void flowtable_free(struct flowtable * table);
+
+/*** Add the entry of a FLOW_MOD
+ * @param match     The entry's match fields, in network byte order
+ * @param n_match   How many of them are used
+ * @return          1 if added, 0 if already there, -1 if refused: the table is
+ *                  full, or a field is not in the frame (e.g. metadata)
+ */
+int flowtable_insert(struct flowtable * table, const struct pof_match_x * match, int n_match);
+
+/*** Remove the entry of a FLOW_MOD
+ * @return          1 if removed, 0 if there was none
+ */
+int flowtable_remove(struct flowtable * table, const struct pof_match_x * match, int n_match);
+
+/*** Does any entry match the frame?
+ * @param frame     Ethernet frame, as sent in a packet_in
+ * @return          1 on a hit, 0 on a miss
+ */
+int flowtable_lookup(const struct flowtable * table, const uint8_t * frame, int len);
+
+/*** @return  Bytes the table's slots take */
+long flowtable_bytes(const struct flowtable * table);
+
+#endif
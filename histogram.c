@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "histogram.h"
+
+static int histogram_index(uint64_t value);
+static uint64_t histogram_bucket_value(int index);
+
+/**********************************************************************/
+void histogram_reset(struct histogram * h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/**********************************************************************/
+static int histogram_index(uint64_t value)
+{
+    int msb;
+    int shift;
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return (int) value;
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS +
+        (int) ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**********************************************************************
+ * middle of the range of values that land in bucket index
+ */
+static uint64_t histogram_bucket_value(int index)
+{
+    int shift;
+    uint64_t low;
+    if (index < HISTOGRAM_SUB_BUCKETS)
+        return index;
+    shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    low = ((uint64_t) (HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS)) << shift;
+    return low + (((uint64_t) 1 << shift) >> 1);
+}
+
+/**********************************************************************/
+void histogram_record(struct histogram * h, uint64_t value)
+{
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->count++;
+    h->buckets[histogram_index(value)]++;
+}
+
+/**********************************************************************/
+void histogram_merge(struct histogram * dst, const struct histogram * src)
+{
+    int i;
+    if (src->count == 0)
+        return;
+    if (dst->count == 0 || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+/**********************************************************************/
+uint64_t histogram_quantile(const struct histogram * h, double quantile)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint64_t value;
+    int i;
+    if (h->count == 0)
+        return 0;
+    rank = (uint64_t) (quantile * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+            break;
+    }
+    value = histogram_bucket_value(i);
+    // the bucket midpoint may lie outside of what was really seen
+    if (value < h->min)
+        value = h->min;
+    if (value > h->max)
+        value = h->max;
+    return value;
+}
+
+/**********************************************************************/
+void histogram_print_latency(FILE * out, const struct histogram * h)
+{
+    fprintf(out, "min/p50/p90/p99/p99.9/max = %.1lf/%.1lf/%.1lf/%.1lf/%.1lf/%.1lf us (%llu samples)",
+            h->min / 1000.0,
+            histogram_quantile(h, 0.50) / 1000.0,
+            histogram_quantile(h, 0.90) / 1000.0,
+            histogram_quantile(h, 0.99) / 1000.0,
+            histogram_quantile(h, 0.999) / 1000.0,
+            h->max / 1000.0,
+            (unsigned long long) h->count);
+}
@@ -0,0 +1,44 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Log-bucketed histogram with fixed memory:
+ *  every power of two is split into HISTOGRAM_SUB_BUCKETS linear buckets,
+ *  which keeps the relative error of any reported value below ~6%
+ *  over the whole uint64_t range.
+ */
+#define HISTOGRAM_SUB_BITS      4
+#define HISTOGRAM_SUB_BUCKETS   (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS       ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram
+{
+    uint64_t count;                     // number of recorded values
+    uint64_t min, max;                  // exact extremes
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/*** Forget all recorded values */
+void histogram_reset(struct histogram * h);
+
+/*** Record one value (e.g., a round trip time in ns) */
+void histogram_record(struct histogram * h, uint64_t value);
+
+/*** Add all values recorded in src to dst */
+void histogram_merge(struct histogram * dst, const struct histogram * src);
+
+/*** Value below which the given fraction of the recorded values lies
+ * @param h         Histogram
+ * @param quantile  Between 0.0 and 1.0, e.g., 0.999 for p99.9
+ * @return          The value, or 0 if nothing was recorded
+ */
+uint64_t histogram_quantile(const struct histogram * h, double quantile);
+
+/*** Print "min/p50/p90/p99/p99.9/max = ... us (n samples)"
+ *  The recorded values are taken to be in ns
+ */
+void histogram_print_latency(FILE * out, const struct histogram * h);
+
+#endif
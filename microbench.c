@@ -0,0 +1,374 @@
+/* Microbenchmarks of pof-cbench's own message hot path, for measuring
+ *  generator-side changes before trusting them in controller runs.
+ *  fakeswitch.c is compiled in here so its static helpers can be timed
+ *  directly; this is the separate pof-cbench-microbench target.
+ */
+#include "fakeswitch.c"
+
+#include <getopt.h>
+#include <stddef.h>
+
+#include "histogram.h"
+#include "myargs.h"
+
+#define PROG_TITLE      "USAGE: pof-cbench-microbench [option]"
+#define BENCH_BATCH     256     // messages per batch; stays below PROBE_TABLE_MAX
+#define BENCH_FRAME     64      // bytes of packet data in a packet_out
+#define BENCH_FLOWS     65536   // flow table entries, one per source MAC; as many MACs miss
+#define MIN(x,y)  (((x) < (y))? (x) : (y))
+
+struct myargs my_options[] = {
+    {"messages",    'n', "messages per repetition", MYARGS_INTEGER, {.integer = 1000000}},
+    {"repetitions", 'r', "timed repetitions of each benchmark, after one warmup", MYARGS_INTEGER, {.integer = 7}},
+    {"filter",      'f', "only run the benchmarks whose name contains this", MYARGS_STRING, {.string = ""}},
+    {"help",        'h', "print this message", MYARGS_NONE, {.none = 0}},
+    {0, 0, 0, 0}
+};
+
+/* wall clock and thread CPU time spent in the timed parts of a benchmark */
+struct bench_timer
+{
+    uint64_t wall, cpu;
+    uint64_t wall_start, cpu_start;
+};
+
+struct bench
+{
+    const char * name;
+    const char * what;
+    void (*run)(struct bench_timer * t, int n);
+};
+
+static struct fakeswitch bench_fs;          // READY_TO_SEND switch on one end of a socketpair
+static int bench_peer;                      // the controller's end of the socketpair
+static struct histogram bench_hist;
+static volatile int bench_sink;             // keeps results the compiler could otherwise drop
+
+/**********************************************************************/
+static inline uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void bench_start(struct bench_timer * t)
+{
+    t->wall_start = now_ns();
+    t->cpu_start = cpu_ns();
+}
+
+static inline void bench_stop(struct bench_timer * t)
+{
+    t->cpu += cpu_ns() - t->cpu_start;
+    t->wall += now_ns() - t->wall_start;
+}
+
+/**********************************************************************
+ * count packet_outs answering the next count probes of bench_fs, as a
+ *  controller would send them
+ * @return  Bytes written to buf
+ */
+static int bench_make_packet_outs(char * buf, int count)
+{
+    int size = offsetof(pof_packet_out, data) + BENCH_FRAME;
+    uint32_t buffer_id = bench_fs.current_buffer_id;
+    pof_packet_out * po;
+    int i;
+
+    for (i = 0; i < count; i++, buffer_id = (buffer_id + 1) % NUM_BUFFER_IDS)
+    {
+        po = (pof_packet_out *) (buf + i * size);
+        memset(po, 0, size);
+        po->header.version = POF_VERSION;
+        po->header.type = POFT_PACKET_OUT;
+        po->header.length = htons(size);
+        po->header.xid = htonl((bench_fs.xid + i) & (ECHO_LANE_XID - 1));
+        po->bufferId = htonl(buffer_id);
+        po->packetLen = htonl(BENCH_FRAME);
+    }
+    return count * size;
+}
+
+/**********************************************************************/
+static void bench_make_packet_in(struct bench_timer * t, int n)
+{
+    char buf[BUFLEN];
+    int i;
+
+    bench_start(t);
+    for (i = 0; i < n; i++)
+    {
+        make_packet_in(1, i, i, buf, sizeof(buf), i);
+        bench_sink += buf[i & 63];
+    }
+    bench_stop(t);
+}
+
+/**********************************************************************/
+static void bench_stamp_packet_in(struct bench_timer * t, int n)
+{
+    char buf[BUFLEN];
+    int i;
+
+    bench_start(t);
+    for (i = 0; i < n; i++)
+    {
+        fakeswitch_stamp_packet_in(&bench_fs, buf);
+        bench_fs.xid = NEXT_XID(bench_fs.xid);
+        bench_sink += buf[i & 63];
+    }
+    bench_stop(t);
+}
+
+/**********************************************************************/
+static void bench_queue_probes(struct bench_timer * t, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i += BENCH_BATCH)
+    {
+        bench_start(t);
+        fakeswitch_queue_probes(&bench_fs, MIN(BENCH_BATCH, n - i), now_ns());
+        bench_stop(t);
+        msgbuf_clear(bench_fs.outbuf);
+        fakeswitch_get_recv_count(&bench_fs);   // forget the probes
+    }
+}
+
+/**********************************************************************/
+static void bench_msgbuf_push_pull(struct bench_timer * t, int n)
+{
+    struct msgbuf * mbuf = msgbuf_new(256 * 1024);
+    char msg[256];
+    int i, j, batch;
+
+    memset(msg, 0x5a, sizeof(msg));
+    bench_start(t);
+    for (i = 0; i < n; i += batch)
+    {
+        batch = MIN(BENCH_BATCH, n - i);
+        for (j = 0; j < batch; j++)
+            msgbuf_push(mbuf, msg, bench_fs.probe_size);
+        for (j = 0; j < batch; j++)
+            msgbuf_pull(mbuf, msg, bench_fs.probe_size);
+    }
+    bench_stop(t);
+    msgbuf_free(mbuf);
+}
+
+/**********************************************************************/
+static void bench_bufpool_get_put(struct bench_timer * t, int n)
+{
+    struct msgbuf * mbuf;
+    int i;
+
+    bench_start(t);
+    for (i = 0; i < n; i++)
+    {
+        mbuf = bufpool_get(BUFLEN);
+        bench_sink += mbuf->len;
+        bufpool_put(mbuf);
+    }
+    bench_stop(t);
+}
+
+/**********************************************************************/
+static void bench_parse_frames(struct bench_timer * t, int n)
+{
+    char * buf = malloc(BENCH_BATCH * (offsetof(pof_packet_out, data) + BENCH_FRAME));
+    int i, len, batch;
+
+    assert(buf);
+    for (i = 0; i < n; i += batch)
+    {
+        batch = MIN(BENCH_BATCH, n - i);
+        len = bench_make_packet_outs(buf, batch);
+        fakeswitch_queue_probes(&bench_fs, batch, now_ns());
+        msgbuf_clear(bench_fs.outbuf);
+        bench_start(t);
+        fakeswitch_handle_input(&bench_fs, buf, len);
+        bench_stop(t);
+    }
+    fakeswitch_get_recv_count(&bench_fs);
+    free(buf);
+}
+
+/**********************************************************************/
+static void bench_handle_read(struct bench_timer * t, int n)
+{
+    char * buf = malloc(BENCH_BATCH * (offsetof(pof_packet_out, data) + BENCH_FRAME));
+    int i, len, batch;
+
+    assert(buf);
+    for (i = 0; i < n; i += batch)
+    {
+        batch = MIN(BENCH_BATCH, n - i);
+        len = bench_make_packet_outs(buf, batch);
+        fakeswitch_queue_probes(&bench_fs, batch, now_ns());
+        msgbuf_clear(bench_fs.outbuf);
+        if (write(bench_peer, buf, len) != len)
+        {
+            perror("microbench: write");
+            exit(1);
+        }
+        bench_start(t);
+        fakeswitch_handle_read(&bench_fs);
+        bench_stop(t);
+    }
+    fakeswitch_get_recv_count(&bench_fs);
+    free(buf);
+}
+
+/**********************************************************************/
+static void bench_packet_out_is_lldp(struct bench_timer * t, int n)
+{
+    char buf[offsetof(pof_packet_out, data) + BENCH_FRAME];
+    int i;
+
+    bench_make_packet_outs(buf, 1);
+    bench_start(t);
+    for (i = 0; i < n; i++)
+    {
+        buf[offsetof(pof_packet_out, data) + 12] = i;   // vary the ethertype
+        bench_sink += packet_out_is_lldp((pof_packet_out *) buf);
+    }
+    bench_stop(t);
+}
+
+/**********************************************************************/
+static void bench_flowtable_lookup(struct bench_timer * t, int n)
+{
+    static struct flowtable table;
+    char buf[BUFLEN];
+    int size = make_packet_in(1, 0, 0, buf, sizeof(buf), 0) - offsetof(pof_packet_in, data);
+    uint8_t * frame = (uint8_t *) ((pof_packet_in *) buf)->data;
+    pof_match_x match;
+    int i, mac;
+
+    if (table.capacity == 0)
+    {
+        // entries on the source MAC, as a learning switch application installs them
+        flowtable_init(&table, BENCH_FLOWS);
+        memset(&match, 0, sizeof(match));
+        match.offset = htons(48);
+        match.len = htons(48);
+        memset(match.mask, 0xff, 6);
+        for (mac = 0; mac < BENCH_FLOWS; mac++)
+        {
+            memcpy(&frame[7], &mac, sizeof(mac));   // ether_shost[1..4], see make_packet_in()
+            memcpy(match.value, &frame[6], 6);
+            flowtable_insert(&table, &match, 1);
+        }
+    }
+    bench_start(t);
+    for (i = 0; i < n; i++)
+    {
+        mac = i % (2 * BENCH_FLOWS);
+        memcpy(&frame[7], &mac, sizeof(mac));
+        bench_sink += flowtable_lookup(&table, frame, size);
+    }
+    bench_stop(t);
+}
+
+static struct bench benches[] = {
+    {"make_packet_in",      "build a packet_in from scratch", bench_make_packet_in},
+    {"stamp_packet_in",     "copy the probe template and patch it", bench_stamp_packet_in},
+    {"queue_probes",        "stamp probes into the output ring and track them", bench_queue_probes},
+    {"msgbuf_push_pull",    "push and pull probe-sized messages through a ring", bench_msgbuf_push_pull},
+    {"bufpool_get_put",     "take an output ring from the pool and give it back", bench_bufpool_get_put},
+    {"parse_frames",        "frame and match packet_outs handed in by an engine", bench_parse_frames},
+    {"handle_read",         "read packet_outs from a socketpair, frame and match them", bench_handle_read},
+    {"packet_out_is_lldp",  "classify a packet_out", bench_packet_out_is_lldp},
+    {"flowtable_lookup",    "look up packet_in frames in a full flow table, half of them hits", bench_flowtable_lookup},
+};
+
+/**********************************************************************/
+static int bench_compare(const void * a, const void * b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**********************************************************************
+ * One warmup, then repetitions timed runs; the median is reported so a
+ *  single preempted run doesn't skew the result
+ */
+static void bench_run(struct bench * b, int n, int repetitions)
+{
+    struct bench_timer t;
+    double * wall = malloc(repetitions * sizeof(double));
+    double * cpu = malloc(repetitions * sizeof(double));
+    int i;
+
+    assert(wall && cpu);
+    memset(&t, 0, sizeof(t));
+    b->run(&t, n);
+    for (i = 0; i < repetitions; i++)
+    {
+        memset(&t, 0, sizeof(t));
+        b->run(&t, n);
+        wall[i] = (double) t.wall / n;
+        cpu[i] = (double) t.cpu / n;
+    }
+    qsort(wall, repetitions, sizeof(double), bench_compare);
+    qsort(cpu, repetitions, sizeof(double), bench_compare);
+    printf("%-20s %9.1lf %9.1lf %9.1lf %14.0lf   %s\n", b->name,
+            wall[repetitions / 2], wall[0], wall[repetitions - 1],
+            cpu[repetitions / 2] > 0 ? 1e9 / cpu[repetitions / 2] : 0.0, b->what);
+    free(wall);
+    free(cpu);
+}
+
+/**********************************************************************/
+int main(int argc, char * argv[])
+{
+    int n = myargs_get_default_integer(my_options, "messages");
+    int repetitions = myargs_get_default_integer(my_options, "repetitions");
+    char * filter = myargs_get_default_string(my_options, "filter");
+    const struct option * long_opts = myargs_to_long(my_options);
+    char * short_opts = myargs_to_short(my_options);
+    int socks[2];
+    int c, i;
+
+    while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 'f':
+                filter = strdup(optarg);
+                break;
+            default:
+                myargs_usage(my_options, PROG_TITLE, "help message", NULL, 1);
+        }
+    }
+    if (n < 1 || repetitions < 1)
+    {
+        fprintf(stderr, "Error messages(%d) and repetitions(%d) must be at least 1\n", n, repetitions);
+        exit(1);
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, socks) < 0)
+    {
+        perror("microbench: socketpair");
+        exit(1);
+    }
+    bench_peer = socks[1];
+    fakeswitch_init(&bench_fs, 1, socks[0], 256 * 1024, 0, 0, MODE_THROUGHPUT, 100000, 0, MAX_SEND_COUNT);
+    fakeswitch_change_status_now(&bench_fs, READY_TO_SEND);
+    msgbuf_clear(bench_fs.outbuf);      // the HELLO
+    bench_fs.rtt_hist = &bench_hist;    // round trips are recorded, as in a test
+
+    printf("%d messages x %d repetitions; ns/message as median, min and max\n", n, repetitions);
+    printf("%-20s %9s %9s %9s %14s\n", "benchmark", "median", "min", "max", "msgs/s/core");
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        if (strstr(benches[i].name, filter))
+            bench_run(&benches[i], n, repetitions);
+    return 0;
+}
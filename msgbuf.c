@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // memfd_create()
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -5,6 +6,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <linux/errqueue.h>
 
 #include "msgbuf.h"
 
@@ -12,29 +20,110 @@
 #define MIN(x,y)  (((x) < (y))? (x) : (y))
 #endif
 
+/* has zc_done not yet reached the given zc_sent mark? */
+#define ZC_PINNED(mbuf, mark)  ((int32_t) ((mark) - (mbuf)->zc_done) > 0)
+
+static char * msgbuf_map_mirrored(int len);
+static void msgbuf_consume(struct msgbuf * mbuf, int count);
+static int msgbuf_reap_completions(struct msgbuf * mbuf, int sock);
+static void msgbuf_wait_zerocopy(struct msgbuf * mbuf, uint32_t mark);
+
 
 
 struct msgbuf *  msgbuf_new(int bufsize)
+{
+    struct msgbuf * mbuf = msgbuf_try_new(bufsize);
+    if (mbuf == NULL)
+    {
+        perror("msgbuf: memfd_create/mmap");
+        fprintf(stderr, "msgbuf: out of mappings? every buffer takes two (see vm.max_map_count)\n");
+        exit(1);
+    }
+    return mbuf;
+}
+/**********************************************************************/
+struct msgbuf *  msgbuf_try_new(int bufsize)
 {
     struct msgbuf * mbuf;
+    long page = sysconf(_SC_PAGESIZE);
     mbuf = malloc(sizeof(*mbuf));
     assert(mbuf);
-    mbuf->len = bufsize;
-    mbuf->buf = malloc(mbuf->len);
-    assert(mbuf->len);
-    mbuf->start = mbuf->end = 0;
-
+    mbuf->len = (bufsize + page - 1) / page * page;
+    mbuf->buf = msgbuf_map_mirrored(mbuf->len);
+    if (mbuf->buf == NULL)
+    {
+        free(mbuf);
+        return NULL;
+    }
+    msgbuf_reset(mbuf);
     return mbuf;
 }
+/**********************************************************************
+ * Map the same len bytes twice in a row, so that anything starting
+ *  in the first copy can run on into the second
+ *  @return the mapping, or NULL (with errno set) if it can't be made
+ */
+static char * msgbuf_map_mirrored(int len)
+{
+    char * base;
+    int err;
+    int fd = memfd_create("msgbuf", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, len) < 0)
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    // reserve the address range, then put both views on top of it
+    base = mmap(NULL, 2 * len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base != MAP_FAILED &&
+            (mmap(base, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+             mmap(base + len, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+        err = errno;
+        munmap(base, 2 * len);
+        errno = err;
+        base = MAP_FAILED;
+    }
+    err = errno;
+    close(fd);      // the mappings keep the memory alive
+    errno = err;
+    return base == MAP_FAILED ? NULL : base;
+}
+/**********************************************************************/
+void msgbuf_reset(struct msgbuf * mbuf)
+{
+    mbuf->start = mbuf->end = 0;
+    mbuf->consumed = 0;
+    mbuf->zc_sock = -1;
+    mbuf->zc_sent = mbuf->zc_done = 0;
+    mbuf->zc_copied = 0;
+}
+/**********************************************************************/
+void msgbuf_free(struct msgbuf * mbuf)
+{
+    // the kernel may still be reading from zerocopy-sent pages
+    msgbuf_wait_zerocopy(mbuf, mbuf->zc_sent);
+    munmap(mbuf->buf, 2 * mbuf->len);
+    free(mbuf);
+}
 
 /**********************************************************************/
 int msgbuf_read(struct msgbuf * mbuf, int sock)
 {
-    int count = read(sock, &mbuf->buf[mbuf->end], mbuf->len - mbuf->end);
+    int space = msgbuf_count_free(mbuf);
+    int count;
+    if (space == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    count = read(sock, &mbuf->buf[mbuf->end], space);
     if(count>0)
         mbuf->end+=count;
-    if( mbuf->end >= mbuf->len)     // resize buffer if need be
-        msgbuf_grow(mbuf);
     return count;
 }
 /**********************************************************************/
@@ -69,9 +158,7 @@ int msgbuf_write(struct msgbuf * mbuf, int sock, int len)
 	}
     int count = write(sock, &mbuf->buf[mbuf->start], send_len);
     if(count>0)
-        mbuf->start+=count;
-    if(mbuf->start >= mbuf->end)
-        mbuf->start = mbuf->end = 0;
+        msgbuf_consume(mbuf, count);
     return count;
 }
 /**********************************************************************/
@@ -95,18 +182,7 @@ int msgbuf_write_all(struct msgbuf * mbuf, int sock, int len)
 /**********************************************************************/
 void msgbuf_clear(struct msgbuf * mbuf)
 {
-    mbuf->start = mbuf->end = 0;
-}
-/**********************************************************************/
-void msgbuf_grow(struct msgbuf * mbuf)
-{
-    mbuf->len *=2 ;
-    mbuf->buf = realloc(mbuf->buf, mbuf->len);
-    if(mbuf->buf == NULL) {
-      perror("msgbuf_grow failed");
-      printf("buffer len: %d\n", mbuf->len);
-    }
-    assert(mbuf->buf);
+    msgbuf_consume(mbuf, mbuf->end - mbuf->start);
 }
 /**********************************************************************/
 void * msgbuf_peek(struct msgbuf *mbuf)
@@ -123,16 +199,149 @@ int msgbuf_pull(struct msgbuf *mbuf, char * buf, int count)
         return -1;
     if(buf)     // don't write if NULL
         memcpy(buf, &mbuf->buf[mbuf->start], min);
-    mbuf->start+=min;
-    if(mbuf->start>= mbuf->end)
-        mbuf->start = mbuf->end = 0;
+    msgbuf_consume(mbuf, min);
     return min;
 }
-/**********************************************************************/
-void msgbuf_push(struct msgbuf *mbuf, char * buf, int count)
+/**********************************************************************
+ * Copy count bytes in
+ *  @return 0, or -1 if they don't fit (nothing is copied then)
+ */
+int msgbuf_push(struct msgbuf *mbuf, char * buf, int count)
 {
-    while((mbuf->end + count) > mbuf->len)
-        msgbuf_grow(mbuf);
+    if (count > msgbuf_count_free(mbuf))
+        return -1;
     memcpy(&mbuf->buf[mbuf->end], buf, count);
     mbuf->end += count;
+    return 0;
+}
+/**********************************************************************
+ * Like msgbuf_push(), but hand back the space so the caller can
+ *  build the message in place instead of copying it in
+ *  @return the space, or NULL if count bytes don't fit
+ */
+void * msgbuf_reserve(struct msgbuf *mbuf, int count)
+{
+    void * space;
+    if (count > msgbuf_count_free(mbuf))
+        return NULL;
+    space = &mbuf->buf[mbuf->end];
+    mbuf->end += count;
+    return space;
+}
+/**********************************************************************
+ * Take back the last count bytes msgbuf_reserve() handed out, e.g.
+ *  for a message that turned out not to be sent after all
+ */
+void msgbuf_unreserve(struct msgbuf *mbuf, int count)
+{
+    assert(count <= mbuf->end - mbuf->start);
+    mbuf->end -= count;
+}
+/**********************************************************************
+ * How many bytes can be pushed: the capacity minus what is buffered
+ *  and minus what zerocopy sends still have pinned behind start
+ */
+int msgbuf_count_free(struct msgbuf * mbuf)
+{
+    int used = mbuf->end - mbuf->start;
+    if (msgbuf_zerocopy_pending(mbuf))
+        used += mbuf->consumed - mbuf->zc_begin[mbuf->zc_done & (MSGBUF_ZC_MAX - 1)];
+    return mbuf->len - used;
+}
+/**********************************************************************
+ * One sendmsg() covering everything that is buffered
+ *  With zerocopy set, the kernel sends straight from our pages
+ *  (MSG_ZEROCOPY; the socket needs SO_ZEROCOPY) and that part of the
+ *  ring stays pinned until msgbuf_reap_zerocopy() sees the completion.
+ */
+int msgbuf_send(struct msgbuf * mbuf, int sock, int zerocopy)
+{
+    struct iovec iov;
+    struct msghdr msg;
+    int count;
+
+    if (mbuf->zc_sent - mbuf->zc_done == MSGBUF_ZC_MAX)
+        zerocopy = 0;       // no room to track another one: copy
+    iov.iov_base = &mbuf->buf[mbuf->start];
+    iov.iov_len = mbuf->end - mbuf->start;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;     // buffered data is always contiguous
+    count = sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+    if (count > 0)
+    {
+        if (zerocopy)
+        {
+            mbuf->zc_sock = sock;
+            mbuf->zc_begin[mbuf->zc_sent++ & (MSGBUF_ZC_MAX - 1)] = mbuf->consumed;
+        }
+        msgbuf_consume(mbuf, count);
+    }
+    return count;
+}
+/**********************************************************************
+ * Read zerocopy completions from the socket error queue without blocking
+ *  @return the number of recvmsg() calls made
+ */
+int msgbuf_reap_zerocopy(struct msgbuf * mbuf, int sock)
+{
+    return msgbuf_reap_completions(mbuf, sock);
+}
+/**********************************************************************/
+static int msgbuf_reap_completions(struct msgbuf * mbuf, int sock)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr * cm;
+    struct sock_extended_err * serr;
+    int calls = 0;
+
+    while (msgbuf_zerocopy_pending(mbuf))
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        calls++;
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;      // EAGAIN: nothing completed yet
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            serr = (struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // completions cover the send range [ee_info, ee_data]
+            mbuf->zc_done += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                mbuf->zc_copied++;
+        }
+    }
+    return calls;
+}
+/**********************************************************************
+ * Called whenever data leaves the buffer; once start passes into the
+ *  second mapping, move both offsets back into the first
+ */
+static void msgbuf_consume(struct msgbuf * mbuf, int count)
+{
+    mbuf->start += count;
+    mbuf->consumed += count;
+    if (mbuf->start >= mbuf->len)
+    {
+        mbuf->start -= mbuf->len;
+        mbuf->end -= mbuf->len;
+    }
+}
+/**********************************************************************
+ * Block until all zerocopy sends up to mark have completed
+ */
+static void msgbuf_wait_zerocopy(struct msgbuf * mbuf, uint32_t mark)
+{
+    struct pollfd pfd;
+    while (ZC_PINNED(mbuf, mark))
+    {
+        pfd.fd = mbuf->zc_sock;
+        pfd.events = 0;     // POLLERR is always reported
+        poll(&pfd, 1, 1);
+        msgbuf_reap_completions(mbuf, mbuf->zc_sock);
+    }
 }
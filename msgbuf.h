@@ -1,23 +1,58 @@
 #ifndef MSGBUF_H
 #define MSGBUF_H
 
+#include <stdint.h>
+
+#define MSGBUF_ZC_MAX   64      // zerocopy sends in flight per buffer; power of 2
+
+/* Fixed-capacity ring buffer
+ *  The len bytes of storage are mapped twice, back to back, so the
+ *  buffered data buf[start..end) is always contiguous, even when it
+ *  wraps around the end of the ring.  start stays below len.
+ *  The buffer never grows: a push that doesn't fit fails.
+ */
 struct msgbuf
 {
         char * buf;
             int len, start, end;
+        uint64_t consumed;              // bytes taken out of the buffer since it was created
+        // MSG_ZEROCOPY bookkeeping: the kernel reads sent data from our
+        //  pages until it reports completion, so that part of the ring
+        //  is not handed out again before then
+        int zc_sock;                    // socket the zerocopy sends went to
+        uint32_t zc_sent, zc_done;      // zerocopy sends issued and completed
+        uint64_t zc_begin[MSGBUF_ZC_MAX];   // value of consumed when each send in flight started
+        unsigned long zc_copied;        // completions where the kernel copied after all
 };
 
 
+/*** Map a new ring buffer
+ * @param bufsize   Capacity in bytes; rounded up to a multiple of the page size
+ */
 struct msgbuf *  msgbuf_new(int bufsize);
+/*** Like msgbuf_new(), but hand back NULL instead of exiting when the
+ *  buffer can't be mapped (out of memory or of mappings)
+ */
+struct msgbuf *  msgbuf_try_new(int bufsize);
+void             msgbuf_free(struct msgbuf * mbuf);
+/*** Empty the buffer and forget its history, so it can be handed to
+ *  another user; no zerocopy send may be pending
+ */
+void             msgbuf_reset(struct msgbuf * mbuf);
 int              msgbuf_read(struct msgbuf * mbuf, int sock);
 int              msgbuf_read_all(struct msgbuf * mbuf, int sock, int len);
 int              msgbuf_write(struct msgbuf * mbuf, int sock, int len);
 int              msgbuf_write_all(struct msgbuf * mbuf, int sock, int len);
-void             msgbuf_grow(struct msgbuf *mbuf);
 void             msgbuf_clear(struct msgbuf *mbuf);
 void *           msgbuf_peek(struct msgbuf *mbuf);
 int              msgbuf_pull(struct msgbuf *mbuf, char * buf, int count);
-void             msgbuf_push(struct msgbuf *mbuf, char * buf, int count);
+int              msgbuf_push(struct msgbuf *mbuf, char * buf, int count);
+void *           msgbuf_reserve(struct msgbuf *mbuf, int count);
+void             msgbuf_unreserve(struct msgbuf *mbuf, int count);
+int              msgbuf_count_free(struct msgbuf * mbuf);
+int              msgbuf_send(struct msgbuf * mbuf, int sock, int zerocopy);
+int              msgbuf_reap_zerocopy(struct msgbuf * mbuf, int sock);
+#define msgbuf_zerocopy_pending(mbuf) ((mbuf)->zc_sent != (mbuf)->zc_done)
 //int              msgbuf_count_buffered(struct msgbuf * mbuf);
 #define msgbuf_count_buffered(mbuf) ((mbuf->end - mbuf->start))
 
@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcap.h"
+
+#define PCAP_MAGIC_US       0xa1b2c3d4
+#define PCAP_MAGIC_NS       0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET  1
+#define PCAP_HEADER_LEN     24
+#define PCAP_RECORD_LEN     16
+#define ETH_MIN_LEN         14
+
+static uint32_t pcap_u32(const uint8_t * p, int swapped);
+static int pcap_frame_is_lldp(const uint8_t * data, uint32_t caplen);
+
+/***********************************************************************/
+void pcap_trace_open(struct pcap_trace * trace, const char * path)
+{
+    struct stat st;
+    const uint8_t * p;
+    uint32_t magic, caplen;
+    uint64_t first = 0, t, last = 0;
+    size_t off;
+    int fd, swapped, ns, i, capacity = 0;
+
+    memset(trace, 0, sizeof(*trace));
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    if (st.st_size < PCAP_HEADER_LEN)
+    {
+        fprintf(stderr, "Error %s is too short for a pcap file\n", path);
+        exit(1);
+    }
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+    {
+        perror("pcap: mmap");
+        exit(1);
+    }
+    close(fd);      // the mapping stays
+    madvise((void *) trace->map, trace->map_len, MADV_SEQUENTIAL);
+
+    p = trace->map;
+    magic = pcap_u32(p, 0);
+    swapped = magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    magic = pcap_u32(p, swapped);
+    if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS)
+    {
+        fprintf(stderr, "Error %s is not a classic pcap file (pcapng must be converted first)\n", path);
+        exit(1);
+    }
+    ns = magic == PCAP_MAGIC_NS;
+    if (pcap_u32(p + 20, swapped) != PCAP_LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "Error %s has link type %u; only Ethernet (1) can go into packet_ins\n",
+                path, pcap_u32(p + 20, swapped));
+        exit(1);
+    }
+
+    for (off = PCAP_HEADER_LEN; off + PCAP_RECORD_LEN <= trace->map_len; off += PCAP_RECORD_LEN + caplen)
+    {
+        p = trace->map + off;
+        caplen = pcap_u32(p + 8, swapped);
+        if (off + PCAP_RECORD_LEN + caplen > trace->map_len)
+            break;      // truncated capture: keep what is complete
+        t = pcap_u32(p, swapped) * 1000000000ull + pcap_u32(p + 4, swapped) * (ns ? 1 : 1000);
+        if (trace->n_frames == 0 && trace->skipped == 0)
+            first = last = t;
+        if (t < last)
+            t = last;   // out of order timestamps: send right away
+        last = t;
+        if (caplen < ETH_MIN_LEN || pcap_frame_is_lldp(p + PCAP_RECORD_LEN, caplen))
+        {
+            trace->skipped++;
+            continue;
+        }
+        if (trace->n_frames == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            trace->frames = realloc(trace->frames, capacity * sizeof(struct pcap_frame));
+            assert(trace->frames);
+        }
+        trace->frames[trace->n_frames].data = p + PCAP_RECORD_LEN;
+        trace->frames[trace->n_frames].caplen = caplen;
+        trace->frames[trace->n_frames].len = pcap_u32(p + 12, swapped);
+        trace->frames[trace->n_frames].time_ns = t - first;
+        if (caplen > trace->max_caplen)
+            trace->max_caplen = caplen;
+        trace->n_frames++;
+    }
+    if (trace->n_frames == 0)
+    {
+        fprintf(stderr, "Error %s holds no Ethernet frame that could go into a packet_in\n", path);
+        exit(1);
+    }
+    // the schedule starts with the first frame that is used
+    first = trace->frames[0].time_ns;
+    for (i = 0; i < trace->n_frames; i++)
+        trace->frames[i].time_ns -= first;
+    trace->duration_ns = trace->frames[trace->n_frames - 1].time_ns;
+}
+
+/***********************************************************************/
+double pcap_trace_rate(const struct pcap_trace * trace)
+{
+    if (trace->duration_ns == 0)
+        return 0;
+    return (trace->n_frames - 1) * 1e9 / trace->duration_ns;
+}
+
+/***********************************************************************/
+uint64_t pcap_trace_loop_ns(const struct pcap_trace * trace)
+{
+    if (trace->n_frames < 2)
+        return trace->duration_ns;
+    return trace->duration_ns + trace->duration_ns / (trace->n_frames - 1);
+}
+
+/***********************************************************************/
+static uint32_t pcap_u32(const uint8_t * p, int swapped)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));   // records are not aligned
+    return swapped ? __builtin_bswap32(v) : v;
+}
+
+/***********************************************************************
+ * LLDP or BDDP, possibly behind one VLAN tag
+ */
+static int pcap_frame_is_lldp(const uint8_t * data, uint32_t caplen)
+{
+    int type = data[12] << 8 | data[13];
+    if (type == 0x8100 && caplen >= ETH_MIN_LEN + 4)
+        type = data[16] << 8 | data[17];
+    return type == 0x88cc || type == 0x8942;
+}
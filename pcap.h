@@ -0,0 +1,48 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* one captured frame */
+struct pcap_frame
+{
+    const uint8_t * data;               // into the mapped file
+    uint32_t caplen;                    // bytes captured
+    uint32_t len;                       // bytes on the wire
+    uint64_t time_ns;                   // since the first frame; never decreasing
+};
+
+/* A pcap file of Ethernet frames, memory-mapped read-only and indexed
+ *  once, so any number of switches can share it.  LLDP and BDDP frames
+ *  are left out of the index: the packet_outs answering them would look
+ *  like the controller's own topology discovery, which isn't counted.
+ */
+struct pcap_trace
+{
+    const uint8_t * map;
+    size_t map_len;
+    struct pcap_frame * frames;
+    int n_frames;
+    int skipped;                        // LLDP, BDDP and runt frames left out
+    uint32_t max_caplen;
+    uint64_t duration_ns;               // from the first frame to the last
+};
+
+/*** Map and index a classic (not pcapng) pcap file with Ethernet link type
+ *  Microsecond and nanosecond timestamps in either byte order are read.
+ *  Exits if the file can't be read or holds no usable frame.
+ * @param trace     Trace to initialize
+ * @param path      The file
+ */
+void pcap_trace_open(struct pcap_trace * trace, const char * path);
+
+/*** @return  Frames per second of the capture, 0 if it has no duration */
+double pcap_trace_rate(const struct pcap_trace * trace);
+
+/*** @return  How long a replay of the whole capture takes before it starts
+ *  over, i.e. its duration plus one mean inter-arrival time (ns)
+ */
+uint64_t pcap_trace_loop_ns(const struct pcap_trace * trace);
+
+#endif
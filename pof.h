@@ -542,6 +542,29 @@ enum pof_packet_in_reason {
     POFR_INVALID_TTL = 2, /* Packet has invalid TTL */
 };
 
+/* Flow removed (datapath -> controller). */
+typedef struct pof_flow_removed {
+    pof_header header;
+    uint64_t cookie; /* Opaque controller-issued identifier. */
+    uint16_t priority; /* Priority level of flow entry. */
+    uint8_t  reason; /* One of POFRR_*. */
+    uint8_t  table_id; /* ID of the table */
+    uint32_t duration_sec; /* Time flow was alive in seconds. */
+    uint32_t duration_nsec; /* Time flow was alive in nanoseconds beyond duration_sec. */
+    uint16_t idle_timeout; /* Idle timeout from original flow mod. */
+    uint16_t hard_timeout; /* Hard timeout from original flow mod. */
+    uint64_t packet_count;
+    uint64_t byte_count;
+    pof_match_x match[POF_MAX_MATCH_FIELD_NUM];
+} pof_flow_removed;     //sizeof=8+40+2*40=128
+
+/* Why was this flow removed? */
+enum pof_flow_removed_reason {
+    POFRR_IDLE_TIMEOUT = 0, /* Flow idle time exceeded idle_timeout. */
+    POFRR_HARD_TIMEOUT = 1, /* Time exceeded hard_timeout. */
+    POFRR_DELETE = 2, /* Evicted by a DELETE flow mod. */
+};
+
 /* Describe the action struct. */
 typedef struct pof_action{
     uint16_t type;
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE     // accept4()
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "pof.h"
+#include "reflector.h"
+
+static void * reflector_main(void * arg);
+static void reflector_accept(struct reflector * reflector);
+static uint32_t reflector_serve(struct reflector_conn * conn);
+static int reflector_reflect(struct reflector_conn * conn);
+static void reflector_close(struct reflector_thread * t, struct reflector_conn * conn);
+
+/***********************************************************************/
+int reflector_start(struct reflector * reflector, int n_threads)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    struct epoll_event ev;
+    int i, err;
+
+    memset(reflector, 0, sizeof(*reflector));
+    reflector->listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (reflector->listen_sock < 0)
+    {
+        perror("reflector: socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;      // any free port
+    if (bind(reflector->listen_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(reflector->listen_sock, SOMAXCONN) < 0 ||
+            getsockname(reflector->listen_sock, (struct sockaddr *) &addr, &addrlen) < 0)
+    {
+        perror("reflector: bind/listen");
+        exit(1);
+    }
+    reflector->port = ntohs(addr.sin_port);
+
+    reflector->n_threads = n_threads;
+    reflector->threads = calloc(n_threads, sizeof(struct reflector_thread));
+    assert(reflector->threads);
+    for (i = 0; i < n_threads; i++)
+    {
+        reflector->threads[i].reflector = reflector;
+        reflector->threads[i].epfd = epoll_create1(0);
+        if (reflector->threads[i].epfd < 0)
+        {
+            perror("reflector: epoll_create1");
+            exit(1);
+        }
+    }
+    // thread 0 accepts; a NULL pointer marks the listening socket
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(reflector->threads[0].epfd, EPOLL_CTL_ADD, reflector->listen_sock, &ev) < 0)
+    {
+        perror("reflector: epoll_ctl");
+        exit(1);
+    }
+    for (i = 0; i < n_threads; i++)
+    {
+        err = pthread_create(&reflector->threads[i].thread, NULL, reflector_main, &reflector->threads[i]);
+        if (err)
+        {
+            fprintf(stderr, "reflector: pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+        pthread_detach(reflector->threads[i].thread);
+    }
+    return reflector->port;
+}
+
+/***********************************************************************/
+static void * reflector_main(void * arg)
+{
+    struct reflector_thread * t = arg;
+    struct epoll_event events[REFLECTOR_MAX_EVENTS];
+    struct epoll_event ev;
+    struct reflector_conn * conn;
+    int i, n;
+
+    while (1)
+    {
+        n = epoll_wait(t->epfd, events, REFLECTOR_MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("reflector: epoll_wait");
+            exit(1);
+        }
+        for (i = 0; i < n; i++)
+        {
+            conn = events[i].data.ptr;
+            if (conn == NULL)
+            {
+                reflector_accept(t->reflector);
+                continue;
+            }
+            ev.events = reflector_serve(conn);
+            if (ev.events == 0)
+                reflector_close(t, conn);
+            else if (ev.events != conn->events)
+            {
+                ev.data.ptr = conn;
+                epoll_ctl(t->epfd, EPOLL_CTL_MOD, conn->sock, &ev);
+                conn->events = ev.events;
+            }
+        }
+    }
+    return NULL;
+}
+
+/***********************************************************************
+ * Take every pending connection, start its handshake and hand it to
+ *  the next thread
+ */
+static void reflector_accept(struct reflector * reflector)
+{
+    struct reflector_conn * conn;
+    struct reflector_thread * t;
+    struct pof_header handshake[3];
+    struct epoll_event ev;
+    int one = 1;
+    int sock, i;
+
+    while ((sock = accept4(reflector->listen_sock, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+    {
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn = malloc(sizeof(*conn));
+        assert(conn);
+        conn->sock = sock;
+        conn->inbuf = msgbuf_new(REFLECTOR_BUFSIZE);
+        conn->outbuf = msgbuf_new(REFLECTOR_BUFSIZE);
+
+        // HELLO, FEATURES_REQUEST and GET_CONFIG_REQUEST in one go
+        for (i = 0; i < 3; i++)
+        {
+            handshake[i].version = POF_VERSION;
+            handshake[i].length = htons(sizeof(struct pof_header));
+            handshake[i].xid = htonl(i + 1);
+        }
+        handshake[0].type = POFT_HELLO;
+        handshake[1].type = POFT_FEATURES_REQUEST;
+        handshake[2].type = POFT_GET_CONFIG_REQUEST;
+        msgbuf_push(conn->outbuf, (char *) handshake, sizeof(handshake));
+
+        t = &reflector->threads[reflector->next_thread++ % reflector->n_threads];
+        ev.events = conn->events = EPOLLOUT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+        {
+            perror("reflector: epoll_ctl");
+            exit(1);
+        }
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        perror("reflector: accept");
+}
+
+/***********************************************************************
+ * Reflect, write and read until the socket would block
+ * @return  The epoll events to wait for next, 0 if the connection is gone
+ */
+static uint32_t reflector_serve(struct reflector_conn * conn)
+{
+    int count;
+
+    while (1)
+    {
+        if (reflector_reflect(conn) < 0)
+            return 0;
+        while (msgbuf_count_buffered(conn->outbuf) > 0)
+        {
+            count = msgbuf_write(conn->outbuf, conn->sock, 0);
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return EPOLLOUT;    // don't read more than we can answer
+            if (count < 0 && errno != EINTR)
+                return 0;
+        }
+        count = msgbuf_read(conn->inbuf, conn->sock);
+        if (count == 0)
+            return 0;
+        if (count < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return EPOLLIN;
+            if (errno != EINTR && errno != ENOBUFS)
+                return 0;   // ENOBUFS: reflect what is buffered first
+        }
+    }
+}
+
+/***********************************************************************
+ * Answer every complete message in the input buffer that fits into the
+ *  output buffer
+ * @return  0, or -1 if the switch sent garbage
+ */
+static int reflector_reflect(struct reflector_conn * conn)
+{
+    char * data = msgbuf_peek(conn->inbuf);
+    int len = msgbuf_count_buffered(conn->inbuf);
+    struct pof_header * pofh;
+    struct pof_header * echo;
+    pof_packet_in * pi;
+    pof_packet_out * po;
+    int off = 0;
+    int msglen, frame;
+
+    while (len - off >= sizeof(struct pof_header))
+    {
+        pofh = (struct pof_header *) (data + off);
+        msglen = ntohs(pofh->length);
+        if (msglen < sizeof(struct pof_header))
+        {
+            fprintf(stderr, "reflector: switch sent a message of length %d, closing\n", msglen);
+            return -1;
+        }
+        if (len - off < msglen)
+            break;      // msg not all there yet
+        if (pofh->type == POFT_PACKET_IN)
+        {
+            pi = (pof_packet_in *) pofh;
+            frame = msglen - (int) offsetof(pof_packet_in, data);
+            if (frame < 0)
+                frame = 0;
+            if (frame > POF_PACKET_IN_MAX_LENGTH)
+                frame = POF_PACKET_IN_MAX_LENGTH;
+            po = msgbuf_reserve(conn->outbuf, offsetof(pof_packet_out, data) + frame);
+            if (po == NULL)
+                break;  // output full: the rest waits for the socket to drain
+            memset(po, 0, offsetof(pof_packet_out, data));
+            po->header.version = POF_VERSION;
+            po->header.type = POFT_PACKET_OUT;
+            po->header.length = htons(offsetof(pof_packet_out, data) + frame);
+            po->header.xid = pofh->xid;
+            po->bufferId = pi->buffer_id;
+            po->packetLen = htonl(frame);
+            memcpy(po->data, pi->data, frame);
+        }
+        else if (pofh->type == POFT_ECHO_REQUEST)
+        {
+            echo = msgbuf_reserve(conn->outbuf, sizeof(struct pof_header));
+            if (echo == NULL)
+                break;
+            echo->version = POF_VERSION;
+            echo->type = POFT_ECHO_REPLY;
+            echo->length = htons(sizeof(struct pof_header));
+            echo->xid = pofh->xid;
+        }
+        // the handshake replies and everything else need no answer
+        off += msglen;
+    }
+    if (off > 0)
+        msgbuf_pull(conn->inbuf, NULL, off);
+    return 0;
+}
+
+/***********************************************************************/
+static void reflector_close(struct reflector_thread * t, struct reflector_conn * conn)
+{
+    epoll_ctl(t->epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+    close(conn->sock);
+    msgbuf_free(conn->inbuf);
+    msgbuf_free(conn->outbuf);
+    free(conn);
+}
@@ -0,0 +1,50 @@
+#ifndef REFLECTOR_H
+#define REFLECTOR_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "msgbuf.h"
+
+#define REFLECTOR_BUFSIZE       (256 * 1024)    // ring buffer per direction and connection
+#define REFLECTOR_MAX_EVENTS    256
+
+/* one switch connected to the reflector */
+struct reflector_conn
+{
+    int sock;
+    uint32_t events;                    // what epoll waits for: EPOLLIN, or EPOLLOUT while output is stuck
+    struct msgbuf * inbuf, * outbuf;
+};
+
+struct reflector_thread
+{
+    pthread_t thread;
+    int epfd;
+    struct reflector * reflector;
+};
+
+/* Minimal POF controller on 127.0.0.1 for calibration: it does the
+ *  HELLO/FEATURES_REQUEST/GET_CONFIG_REQUEST handshake, answers echo
+ *  requests and turns every PACKET_IN into a PACKET_OUT with the same
+ *  xid and buffer_id, as fast as it can.  Connections are spread over
+ *  its threads round robin; it runs until the process exits.
+ */
+struct reflector
+{
+    int listen_sock;
+    int port;                           // where it listens
+    int n_threads;
+    struct reflector_thread * threads;
+    int next_thread;                    // thread that gets the next connection
+};
+
+/*** Start listening on an ephemeral port of 127.0.0.1 and start the threads
+ *  Exits if the socket or a thread can't be set up
+ * @param reflector Reflector to initialize
+ * @param n_threads Event loops serving the connections
+ * @return          The port
+ */
+int reflector_start(struct reflector * reflector, int n_threads);
+
+#endif
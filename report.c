@@ -0,0 +1,446 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/time.h>
+
+#include "report.h"
+
+static const char * report_format_names[] = { "jsonl", "csv" };
+
+static void report_param(struct report * report, const char * name, const char * value, int is_string);
+static void report_begin(struct report * report, const char * record, int n_fakeswitches);
+static void report_latency(struct report * report, const char * name, const struct histogram * h);
+static void report_worst(struct report * report, const struct test_result * result);
+static void report_mix(struct report * report, const struct mix_counts * mix);
+static void report_failover(struct report * report, const struct failover_stats * failover);
+static void report_reconnect(struct report * report, const struct test_result * result);
+static void report_flows(struct report * report, const struct flow_stats * flows);
+static void report_echo(struct report * report, const struct test_result * result);
+static void report_end(struct report * report);
+static void report_csv_header(struct report * report);
+static void report_write_string(struct report * report, const char * s);
+
+/***********************************************************************/
+int report_format_from_name(const char * name)
+{
+    int i;
+    for (i = 0; i < sizeof(report_format_names) / sizeof(report_format_names[0]); i++)
+        if (!strcmp(name, report_format_names[i]))
+            return i;
+    return -1;
+}
+
+/***********************************************************************/
+void report_open(struct report * report, const char * path, enum report_format format)
+{
+    memset(report, 0, sizeof(*report));
+    report->fp = fopen(path, "w");
+    if (report->fp == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    report->format = format;
+    // a big buffer keeps writes to a few per run
+    report->buf = malloc(REPORT_BUFSIZE);
+    assert(report->buf);
+    setvbuf(report->fp, report->buf, _IOFBF, REPORT_BUFSIZE);
+}
+
+/***********************************************************************/
+void report_param_int(struct report * report, const char * name, long value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    report_param(report, name, buf, 0);
+}
+
+/***********************************************************************/
+void report_param_double(struct report * report, const char * name, double value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", value);
+    report_param(report, name, buf, 0);
+}
+
+/***********************************************************************/
+void report_param_string(struct report * report, const char * name, const char * value)
+{
+    report_param(report, name, value, 1);
+}
+
+/***********************************************************************
+ * Add a parameter, or change the value of one added before
+ */
+static void report_param(struct report * report, const char * name, const char * value, int is_string)
+{
+    int i;
+    for (i = 0; i < report->n_params; i++)
+        if (!strcmp(report->param_names[i], name))
+            break;
+    if (i == report->n_params)
+    {
+        assert(report->n_params < REPORT_MAX_PARAMS);
+        report->param_names[i] = name;
+        report->n_params++;
+    }
+    else
+        free(report->param_values[i]);
+    report->param_values[i] = strdup(value);
+    report->param_is_string[i] = is_string;
+}
+
+/***********************************************************************/
+void report_test(struct report * report, const struct test_result * result)
+{
+    FILE * fp = report->fp;
+    double s = result->ms / 1000.0;
+    int i;
+
+    report_begin(report, "test", result->n_fakeswitches);
+    if (report->format == REPORT_CSV)
+    {
+        fprintf(fp, "%d,%.3lf,%d,%d,%.2lf,%.2lf,,,,,", report->test, result->ms,
+                result->responses, result->requests, result->responses / s, result->requests / s);
+        report_latency(report, "rtt", result->rtt_hist);
+        fprintf(fp, ",%lu,%.3lf,\"", result->syscalls, result->cpu_time);
+        for (i = 0; i < result->n_fakeswitches; i++)
+            fprintf(fp, "%s%d/%d", i ? " " : "", result->counts[i].recv_count, result->counts[i].send_count);
+        fprintf(fp, "\",%.4lf,%.4lf,%.2lf,%.2lf,%.2lf,\"", result->fairness->jain, result->fairness->cv,
+                result->fairness->min, result->fairness->median, result->fairness->max);
+        report_worst(report, result);
+        fprintf(fp, "\",%d,%.1lf,%d,%lu,%lu,%lu,%lu,\"", result->window_min, result->window_avg, result->window_max,
+                result->match.unmatched, result->match.duplicates, result->match.late, result->match.timed_out);
+        report_mix(report, result->mix);
+        fprintf(fp, "\",%.0lf,%ld,%llu,%lu", result->mem_peak_avg, result->mem_peak_max,
+                (unsigned long long) result->pool.peak, result->pool.refused);
+        report_failover(report, result->failover);
+        report_reconnect(report, result);
+        report_flows(report, result->flows);
+        report_echo(report, result);
+    }
+    else
+    {
+        fprintf(fp, ",\"test\":%d,\"ms\":%.3lf,\"responses\":%d,\"requests\":%d,"
+                "\"responses_per_s\":%.2lf,\"requests_per_s\":%.2lf,",
+                report->test, result->ms, result->responses, result->requests,
+                result->responses / s, result->requests / s);
+        report_latency(report, "rtt", result->rtt_hist);
+        fprintf(fp, ",\"syscalls\":%lu,\"cpu_s\":%.3lf,\"recv\":[", result->syscalls, result->cpu_time);
+        for (i = 0; i < result->n_fakeswitches; i++)
+            fprintf(fp, "%s%d", i ? "," : "", result->counts[i].recv_count);
+        fprintf(fp, "],\"send\":[");
+        for (i = 0; i < result->n_fakeswitches; i++)
+            fprintf(fp, "%s%d", i ? "," : "", result->counts[i].send_count);
+        fprintf(fp, "],\"jain\":%.4lf,\"cv\":%.4lf,\"switch_min_per_s\":%.2lf,"
+                "\"switch_median_per_s\":%.2lf,\"switch_max_per_s\":%.2lf,\"worst_switches\":[",
+                result->fairness->jain, result->fairness->cv,
+                result->fairness->min, result->fairness->median, result->fairness->max);
+        report_worst(report, result);
+        fprintf(fp, "],\"window_min\":%d,\"window_avg\":%.1lf,\"window_max\":%d,"
+                "\"unmatched\":%lu,\"duplicates\":%lu,\"late\":%lu,\"timed_out\":%lu",
+                result->window_min, result->window_avg, result->window_max,
+                result->match.unmatched, result->match.duplicates, result->match.late, result->match.timed_out);
+        fprintf(fp, ",\"mem_peak_avg_bytes\":%.0lf,\"mem_peak_max_bytes\":%ld,"
+                "\"rings_peak_bytes\":%llu,\"rings_refused\":%lu",
+                result->mem_peak_avg, result->mem_peak_max,
+                (unsigned long long) result->pool.peak, result->pool.refused);
+        report_failover(report, result->failover);
+        report_reconnect(report, result);
+        report_flows(report, result->flows);
+        report_echo(report, result);
+        if (result->mix)
+        {
+            fprintf(fp, ",\"messages\":{");
+            report_mix(report, result->mix);
+            fputc('}', fp);
+        }
+    }
+    report_end(report);
+    report->test++;
+}
+
+/***********************************************************************/
+void report_run(struct report * report, const struct run_result * result)
+{
+    FILE * fp = report->fp;
+
+    report_begin(report, "run", result->n_fakeswitches);
+    if (report->format == REPORT_CSV)
+    {
+        fprintf(fp, "%d,,%d,%d,,,%.2lf,%.2lf,%.2lf,%.2lf,", result->counted_tests,
+                result->responses, result->requests,
+                result->min, result->max, result->avg, result->stdev);
+        report_latency(report, "rtt", result->rtt_hist);
+        fprintf(fp, ",,,,%.4lf,%.4lf,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,", result->jain_min, result->cv_max);
+    }
+    else
+    {
+        fprintf(fp, ",\"tests\":%d,\"responses\":%d,\"requests\":%d,"
+                "\"min_per_s\":%.2lf,\"max_per_s\":%.2lf,\"avg_per_s\":%.2lf,\"stdev_per_s\":%.2lf,",
+                result->counted_tests, result->responses, result->requests,
+                result->min, result->max, result->avg, result->stdev);
+        report_latency(report, "rtt", result->rtt_hist);
+        fprintf(fp, ",\"jain_min\":%.4lf,\"cv_max\":%.4lf", result->jain_min, result->cv_max);
+    }
+    report_end(report);
+    fflush(fp);     // a run is complete: let readers see it
+    report->test = 0;
+}
+
+/***********************************************************************/
+void report_close(struct report * report)
+{
+    int i;
+    fclose(report->fp);
+    free(report->buf);
+    for (i = 0; i < report->n_params; i++)
+        free(report->param_values[i]);
+}
+
+/***********************************************************************
+ * Record type, wall clock time and switch count
+ */
+static void report_begin(struct report * report, const char * record, int n_fakeswitches)
+{
+    struct timeval now;
+
+    if (report->format == REPORT_CSV && ftell(report->fp) == 0)
+        report_csv_header(report);
+    gettimeofday(&now, NULL);
+    if (report->format == REPORT_CSV)
+        fprintf(report->fp, "%s,%ld.%06ld,%d,", record, (long) now.tv_sec, (long) now.tv_usec, n_fakeswitches);
+    else
+        fprintf(report->fp, "{\"record\":\"%s\",\"timestamp\":%ld.%06ld,\"switches\":%d",
+                record, (long) now.tv_sec, (long) now.tv_usec, n_fakeswitches);
+}
+
+/***********************************************************************
+ * Round trip time quantiles in us; name prefixes the JSON keys
+ */
+static void report_latency(struct report * report, const char * name, const struct histogram * h)
+{
+    double q[6];
+    q[0] = h->count ? h->min / 1000.0 : 0;
+    q[1] = histogram_quantile(h, 0.50) / 1000.0;
+    q[2] = histogram_quantile(h, 0.90) / 1000.0;
+    q[3] = histogram_quantile(h, 0.99) / 1000.0;
+    q[4] = histogram_quantile(h, 0.999) / 1000.0;
+    q[5] = h->max / 1000.0;
+    if (report->format == REPORT_CSV)
+        fprintf(report->fp, "%lu,%.1lf,%.1lf,%.1lf,%.1lf,%.1lf,%.1lf",
+                (unsigned long) h->count, q[0], q[1], q[2], q[3], q[4], q[5]);
+    else
+        fprintf(report->fp, "\"%s_samples\":%lu,\"%s_min_us\":%.1lf,\"%s_p50_us\":%.1lf,"
+                "\"%s_p90_us\":%.1lf,\"%s_p99_us\":%.1lf,\"%s_p999_us\":%.1lf,\"%s_max_us\":%.1lf",
+                name, (unsigned long) h->count, name, q[0], name, q[1], name, q[2],
+                name, q[3], name, q[4], name, q[5]);
+}
+
+/***********************************************************************
+ * Switch numbers (DPIDs) of the worst served switches, comma separated
+ */
+static void report_worst(struct report * report, const struct test_result * result)
+{
+    int i;
+    for (i = 0; i < result->fairness->n_worst; i++)
+        fprintf(report->fp, "%s%d", i ? "," : "",
+                result->counts[result->fairness->worst[i]].id);
+}
+
+/***********************************************************************
+ * Sent and answered messages of each type that was sent; in CSV
+ *  "type:sent/answered" pairs, empty without a mix
+ */
+static void report_mix(struct report * report, const struct mix_counts * mix)
+{
+    int i, first = 1;
+    if (mix == NULL)
+        return;
+    for (i = 0; i < WORKLOAD_TYPES; i++)
+    {
+        if (mix->sent[i] == 0)
+            continue;
+        if (report->format == REPORT_CSV)
+            fprintf(report->fp, "%s%s:%lu/%lu", first ? "" : " ", workload_type_name(i),
+                    mix->sent[i], mix->answered[i]);
+        else
+            fprintf(report->fp, "%s\"%s\":{\"sent\":%lu,\"answered\":%lu}", first ? "" : ",",
+                    workload_type_name(i), mix->sent[i], mix->answered[i]);
+        first = 0;
+    }
+}
+
+/***********************************************************************
+ * Mastership columns; in CSV empty without a controller cluster
+ */
+static void report_failover(struct report * report, const struct failover_stats * failover)
+{
+    double avg;
+    if (failover == NULL)
+    {
+        if (report->format == REPORT_CSV)
+            fprintf(report->fp, ",,,,,,");
+        return;
+    }
+    avg = failover->failovers ? failover->failover_sum / 1e6 / failover->failovers : 0;
+    if (report->format == REPORT_CSV)
+        fprintf(report->fp, ",%lu,%lu,%lu,%.3lf,%.3lf,%d", failover->role_changes, failover->connections_lost,
+                failover->failovers, avg, failover->failover_max / 1e6, failover->without_master);
+    else
+        fprintf(report->fp, ",\"role_changes\":%lu,\"connections_lost\":%lu,\"failovers\":%lu,"
+                "\"failover_avg_ms\":%.3lf,\"failover_max_ms\":%.3lf,\"switches_without_master\":%d",
+                failover->role_changes, failover->connections_lost,
+                failover->failovers, avg, failover->failover_max / 1e6, failover->without_master);
+}
+
+/***********************************************************************
+ * Reconnect columns; in CSV empty unless the switches reconnect
+ */
+static void report_reconnect(struct report * report, const struct test_result * result)
+{
+    const struct reconnect_stats * reconnect = result->reconnect;
+    double outage_avg, recovery_avg;
+    int i;
+
+    if (reconnect == NULL)
+    {
+        if (report->format == REPORT_CSV)
+            fprintf(report->fp, ",,,,,,,,,");
+        return;
+    }
+    outage_avg = reconnect->handshakes ? reconnect->outage_sum / 1e6 / reconnect->handshakes : 0;
+    recovery_avg = reconnect->recoveries ? reconnect->recovery_sum / 1e6 / reconnect->recoveries : 0;
+    if (report->format == REPORT_CSV)
+        fprintf(report->fp, ",%lu,%lu,%lu,%.3lf,%.3lf,%.3lf,%.3lf,%d,\"", reconnect->losses, reconnect->attempts,
+                reconnect->handshakes, outage_avg, reconnect->outage_max / 1e6,
+                recovery_avg, reconnect->recovery_max / 1e6, reconnect->down);
+    else
+        fprintf(report->fp, ",\"reconnect_losses\":%lu,\"reconnect_attempts\":%lu,\"handshakes_redone\":%lu,"
+                "\"outage_avg_ms\":%.3lf,\"outage_max_ms\":%.3lf,\"recovery_avg_ms\":%.3lf,\"recovery_max_ms\":%.3lf,"
+                "\"switches_down\":%d,\"down_ms\":[", reconnect->losses, reconnect->attempts,
+                reconnect->handshakes, outage_avg, reconnect->outage_max / 1e6,
+                recovery_avg, reconnect->recovery_max / 1e6, reconnect->down);
+    for (i = 0; i < result->n_fakeswitches; i++)
+        fprintf(report->fp, "%s%.1lf", i ? (report->format == REPORT_CSV ? " " : ",") : "", result->counts[i].down_ms);
+    fputc(report->format == REPORT_CSV ? '"' : ']', report->fp);
+}
+
+/***********************************************************************
+ * Flow table columns; in CSV empty without emulated flow tables
+ */
+static void report_flows(struct report * report, const struct flow_stats * flows)
+{
+    unsigned long packets;
+    double miss, convergence_avg;
+
+    if (flows == NULL)
+    {
+        if (report->format == REPORT_CSV)
+            fprintf(report->fp, ",,,,,,,,,,");
+        return;
+    }
+    packets = flows->forwarded + flows->missed;
+    miss = packets ? 100.0 * flows->missed / packets : 0;
+    convergence_avg = flows->converged ? flows->convergence_sum / 1e6 / flows->converged : 0;
+    if (report->format == REPORT_CSV)
+        fprintf(report->fp, ",%d,%lu,%lu,%lu,%lu,%lu,%.3lf,%lu,%.3lf,%.3lf", flows->entries,
+                flows->installed, flows->removed, flows->refused, flows->forwarded, flows->missed, miss,
+                flows->converged, convergence_avg, flows->convergence_max / 1e6);
+    else
+        fprintf(report->fp, ",\"flow_entries\":%d,\"flows_installed\":%lu,\"flows_removed\":%lu,"
+                "\"flow_mods_refused\":%lu,\"packets_forwarded\":%lu,\"packets_missed\":%lu,\"miss_percent\":%.3lf,"
+                "\"switches_converged\":%lu,\"convergence_avg_ms\":%.3lf,\"convergence_max_ms\":%.3lf",
+                flows->entries, flows->installed, flows->removed, flows->refused, flows->forwarded, flows->missed,
+                miss, flows->converged, convergence_avg, flows->convergence_max / 1e6);
+}
+
+/***********************************************************************
+ * Echo lane columns; in CSV empty without an echo lane
+ */
+static void report_echo(struct report * report, const struct test_result * result)
+{
+    const struct echo_stats * echo = result->echo;
+
+    if (echo == NULL)
+    {
+        if (report->format == REPORT_CSV)
+            fprintf(report->fp, ",,,,,,,,,,");
+        return;
+    }
+    if (report->format == REPORT_CSV)
+        fprintf(report->fp, ",%lu,%lu,%lu,", echo->sent, echo->answered, echo->lost);
+    else
+        fprintf(report->fp, ",\"echo_sent\":%lu,\"echo_answered\":%lu,\"echo_lost\":%lu,",
+                echo->sent, echo->answered, echo->lost);
+    report_latency(report, "echo_rtt", result->echo_hist);
+}
+
+/***********************************************************************
+ * The run parameters and the end of the record
+ */
+static void report_end(struct report * report)
+{
+    int i;
+    for (i = 0; i < report->n_params; i++)
+    {
+        if (report->format == REPORT_CSV)
+            fprintf(report->fp, ",");
+        else
+            fprintf(report->fp, ",\"%s\":", report->param_names[i]);
+        if (report->param_is_string[i])
+            report_write_string(report, report->param_values[i]);
+        else
+            fprintf(report->fp, "%s", report->param_values[i]);
+    }
+    fprintf(report->fp, report->format == REPORT_CSV ? "\n" : "}\n");
+}
+
+/***********************************************************************/
+static void report_csv_header(struct report * report)
+{
+    int i;
+    fprintf(report->fp, "record,timestamp,switches,test,ms,responses,requests,"
+            "responses_per_s,requests_per_s,min_per_s,max_per_s,avg_per_s,stdev_per_s,"
+            "rtt_samples,rtt_min_us,rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_p999_us,rtt_max_us,"
+            "syscalls,cpu_s,recv/send per switch,"
+            "jain,cv,switch_min_per_s,switch_median_per_s,switch_max_per_s,worst_switches,"
+            "window_min,window_avg,window_max,unmatched,duplicates,late,timed_out,messages,"
+            "mem_peak_avg_bytes,mem_peak_max_bytes,rings_peak_bytes,rings_refused,"
+            "role_changes,connections_lost,failovers,failover_avg_ms,failover_max_ms,switches_without_master,"
+            "reconnect_losses,reconnect_attempts,handshakes_redone,outage_avg_ms,outage_max_ms,"
+            "recovery_avg_ms,recovery_max_ms,switches_down,down_ms per switch,"
+            "flow_entries,flows_installed,flows_removed,flow_mods_refused,packets_forwarded,packets_missed,"
+            "miss_percent,switches_converged,convergence_avg_ms,convergence_max_ms,"
+            "echo_sent,echo_answered,echo_lost,echo_rtt_samples,echo_rtt_min_us,echo_rtt_p50_us,"
+            "echo_rtt_p90_us,echo_rtt_p99_us,echo_rtt_p999_us,echo_rtt_max_us");
+    for (i = 0; i < report->n_params; i++)
+        fprintf(report->fp, ",%s", report->param_names[i]);
+    fprintf(report->fp, "\n");
+}
+
+/***********************************************************************
+ * A quoted string, escaped for JSON or CSV
+ */
+static void report_write_string(struct report * report, const char * s)
+{
+    fputc('"', report->fp);
+    for (; *s; s++)
+    {
+        if (report->format == REPORT_CSV)
+        {
+            if (*s == '"')
+                fputc('"', report->fp);     // CSV doubles quotes
+            fputc(*s, report->fp);
+        }
+        else if (*s == '"' || *s == '\\')
+            fprintf(report->fp, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(report->fp, "\\u%04x", *s);
+        else
+            fputc(*s, report->fp);
+    }
+    fputc('"', report->fp);
+}
@@ -0,0 +1,99 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdio.h>
+
+#include "bufpool.h"
+#include "fairness.h"
+#include "histogram.h"
+#include "worker.h"
+
+#define REPORT_MAX_PARAMS   48
+#define REPORT_BUFSIZE      (1 << 20)   // records are flushed at the end of each run, or when this fills up
+
+enum report_format
+{
+    REPORT_JSONL, REPORT_CSV
+};
+
+/* Structured results: one record per test and one per run (switch count),
+ *  streamed to a file as JSON Lines or CSV.  Every record carries the
+ *  run parameters, so files from different runs can be concatenated.
+ *  In CSV, the test column of a run record holds the number of counted tests,
+ *  and its jain/cv columns the lowest index and highest cv of those tests.
+ */
+struct report
+{
+    FILE * fp;
+    enum report_format format;
+    char * buf;                         // stdio buffer of fp
+    int n_params;
+    const char * param_names[REPORT_MAX_PARAMS];
+    char * param_values[REPORT_MAX_PARAMS];
+    int param_is_string[REPORT_MAX_PARAMS];
+    int test;                           // number of the next test of the current run
+};
+
+/* what one test measured */
+struct test_result
+{
+    int n_fakeswitches;
+    const struct switch_counts * counts;    // n_fakeswitches entries
+    double ms;                          // length of the test
+    int responses, requests;            // summed over all switches
+    const struct histogram * rtt_hist;
+    unsigned long syscalls;
+    double cpu_time;                    // seconds, summed over the worker threads
+    const struct fairness * fairness;   // per-switch rate distribution
+    int window_min, window_max;         // probes allowed in flight at the end of the test; 0 = unbounded
+    double window_avg;
+    struct match_stats match;           // responses that matched no outstanding probe, probes never answered
+    const struct mix_counts * mix;      // per message type; NULL without a workload mix
+    double mem_peak_avg;                // most bytes a switch held at once, averaged over the switches
+    long mem_peak_max;                  // ... and of the switch that held the most
+    struct bufpool_stats pool;          // output rings of all switches
+    const struct failover_stats * failover; // mastership in a controller cluster; NULL without one
+    const struct reconnect_stats * reconnect;   // lost connections and how they came back; NULL without reconnects
+    const struct flow_stats * flows;    // emulated flow tables; NULL without them
+    const struct echo_stats * echo;     // echo lane requests; NULL without an echo lane
+    const struct histogram * echo_hist; // ... and their round trip times
+};
+
+/* what a whole run over one switch count measured */
+struct run_result
+{
+    int n_fakeswitches;
+    int counted_tests;                  // tests without warmup and cooldown
+    double min, max, avg, stdev;        // responses per second over the counted tests
+    int responses, requests;            // over all tests
+    const struct histogram * rtt_hist;  // counted tests only
+    double jain_min, cv_max;            // least fair counted test
+    double jain_avg;                    // mean fairness index of the counted tests
+};
+
+/*** Parse the name of a report format ("jsonl" or "csv")
+ * @return  The format, or -1 if the name is unknown
+ */
+int report_format_from_name(const char * name);
+
+/*** Open (and truncate) the output file
+ *  Exits if the file can't be opened
+ */
+void report_open(struct report * report, const char * path, enum report_format format);
+
+/*** Add a run parameter that goes into every record; add all of them before
+ *  the first record.  Adding a name again changes its value for later records.
+ */
+void report_param_int(struct report * report, const char * name, long value);
+void report_param_double(struct report * report, const char * name, double value);
+void report_param_string(struct report * report, const char * name, const char * value);
+
+/*** Write the record of one test */
+void report_test(struct report * report, const struct test_result * result);
+
+/*** Write the record of one run and flush the file */
+void report_run(struct report * report, const struct run_result * result);
+
+void report_close(struct report * report);
+
+#endif
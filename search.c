@@ -0,0 +1,56 @@
+#include <limits.h>
+
+#include "search.h"
+
+/**********************************************************************/
+void search_init(struct search * search, int start_rate, uint64_t slo_ns, double quantile, double min_ratio)
+{
+    search->slo_ns = slo_ns;
+    search->quantile = quantile;
+    search->min_ratio = min_ratio;
+    search->rate = start_rate > 0 ? start_rate : SEARCH_START_RATE;
+    search->passed = 0;
+    search->failed = 0;
+    search->steps = 0;
+    search->done = 0;
+}
+
+/**********************************************************************/
+int search_judge(struct search * search, const struct histogram * rtt_hist, double ratio)
+{
+    int met = rtt_hist->count > 0 && ratio >= search->min_ratio &&
+        histogram_quantile(rtt_hist, search->quantile) <= search->slo_ns;
+
+    if (met && search->rate > search->passed)
+        search->passed = search->rate;
+    if (!met && (search->failed == 0 || search->rate < search->failed))
+        search->failed = search->rate;
+    search->steps++;
+
+    if (search->failed == 0)
+    {
+        // ramp
+        if (search->rate > INT_MAX / 2)
+            search->done = 1;
+        else
+            search->rate *= 2;
+    }
+    else if (search->passed == 0)
+    {
+        // backoff
+        search->rate /= 2;
+        if (search->rate < 1)
+            search->done = 1;
+    }
+    else
+    {
+        // bisect
+        if (search->failed - search->passed <= 1 ||
+                search->failed - search->passed <= search->passed * SEARCH_PRECISION)
+            search->done = 1;
+        search->rate = search->passed + (search->failed - search->passed) / 2;
+    }
+    if (search->steps >= SEARCH_MAX_STEPS)
+        search->done = 1;
+    return met;
+}
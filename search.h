@@ -0,0 +1,44 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define SEARCH_START_RATE   1000        // first rate tried if none is given (packet_ins/s)
+#define SEARCH_PRECISION    0.02        // stop once the bracket is this close to the rate that passed
+#define SEARCH_MAX_STEPS    40
+
+/* Saturation search over the open-loop rate:
+ *  double the rate until a step misses the SLO (ramp), halve it until
+ *  one meets it (backoff), then bisect between the two.
+ */
+struct search
+{
+    uint64_t slo_ns;                    // tail latency limit
+    double quantile;                    // ... on this quantile of the round trip time, e.g. 0.99
+    double min_ratio;                   // answered/offered packet_ins must stay at or above this
+    int rate;                           // rate of the current step
+    int passed;                         // highest rate that met the SLO; 0 = none yet
+    int failed;                         // lowest rate that missed it; 0 = none yet
+    int steps;                          // steps judged so far
+    int done;
+};
+
+/*** Set up a search
+ * @param start_rate    First rate to try; <= 0 for SEARCH_START_RATE
+ * @param slo_ns        Tail latency limit
+ * @param quantile      Quantile the limit applies to, between 0 and 1
+ * @param min_ratio     Lowest acceptable answered/offered ratio, between 0 and 1
+ */
+void search_init(struct search * search, int start_rate, uint64_t slo_ns, double quantile, double min_ratio);
+
+/*** Judge the step run at search->rate and move on to the next rate
+ *  Sets search->done when the bracket is tight enough, or nothing passes
+ * @param rtt_hist  Round trip times of the step's counted tests
+ * @param ratio     Answered/offered packet_ins of those tests
+ * @return          1 if the step met the SLO, else 0
+ */
+int search_judge(struct search * search, const struct histogram * rtt_hist, double ratio);
+
+#endif
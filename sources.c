@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "sources.h"
+
+static int sources_parse_addr(const char * p, int len, uint32_t * addr);
+
+/***********************************************************************/
+int sources_parse_addrs(struct sources * sources, const char * spec)
+{
+    const char * p = spec;
+    uint32_t first, last, a;
+    int len, dash;
+
+    while (*p)
+    {
+        len = strcspn(p, ",");
+        dash = strcspn(p, "-");
+        if (dash < len)
+        {
+            if (sources_parse_addr(p, dash, &first) < 0 ||
+                    sources_parse_addr(p + dash + 1, len - dash - 1, &last) < 0)
+                return -1;
+        }
+        else if (sources_parse_addr(p, len, &first) < 0)
+            return -1;
+        else
+            last = first;
+        if (last < first || last - first >= SOURCES_MAX_ADDRS - sources->n_addrs)
+            return -1;
+        sources->addrs = realloc(sources->addrs, (sources->n_addrs + last - first + 1) * sizeof(struct in_addr));
+        assert(sources->addrs);
+        for (a = first; ; a++)
+        {
+            sources->addrs[sources->n_addrs++].s_addr = htonl(a);
+            if (a == last)
+                break;
+        }
+        p += len;
+        if (*p)
+            p++;
+    }
+    return sources->n_addrs > 0 ? 0 : -1;
+}
+
+/***********************************************************************/
+int sources_parse_ports(struct sources * sources, const char * spec)
+{
+    char * end;
+    long first, last;
+
+    first = strtol(spec, &end, 10);
+    last = first;
+    if (*end == '-')
+        last = strtol(end + 1, &end, 10);
+    if (*end || first < 1 || last < first || last > 65535)
+        return -1;
+    sources->port_min = first;
+    sources->port_max = last;
+    return 0;
+}
+
+/***********************************************************************/
+uint64_t sources_capacity(const struct sources * sources)
+{
+    if (sources->port_min == 0)
+        return 0;
+    return (uint64_t) (sources->n_addrs > 0 ? sources->n_addrs : 1) *
+        (sources->port_max - sources->port_min + 1);
+}
+
+/***********************************************************************/
+int sources_bind(struct sources * sources, int sock)
+{
+    struct sockaddr_in local;
+    uint64_t pairs, i, tries;
+    int n_addrs = sources->n_addrs > 0 ? sources->n_addrs : 1;
+    int one = 1;
+    int err = 0;
+
+    if (!sources_active(sources))
+        return 0;
+    // lets a run reuse the pairs a previous run left in TIME_WAIT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    // with the kernel picking the port, pick it at connect() from the
+    //  whole four-tuple, not at bind() from the address alone
+    if (sources->port_min == 0)
+        setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+    pairs = sources->port_min ? sources_capacity(sources) : (uint64_t) n_addrs;
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    for (tries = 0; tries < pairs; tries++)
+    {
+        i = __atomic_fetch_add(&sources->next, 1, __ATOMIC_RELAXED) % pairs;
+        local.sin_addr.s_addr = sources->n_addrs > 0 ? sources->addrs[i % n_addrs].s_addr : htonl(INADDR_ANY);
+        local.sin_port = htons(sources->port_min ? sources->port_min + i / n_addrs : 0);
+        if (bind(sock, (struct sockaddr *) &local, sizeof(local)) == 0)
+            return 0;
+        err = errno;
+        if (err != EADDRINUSE || sources->port_min == 0)
+            break;
+        __atomic_fetch_add(&sources->in_use, 1, __ATOMIC_RELAXED);
+    }
+    fprintf(stderr, "Error can't bind a connection to source %s:%d: %s%s\n",
+            inet_ntoa(local.sin_addr), ntohs(local.sin_port), strerror(err),
+            err == EADDRNOTAVAIL ? " (the address must be configured on this host, e.g. with ip addr add ... dev lo)" :
+            err == EADDRINUSE ? " (every source address and port pair is taken)" : "");
+    return -1;
+}
+
+/***********************************************************************
+ * One dotted quad of len characters
+ */
+static int sources_parse_addr(const char * p, int len, uint32_t * addr)
+{
+    char tmp[INET_ADDRSTRLEN];
+    struct in_addr in;
+
+    if (len <= 0 || len >= sizeof(tmp))
+        return -1;
+    memcpy(tmp, p, len);
+    tmp[len] = 0;
+    if (inet_pton(AF_INET, tmp, &in) != 1)
+        return -1;
+    *addr = ntohl(in.s_addr);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#define SOURCES_MAX_ADDRS   65536       // most local addresses a list or range may name
+
+/* Local addresses and ports the switches' connections come from
+ *  Against a single controller address and port, every connection
+ *  needs its own source address and port pair, so one source address
+ *  runs out at the size of the ephemeral port range (and a conntrack
+ *  table may give out even sooner).  Spreading the connections over
+ *  several local addresses (loopback aliases work on one host) and,
+ *  if wanted, an explicit port range lifts that limit.
+ *  Connections take the addresses round-robin; each address takes
+ *  the next port once all addresses had their turn.  Workers that
+ *  reconnect switches bind concurrently, so the counters are atomic.
+ */
+struct sources
+{
+    struct in_addr * addrs;             // network byte order; NULL = any address
+    int n_addrs;
+    int port_min;                       // 0 = the kernel picks the port
+    int port_max;
+    uint64_t next;                      // pairs handed out so far
+    unsigned long in_use;               // binds that found their pair taken and moved on
+};
+
+/*** Parse a list of local IPv4 addresses
+ * @param sources   Sources to add the addresses to
+ * @param spec      Comma separated addresses or first-last ranges,
+ *                  e.g. 127.0.0.1-127.0.0.8,10.0.0.5
+ * @return          0, or -1 if spec is malformed
+ */
+int sources_parse_addrs(struct sources * sources, const char * spec);
+
+/*** Parse the range of local ports
+ * @param spec      A port or a first-last range, e.g. 20000-59999
+ * @return          0, or -1 if spec is malformed
+ */
+int sources_parse_ports(struct sources * sources, const char * spec);
+
+/*** @return  Distinct address and port pairs; 0 if the kernel picks the ports */
+uint64_t sources_capacity(const struct sources * sources);
+
+/*** Bind an IPv4 socket to the next source address and port
+ *  A pair that is already in use is skipped.  Any other failure,
+ *  such as an address not configured on this host, is reported with
+ *  the address and port that were tried.
+ * @param sock      Socket, not yet connected
+ * @return          0 on success (or if there is nothing to bind), -1 on failure
+ */
+int sources_bind(struct sources * sources, int sock);
+
+/*** @return  1 if connections are bound to chosen addresses or ports */
+static inline int sources_active(const struct sources * sources)
+{
+    return sources->n_addrs > 0 || sources->port_min > 0;
+}
+
+#endif
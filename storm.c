@@ -0,0 +1,286 @@
+#include <assert.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "cbench.h"
+#include "histogram.h"
+#include "storm.h"
+
+#define STORM_MAX_EVENTS    256
+
+static void storm_poll(struct storm * storm, uint64_t until);
+static void storm_register(struct storm * storm, int i);
+static void storm_resolve(struct storm * storm, const char * hostname, int port);
+static int storm_count_not_ready(struct storm * storm);
+static void storm_print_step(struct storm * storm, FILE * out, const char * name, size_t step);
+
+/***********************************************************************/
+void storm_init(struct storm * storm, int max_switches, int rate, struct sources * sources)
+{
+    struct rlimit rl;
+
+    memset(storm, 0, sizeof(*storm));
+    storm->epfd = epoll_create1(0);
+    if (storm->epfd < 0)
+    {
+        perror("storm: epoll_create1");
+        exit(1);
+    }
+    storm->rate = rate;
+    storm->sources = sources;
+    storm->fakeswitches = malloc(max_switches * sizeof(struct fakeswitch *));
+    storm->generations = malloc(max_switches * sizeof(unsigned int));
+    assert(storm->fakeswitches && storm->generations);
+    storm->port = -1;
+
+    // one socket per switch, plus a few for everything else
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < max_switches + 64)
+    {
+        rl.rlim_cur = rl.rlim_max < max_switches + 64 ? rl.rlim_max : max_switches + 64;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < max_switches + 64)
+            fprintf(stderr, "storm: only %ld file descriptors allowed for %d switches\n",
+                    (long) rl.rlim_cur, max_switches);
+    }
+}
+
+/***********************************************************************/
+int storm_connect(struct storm * storm, const char * hostname, int port)
+{
+    int sock;
+
+    if (storm->rate > 0 && storm->n_started > 0)
+        storm_poll(storm, storm->first_start + (uint64_t) (storm->n_started * 1e9 / storm->rate));
+    storm_resolve(storm, hostname, port);
+
+    sock = socket(storm->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0)
+    {
+        perror("storm: socket");
+        exit(1);
+    }
+    if (sources_active(storm->sources) && storm->addr.ss_family != AF_INET)
+    {
+        fprintf(stderr, "Error source addresses and ports only work with an IPv4 controller address\n");
+        exit(1);
+    }
+    if (sources_bind(storm->sources, sock) < 0)
+        exit(1);
+    storm->last_start = now_ns();
+    if (storm->n_started++ == 0)
+        storm->first_start = storm->last_start;
+    if (connect(sock, (struct sockaddr *) &storm->addr, storm->addrlen) < 0 && errno != EINPROGRESS)
+    {
+        perror("storm: connect");
+        exit(1);
+    }
+    return sock;
+}
+
+/***********************************************************************/
+void storm_add(struct storm * storm, struct fakeswitch * fs)
+{
+    fs->handshake.connect_start = storm->last_start;
+    fs->paced = 1;      // no probes before the whole fleet is ready
+    storm->fakeswitches[storm->n_fakeswitches] = fs;
+    storm->generations[storm->n_fakeswitches] = fs->sock_generation - 1;     // not registered yet
+    storm_register(storm, storm->n_fakeswitches++);
+}
+
+/***********************************************************************
+ * Register the switch's socket unless it already is; a switch that
+ *  reconnected has a new one, and the closed one left the epoll set
+ *  by itself
+ */
+static void storm_register(struct storm * storm, int i)
+{
+    struct fakeswitch * fs = storm->fakeswitches[i];
+    struct epoll_event ev;
+
+    if (fs->sock < 0 || storm->generations[i] == fs->sock_generation)
+        return;
+    // the first EPOLLOUT edge means the connection is up and sends the HELLO
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u32 = i;
+    if (epoll_ctl(storm->epfd, EPOLL_CTL_ADD, fs->sock, &ev) < 0)
+    {
+        perror("storm: epoll_ctl");
+        exit(1);
+    }
+    storm->generations[i] = fs->sock_generation;
+}
+
+/***********************************************************************/
+int storm_finish(struct storm * storm, FILE * out)
+{
+    struct io_stats discard;
+    uint64_t deadline = storm->last_start + STORM_TIMEOUT_MS * 1000000ull;
+    uint64_t last_ready = storm->first_start;
+    uint64_t now;
+    int not_ready;
+    int i;
+
+    while ((not_ready = storm_count_not_ready(storm)) > 0 && (now = now_ns()) < deadline)
+        storm_poll(storm, now + 10000000 < deadline ? now + 10000000 : deadline);
+
+    for (i = 0; i < storm->n_fakeswitches; i++)
+    {
+        struct fakeswitch * fs = storm->fakeswitches[i];
+        if (fs->handshake.ready > last_ready)
+            last_ready = fs->handshake.ready;
+        fs->paced = 0;
+        fakeswitch_get_io_stats(fs, &discard);     // the tests count their own system calls
+    }
+    close(storm->epfd);     // the sockets stay open for the tests
+    free(storm->hostname);
+    free(storm->generations);
+    if (out == NULL)
+    {
+        free(storm->fakeswitches);
+        return not_ready;
+    }
+
+    fprintf(out, "STORM: %d switches connecting ", storm->n_fakeswitches);
+    if (storm->rate > 0)
+        fprintf(out, "at %d per second", storm->rate);
+    else
+        fprintf(out, "all at once");
+    fprintf(out, ": whole fleet ready after %.1lf ms", (last_ready - storm->first_start) / 1e6);
+    if (not_ready > 0)
+        fprintf(out, ", %d NOT ready after %d ms", not_ready, STORM_TIMEOUT_MS);
+    fprintf(out, "\n    time from connect() to ...\n");
+    storm_print_step(storm, out, "tcp connected", offsetof(struct handshake_times, connected));
+    storm_print_step(storm, out, "hello", offsetof(struct handshake_times, hello));
+    storm_print_step(storm, out, "features_request", offsetof(struct handshake_times, features_request));
+    storm_print_step(storm, out, "get_config_request", offsetof(struct handshake_times, get_config_request));
+    storm_print_step(storm, out, "ready_to_send", offsetof(struct handshake_times, ready));
+    free(storm->fakeswitches);
+    return not_ready;
+}
+
+/***********************************************************************
+ * Run the handshakes of all added switches until the given time
+ *  Switches waiting out their delay (or about to learn mac addresses)
+ *  get no socket events, so they are swept about once per ms; so are
+ *  switches without a socket, until they reconnect.
+ */
+static void storm_poll(struct storm * storm, uint64_t until)
+{
+    struct epoll_event events[STORM_MAX_EVENTS];
+    struct fakeswitch * fs;
+    uint64_t now, last_sweep = 0;
+    int sweep = 1;
+    int timeout;
+    int i, n;
+
+    while ((now = now_ns()) < until)
+    {
+        if (sweep && now - last_sweep >= 1000000)
+        {
+            sweep = 0;
+            last_sweep = now;
+            for (i = 0; i < storm->n_fakeswitches; i++)
+            {
+                fs = storm->fakeswitches[i];
+                if (fs->switch_status != WAITING && fs->switch_status != LEARN_DSTMAC &&
+                        !fakeswitch_reconnecting(fs))
+                    continue;
+                sweep = 1;
+                fakeswitch_handle_write(fs);
+                storm_register(storm, i);
+            }
+        }
+
+        timeout = (until - now) / 1000000;
+        if (sweep && timeout > 1)
+            timeout = 1;
+        n = epoll_wait(storm->epfd, events, STORM_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("storm: epoll_wait");
+            exit(1);
+        }
+        for (i = 0; i < n; i++)
+        {
+            fs = storm->fakeswitches[events[i].data.u32];
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                fakeswitch_handle_read(fs);
+            fakeswitch_handle_write(fs);
+            storm_register(storm, events[i].data.u32);
+            if (fs->switch_status == WAITING || fs->switch_status == LEARN_DSTMAC || fakeswitch_reconnecting(fs))
+                sweep = 1;
+        }
+    }
+}
+
+/***********************************************************************/
+static void storm_resolve(struct storm * storm, const char * hostname, int port)
+{
+    struct addrinfo hints;
+    struct addrinfo * res = NULL;
+    char sport[16];
+    int err;
+
+    if (storm->hostname && port == storm->port && !strcmp(hostname, storm->hostname))
+        return;     // same controller as last time
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    snprintf(sport, sizeof(sport), "%d", port);
+    err = getaddrinfo(hostname, sport, &hints, &res);
+    if (err || res == NULL)
+    {
+        fprintf(stderr, "storm: can't resolve %s: %s\n", hostname, gai_strerror(err));
+        exit(1);
+    }
+    memcpy(&storm->addr, res->ai_addr, res->ai_addrlen);
+    storm->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    free(storm->hostname);
+    storm->hostname = strdup(hostname);
+    storm->port = port;
+}
+
+/***********************************************************************/
+static int storm_count_not_ready(struct storm * storm)
+{
+    int i;
+    int not_ready = 0;
+    for (i = 0; i < storm->n_fakeswitches; i++)
+        if (storm->fakeswitches[i]->switch_status != READY_TO_SEND)
+            not_ready++;
+    return not_ready;
+}
+
+/***********************************************************************
+ * Print the distribution of one handshake step, measured from each
+ *  switch's connect(); switches that never got there are left out
+ */
+static void storm_print_step(struct storm * storm, FILE * out, const char * name, size_t step)
+{
+    struct histogram hist;
+    uint64_t t;
+    int i;
+
+    histogram_reset(&hist);
+    for (i = 0; i < storm->n_fakeswitches; i++)
+    {
+        struct handshake_times * times = &storm->fakeswitches[i]->handshake;
+        t = *(uint64_t *) ((char *) times + step);
+        if (t != 0)
+            histogram_record(&hist, t - times->connect_start);
+    }
+    fprintf(out, "      %-20s ", name);
+    histogram_print_latency(out, &hist);
+    fprintf(out, "\n");
+}
@@ -0,0 +1,65 @@
+#ifndef STORM_H
+#define STORM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sys/socket.h>
+
+#include "fakeswitch.h"
+#include "sources.h"
+
+#define STORM_TIMEOUT_MS    60000       // how long the fleet may take to become ready after the last connect()
+
+/* Connection storm: all switches connect concurrently, non-blocking,
+ *  at a fixed rate, and their handshakes run side by side in one
+ *  event loop until the whole fleet is READY_TO_SEND.
+ */
+struct storm
+{
+    int epfd;
+    int rate;                           // connect() calls per second; <= 0 for all at once
+    uint64_t first_start;               // when the first connect() was made
+    uint64_t last_start;                // when the latest connect() was made
+    int n_started;                      // connections opened so far
+    struct fakeswitch ** fakeswitches;  // every switch added so far
+    unsigned int * generations;         // sock_generation of each switch's registered socket
+    int n_fakeswitches;
+    char * hostname;                    // last address looked up, kept for the next connect()
+    int port;
+    struct sockaddr_storage addr;
+    int addrlen;
+    struct sources * sources;           // local addresses and ports to connect from
+};
+
+/*** Set up a storm
+ * Raises the open file limit if max_switches sockets wouldn't fit
+ * @param storm         Storm to initialize
+ * @param max_switches  Number of switches that will be added
+ * @param rate          connect() calls per second, <= 0 for all at once
+ * @param sources       Local addresses and ports the connections come from
+ */
+void storm_init(struct storm * storm, int max_switches, int rate, struct sources * sources);
+
+/*** Start a non-blocking connect() once the rate allows it
+ *  Until then, the handshakes of the switches already added make progress
+ * @return  The socket, connect() in progress
+ */
+int storm_connect(struct storm * storm, const char * hostname, int port);
+
+/*** Hand a switch initialized on the socket of the last storm_connect() to the storm
+ *  Its probes are held back until storm_finish()
+ */
+void storm_add(struct storm * storm, struct fakeswitch * fs);
+
+/*** Run the handshakes until every switch is READY_TO_SEND (or
+ *  STORM_TIMEOUT_MS passes) and print when each handshake step was
+ *  reached, relative to the switch's connect()
+ *  Switches set to reconnect that lose their connection meanwhile
+ *  reconnect and go through the handshake again.
+ * @param out   Where to print; NULL to print nothing
+ * @return      Number of switches that did not become ready
+ */
+int storm_finish(struct storm * storm, FILE * out);
+
+#endif
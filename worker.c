@@ -0,0 +1,557 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cbench.h"
+#include "worker.h"
+
+#define MIN(x,y)  (((x) < (y))? (x) : (y))
+
+#define EPOLL_MAX_EVENTS    256
+#define EPOLL_MAX_REFILLS   4       // write rounds per wakeup before yielding to other switches
+
+static const char * io_engine_names[] = { "poll", "epoll", "io_uring" };
+static const char * arrival_process_names[] = { "constant", "poisson", "trace" };
+
+static void * worker_main(void * arg);
+static void worker_poll_loop(struct worker * w);
+static void worker_epoll_loop(struct worker * w);
+static void worker_epoll_update(int epfd, struct worker * w, int i, uint32_t * armed, unsigned int * generations);
+static void worker_collect_counts(struct worker * w);
+static uint64_t worker_random(struct worker * w);
+static void worker_trace_next(struct worker * w, int stride);
+
+/***********************************************************************/
+int io_engine_from_name(const char * name)
+{
+    int i;
+    for (i = 0; i < sizeof(io_engine_names) / sizeof(io_engine_names[0]); i++)
+        if (!strcmp(name, io_engine_names[i]))
+            return i;
+    return -1;
+}
+
+/***********************************************************************/
+const char * io_engine_name(enum io_engine engine)
+{
+    return io_engine_names[engine];
+}
+
+/***********************************************************************/
+int io_engine_available(enum io_engine engine)
+{
+#ifndef HAVE_LIBURING
+    if (engine == ENGINE_URING)
+        return 0;
+#endif
+    return 1;
+}
+
+/***********************************************************************/
+int arrival_process_from_name(const char * name)
+{
+    int i;
+    for (i = 0; i < sizeof(arrival_process_names) / sizeof(arrival_process_names[0]); i++)
+        if (!strcmp(name, arrival_process_names[i]))
+            return i;
+    return -1;
+}
+
+/***********************************************************************/
+const char * arrival_process_name(enum arrival_process arrivals)
+{
+    return arrival_process_names[arrivals];
+}
+
+/***********************************************************************/
+void workers_init(struct worker * workers, int n_workers, enum io_engine engine)
+{
+    int i;
+    memset(workers, 0, n_workers * sizeof(struct worker));
+    for (i = 0; i < n_workers; i++)
+    {
+        workers[i].id = i;
+        workers[i].engine = engine;
+        workers[i].pace_rng = 0x9e3779b97f4a7c15ull * (i + 1);
+    }
+}
+
+/***********************************************************************/
+void workers_set_rate(struct worker * workers, int n_workers, int rate, enum arrival_process arrivals)
+{
+    int i;
+    for (i = 0; i < n_workers; i++)
+    {
+        workers[i].rate = rate;
+        workers[i].arrivals = arrivals;
+    }
+}
+
+/***********************************************************************/
+void workers_set_echo_rate(struct worker * workers, int n_workers, int rate)
+{
+    int i;
+    for (i = 0; i < n_workers; i++)
+        workers[i].echo_rate = rate;
+}
+
+/***********************************************************************/
+void workers_set_trace(struct worker * workers, int n_workers, const struct pcap_trace * trace)
+{
+    int i;
+    for (i = 0; i < n_workers; i++)
+        workers[i].trace = trace;
+}
+
+/***********************************************************************/
+int workers_run_test(struct worker * workers, int n_workers,
+        struct fakeswitch * fakeswitches, int n_fakeswitches,
+        struct switch_counts * counts, int total_wait)
+{
+    int i;
+    int err;
+    int first = 0;
+    // the connections of a switch to a controller cluster share its
+    //  mastership, so they stay in one shard
+    int group = fakeswitches[0].cluster ? fakeswitches[0].cluster->n_members : 1;
+    int n_groups = n_fakeswitches / group;
+
+    if (n_workers > n_groups)
+        n_workers = n_groups;
+    if (n_workers < 1)
+        n_workers = 1;
+
+    for (i = 0; i < n_workers; i++)
+    {
+        // contiguous shards; the first (n % n_workers) workers get one extra switch
+        int shard = group * (n_groups / n_workers + (i < n_groups % n_workers ? 1 : 0));
+        workers[i].fakeswitches = &fakeswitches[first];
+        workers[i].n_fakeswitches = shard;
+        workers[i].counts = &counts[first];
+        workers[i].total_wait = total_wait;
+        workers[i].recv_count = 0;
+        workers[i].send_count = 0;
+        histogram_reset(&workers[i].rtt_hist);
+        memset(&workers[i].io, 0, sizeof(workers[i].io));
+        memset(&workers[i].match, 0, sizeof(workers[i].match));
+        memset(&workers[i].mix, 0, sizeof(workers[i].mix));
+        memset(&workers[i].failover, 0, sizeof(workers[i].failover));
+        memset(&workers[i].reconnect, 0, sizeof(workers[i].reconnect));
+        memset(&workers[i].flows, 0, sizeof(workers[i].flows));
+        histogram_reset(&workers[i].echo_hist);
+        memset(&workers[i].echo, 0, sizeof(workers[i].echo));
+        workers[i].echo_switch = 0;
+        if (workers[i].echo_rate > 0)
+            workers[i].echo_interval = 1e9 / ((double) workers[i].echo_rate * shard);
+        workers[i].event_syscalls = 0;
+        workers[i].pace_skipped = 0;
+        workers[i].pace_switch = 0;
+        workers[i].window_increases = 0;
+        workers[i].window_decreases = 0;
+        // every switch of the test gets the same share of the rate
+        if (workers[i].rate > 0)
+            workers[i].pace_interval = 1e9 * n_fakeswitches / ((double) workers[i].rate * shard);
+        if (workers[i].rate > 0 && workers[i].arrivals == ARRIVAL_TRACE)
+        {
+            workers[i].pace_scale = pcap_trace_rate(workers[i].trace) / workers[i].rate;
+            workers[i].pace_stride = n_workers;
+        }
+        first += shard;
+    }
+
+    for (i = 1; i < n_workers; i++)
+    {
+        err = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        if (err)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    worker_main(&workers[0]);
+    for (i = 1; i < n_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    return n_workers;
+}
+
+/***********************************************************************/
+static void * worker_main(void * arg)
+{
+    struct worker * w = arg;
+    struct timespec start, end;
+    int i;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    for (i = 0; i < w->n_fakeswitches; i++)
+    {
+        w->fakeswitches[i].rtt_hist = &w->rtt_hist;
+        w->fakeswitches[i].echo_hist = &w->echo_hist;
+        w->fakeswitches[i].paced = w->rate > 0;
+    }
+    w->pace_next = now_ns();
+    w->echo_next = w->pace_next;
+    if (w->rate > 0 && w->arrivals == ARRIVAL_TRACE)
+    {
+        w->pace_start = w->pace_next;
+        w->pace_loop = 0;
+        w->pace_frame = 0;
+        worker_trace_next(w, w->id);    // the worker's first frame
+    }
+
+    switch (w->engine)
+    {
+        case ENGINE_EPOLL:
+            worker_epoll_loop(w);
+            break;
+#ifdef HAVE_LIBURING
+        case ENGINE_URING:
+            worker_uring_loop(w);
+            break;
+#endif
+        default:
+            worker_poll_loop(w);
+    }
+    worker_collect_counts(w);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    w->cpu_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return NULL;
+}
+
+/***********************************************************************/
+static void worker_poll_loop(struct worker * w)
+{
+    struct timeval now, then, diff;
+    struct pollfd * pollfds;
+    int reconnecting;
+    int i;
+
+    pollfds = malloc(w->n_fakeswitches * sizeof(struct pollfd));
+    assert(pollfds);
+    gettimeofday(&then, NULL);
+    while (1)
+    {
+        gettimeofday(&now, NULL);
+        timersub(&now, &then, &diff);
+        if ((1000 * diff.tv_sec + (float)diff.tv_usec/1000) > w->total_wait)
+            break;
+        // due probes go out through the POLLOUT handling below,
+        //  so they must be queued before the pollfds are set up
+        for (i = 0; i < PACE_MAX_BURST && worker_pace_next(w, now_ns()) >= 0; i++)
+            ;
+        for (i = 0; i < PACE_MAX_BURST && worker_echo_next(w, now_ns()) >= 0; i++)
+            ;
+        reconnecting = 0;
+        for (i = 0; i < w->n_fakeswitches; i++)
+        {
+            fakeswitch_set_pollfd(&w->fakeswitches[i], &pollfds[i]);
+            reconnecting |= fakeswitch_reconnecting(&w->fakeswitches[i]);
+        }
+
+        // block until something is ready, 1s passes or the next arrival or echo is due;
+        //  switches without a socket get looked at every ms for their reconnect
+        poll(pollfds, w->n_fakeswitches, MIN(MIN(reconnecting ? 1 : 1000, worker_pace_wait(w, now_ns()) / 1000000),
+                    worker_echo_wait(w, now_ns()) / 1000000));
+        w->event_syscalls++;
+
+        for (i = 0; i < w->n_fakeswitches; i++)
+            fakeswitch_handle_io(&w->fakeswitches[i], &pollfds[i]);
+    }
+    free(pollfds);
+}
+
+/***********************************************************************
+ * Edge-triggered epoll: sockets stay registered for EPOLLIN for the whole
+ *  test and EPOLLOUT is only armed while a switch has something to write,
+ *  so a wakeup costs O(active sockets) instead of O(switches).
+ *  Switches that are still in the handshake or waiting out their delay
+ *  are swept about once per ms, since no socket event will move them on.
+ *  The same sweep reconnects switches that lost their connection; the
+ *  new socket is registered when its generation differs from the one
+ *  registered, as a closed socket drops out of the epoll set by itself.
+ */
+static void worker_epoll_loop(struct worker * w)
+{
+    struct timeval now, then, diff, last_sweep;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    struct epoll_event ev;
+    uint32_t * armed;
+    unsigned int * generations;
+    int epfd;
+    int i, n;
+    int sweep = 1;
+    int timeout;
+    double elapsed;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+    {
+        perror("epoll_create1");
+        exit(1);
+    }
+    armed = calloc(w->n_fakeswitches, sizeof(uint32_t));
+    generations = calloc(w->n_fakeswitches, sizeof(unsigned int));
+    assert(armed && generations);
+    for (i = 0; i < w->n_fakeswitches; i++)
+    {
+        generations[i] = w->fakeswitches[i].sock_generation;
+        if (w->fakeswitches[i].sock < 0)
+        {
+            generations[i]--;           // down since the last test: registered once it reconnects
+            continue;
+        }
+        ev.events = EPOLLIN | EPOLLET;
+        if (fakeswitch_want_write(&w->fakeswitches[i]))
+            ev.events |= EPOLLOUT;
+        ev.data.u32 = i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, w->fakeswitches[i].sock, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            exit(1);
+        }
+        armed[i] = ev.events;
+    }
+
+    gettimeofday(&then, NULL);
+    last_sweep = then;
+    while (1)
+    {
+        gettimeofday(&now, NULL);
+        timersub(&now, &then, &diff);
+        elapsed = 1000 * diff.tv_sec + (double)diff.tv_usec/1000;
+        if (elapsed > w->total_wait)
+            break;
+
+        timersub(&now, &last_sweep, &diff);
+        if (sweep && (diff.tv_sec > 0 || diff.tv_usec >= 1000))
+        {
+            sweep = 0;
+            last_sweep = now;
+            for (i = 0; i < w->n_fakeswitches; i++)
+            {
+                struct fakeswitch * fs = &w->fakeswitches[i];
+                if (fs->switch_status == READY_TO_SEND)
+                    continue;
+                sweep = 1;
+                fakeswitch_handle_write(fs);
+                worker_epoll_update(epfd, w, i, armed, generations);
+            }
+        }
+
+        for (i = 0; i < PACE_MAX_BURST && (n = worker_pace_next(w, now_ns())) >= 0; i++)
+        {
+            fakeswitch_handle_write(&w->fakeswitches[n]);
+            worker_epoll_update(epfd, w, n, armed, generations);
+        }
+        for (i = 0; i < PACE_MAX_BURST && (n = worker_echo_next(w, now_ns())) >= 0; i++)
+        {
+            fakeswitch_handle_write(&w->fakeswitches[n]);
+            worker_epoll_update(epfd, w, n, armed, generations);
+        }
+
+        timeout = sweep ? 1 : (int)(w->total_wait - elapsed) + 1;
+        // sub-ms waits round down to 0: spinning is cheaper than sending late
+        timeout = MIN(timeout, worker_pace_wait(w, now_ns()) / 1000000);
+        timeout = MIN(timeout, worker_echo_wait(w, now_ns()) / 1000000);
+        n = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, timeout);
+        w->event_syscalls++;
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            exit(1);
+        }
+        for (i = 0; i < n; i++)
+        {
+            int idx = events[i].data.u32;
+            struct fakeswitch * fs = &w->fakeswitches[idx];
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                fakeswitch_handle_read(fs);
+            // a response may have freed a probe slot, so always try to write
+            fakeswitch_handle_write(fs);
+            worker_epoll_update(epfd, w, idx, armed, generations);
+            if (fs->switch_status != READY_TO_SEND)
+                sweep = 1;
+        }
+    }
+    close(epfd);
+    free(armed);
+    free(generations);
+}
+
+/***********************************************************************/
+static void worker_epoll_update(int epfd, struct worker * w, int i, uint32_t * armed, unsigned int * generations)
+{
+    struct fakeswitch * fs = &w->fakeswitches[i];
+    struct epoll_event ev;
+    int refills = 0;
+    int op = EPOLL_CTL_MOD;
+
+    if (fs->sock < 0)
+        return;
+    if (generations[i] != fs->sock_generation)
+    {
+        op = EPOLL_CTL_ADD;
+        generations[i] = fs->sock_generation;
+        armed[i] = 0;
+    }
+
+    // the socket swallowed everything; queue more while it keeps up
+    while (fakeswitch_count_buffered(fs) == 0 && fakeswitch_want_write(fs) &&
+            refills++ < EPOLL_MAX_REFILLS)
+        fakeswitch_handle_write(fs);
+
+    ev.events = EPOLLIN | EPOLLET;
+    if (fakeswitch_want_write(fs))
+        ev.events |= EPOLLOUT;
+    // re-arming with an empty buffer re-reports a still-writable socket,
+    //  otherwise no new edge would ever arrive for it
+    if (ev.events == armed[i] && !((ev.events & EPOLLOUT) && fakeswitch_count_buffered(fs) == 0))
+        return;
+    ev.data.u32 = i;
+    if (epoll_ctl(epfd, op, fs->sock, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        exit(1);
+    }
+    w->event_syscalls++;
+    armed[i] = ev.events;
+}
+
+/***********************************************************************/
+int worker_pace_next(struct worker * w, uint64_t now)
+{
+    uint64_t scheduled;
+    double u;
+    int i;
+
+    while (w->rate > 0 && w->pace_next <= now)
+    {
+        scheduled = w->pace_next;
+        if (w->arrivals == ARRIVAL_POISSON)
+        {
+            // exponential gaps, each arrival to a random switch: every
+            //  switch sees a Poisson process of its share of the rate
+            u = (worker_random(w) >> 11) * (1.0 / 9007199254740992.0);
+            w->pace_next += (uint64_t) (-log(1.0 - u) * w->pace_interval);
+            i = worker_random(w) % w->n_fakeswitches;
+        }
+        else if (w->arrivals == ARRIVAL_TRACE)
+        {
+            i = w->pace_switch;
+            w->pace_switch = (w->pace_switch + 1) % w->n_fakeswitches;
+            w->fakeswitches[i].trace_pos = w->pace_frame;   // the frame goes with its time
+            worker_trace_next(w, w->pace_stride);
+        }
+        else
+        {
+            w->pace_next = scheduled + (uint64_t) (w->pace_interval + 0.5);
+            i = w->pace_switch;
+            w->pace_switch = (w->pace_switch + 1) % w->n_fakeswitches;
+        }
+        if (fakeswitch_queue_probe(&w->fakeswitches[i], scheduled))
+            return i;
+        w->pace_skipped++;
+    }
+    return -1;
+}
+
+/***********************************************************************/
+int worker_echo_next(struct worker * w, uint64_t now)
+{
+    int i;
+
+    if (w->echo_rate <= 0 || w->echo_next > now)
+        return -1;
+    // after a stall, every connection gets one request, not all it missed
+    if (now - w->echo_next > w->echo_interval * w->n_fakeswitches)
+        w->echo_next = now - (uint64_t) (w->echo_interval * (w->n_fakeswitches - 1));
+    while (w->echo_next <= now)
+    {
+        w->echo_next += (uint64_t) (w->echo_interval + 0.5);
+        i = w->echo_switch;
+        w->echo_switch = (w->echo_switch + 1) % w->n_fakeswitches;
+        if (fakeswitch_send_echo(&w->fakeswitches[i], now))
+            return i;
+    }
+    return -1;
+}
+
+/***********************************************************************/
+uint64_t worker_echo_wait(struct worker * w, uint64_t now)
+{
+    if (w->echo_rate <= 0)
+        return UINT64_MAX;
+    return w->echo_next > now ? w->echo_next - now : 0;
+}
+
+/***********************************************************************
+ * Move stride frames on in the capture and schedule that frame at its
+ *  captured time; each pass over the capture follows the last one
+ */
+static void worker_trace_next(struct worker * w, int stride)
+{
+    w->pace_frame += stride;
+    while (w->pace_frame >= w->trace->n_frames)
+    {
+        w->pace_frame -= w->trace->n_frames;
+        w->pace_loop += pcap_trace_loop_ns(w->trace);
+    }
+    w->pace_next = w->pace_start +
+        (uint64_t) ((w->pace_loop + w->trace->frames[w->pace_frame].time_ns) * w->pace_scale);
+}
+
+/***********************************************************************/
+uint64_t worker_pace_wait(struct worker * w, uint64_t now)
+{
+    if (w->rate <= 0)
+        return UINT64_MAX;
+    return w->pace_next > now ? w->pace_next - now : 0;
+}
+
+/***********************************************************************/
+static uint64_t worker_random(struct worker * w)
+{
+    // xorshift64*
+    w->pace_rng ^= w->pace_rng >> 12;
+    w->pace_rng ^= w->pace_rng << 25;
+    w->pace_rng ^= w->pace_rng >> 27;
+    return w->pace_rng * 0x2545f4914f6cdd1dull;
+}
+
+/***********************************************************************/
+static void worker_collect_counts(struct worker * w)
+{
+    struct reconnect_stats reconnect;
+    int i;
+
+    for (i = 0; i < w->n_fakeswitches; i++)
+    {
+        w->counts[i].id = w->fakeswitches[i].id;
+        w->counts[i].recv_count = fakeswitch_get_recv_count(&w->fakeswitches[i]);
+        w->counts[i].send_count = fakeswitch_get_send_count(&w->fakeswitches[i]);
+        w->counts[i].window = fakeswitch_get_window(&w->fakeswitches[i],
+                &w->window_increases, &w->window_decreases);
+        w->counts[i].mem_peak = fakeswitch_get_mem_peak(&w->fakeswitches[i]);
+        w->recv_count += w->counts[i].recv_count;
+        w->send_count += w->counts[i].send_count;
+        fakeswitch_get_io_stats(&w->fakeswitches[i], &w->io);
+        fakeswitch_get_match_stats(&w->fakeswitches[i], &w->match);
+        fakeswitch_get_mix_counts(&w->fakeswitches[i], &w->mix);
+        fakeswitch_get_failover_stats(&w->fakeswitches[i], &w->failover);
+        fakeswitch_get_flow_stats(&w->fakeswitches[i], &w->flows);
+        fakeswitch_get_echo_stats(&w->fakeswitches[i], &w->echo);
+        memset(&reconnect, 0, sizeof(reconnect));
+        fakeswitch_get_reconnect_stats(&w->fakeswitches[i], &reconnect);
+        w->counts[i].down_ms = reconnect.downtime / 1e6;
+        reconnect_stats_add(&w->reconnect, &reconnect);
+    }
+}
@@ -0,0 +1,187 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <sys/time.h>
+
+#include "fakeswitch.h"
+#include "histogram.h"
+#include "pcap.h"
+
+enum io_engine
+{
+    ENGINE_POLL, ENGINE_EPOLL, ENGINE_URING
+};
+
+/* how open-loop arrivals are spaced */
+enum arrival_process
+{
+    ARRIVAL_CONSTANT, ARRIVAL_POISSON,
+    ARRIVAL_TRACE                       // the captured inter-arrival times of a pcap file
+};
+
+#define PACE_MAX_BURST  256     // overdue arrivals queued per pass before the loop looks at the sockets again
+
+/* responses/requests of one switch during one test */
+struct switch_counts
+{
+    int id;                             // the switch's DPID
+    int recv_count;
+    int send_count;
+    int window;                         // probes allowed in flight at the end of the test; 0 = unbounded
+    long mem_peak;                      // most bytes the switch held at once
+    double down_ms;                     // time without a connection to the controller
+};
+
+struct worker
+{
+    int id;                             // worker number
+    pthread_t thread;
+    enum io_engine engine;              // which event loop drives the shard
+    struct fakeswitch * fakeswitches;   // first switch of this worker's shard
+    int n_fakeswitches;                 // number of switches in the shard
+    struct switch_counts * counts;      // per-switch results of the shard, filled after each test
+    int total_wait;                     // how long the event loop runs (in ms)
+    int recv_count;                     // responses received by the whole shard in the last test
+    int send_count;                     // requests sent by the whole shard in the last test
+    struct histogram rtt_hist;          // round trip times seen by the shard in the last test
+    struct io_stats io;                 // socket system calls of the shard in the last test
+    struct match_stats match;           // stray responses and timed out probes of the shard in the last test
+    struct mix_counts mix;              // messages of each workload type sent and answered in the last test
+    struct failover_stats failover;     // mastership of the shard's switches in a controller cluster
+    struct reconnect_stats reconnect;   // lost connections of the shard and how they came back
+    struct flow_stats flows;            // emulated flow tables of the shard's switches
+    unsigned long event_syscalls;       // poll/epoll/io_uring_enter calls in the last test
+    double cpu_time;                    // seconds of CPU the worker thread used in the last test
+    unsigned long window_increases;     // AIMD window steps of the shard in the last test
+    unsigned long window_decreases;
+    int rate;                           // packet_ins per second offered by all switches; 0 = closed loop
+    enum arrival_process arrivals;      // spacing of the open-loop arrivals
+    double pace_interval;               // mean ns between arrivals in this shard
+    uint64_t pace_next;                 // scheduled time of the next arrival (ns)
+    int pace_switch;                    // next switch of the constant-rate round robin
+    uint64_t pace_rng;                  // xorshift state for Poisson arrivals
+    const struct pcap_trace * trace;    // frames and arrival times for trace arrivals
+    double pace_scale;                  // trace arrivals: ns of replay per ns of capture
+    uint64_t pace_start;                // trace arrivals: when the replay started
+    uint64_t pace_loop;                 // trace arrivals: capture time at which the current pass began
+    int pace_frame;                     // trace arrivals: frame of the next arrival
+    int pace_stride;                    // trace arrivals: workers taking turns on the frames
+    unsigned long pace_skipped;         // arrivals dropped in the last test: switch not ready, out of sends or full
+    int echo_rate;                      // echo lane requests per second on each connection; 0 = no echo lane
+    double echo_interval;               // ns between two echo lane requests of the shard
+    uint64_t echo_next;                 // when the next one is due (ns)
+    int echo_switch;                    // connection it goes out on, round robin
+    struct histogram echo_hist;         // echo lane round trip times of the shard in the last test
+    struct echo_stats echo;             // echo lane requests of the shard in the last test
+};
+
+/*** Parse the name of an I/O engine ("poll", "epoll" or "io_uring")
+ * @return  The engine, or -1 if the name is unknown
+ */
+int io_engine_from_name(const char * name);
+
+/*** @return  The printable name of an I/O engine */
+const char * io_engine_name(enum io_engine engine);
+
+/*** @return  1 if the engine was compiled in, else 0 */
+int io_engine_available(enum io_engine engine);
+
+/*** Parse the name of an arrival process ("constant" or "poisson")
+ * @return  The process, or -1 if the name is unknown
+ */
+int arrival_process_from_name(const char * name);
+
+/*** @return  The printable name of an arrival process */
+const char * arrival_process_name(enum arrival_process arrivals);
+
+#ifdef HAVE_LIBURING
+/*** Event loop of the io_uring engine, see worker_uring.c */
+void worker_uring_loop(struct worker * w);
+#endif
+
+/*** Set up the parts of the workers that stay the same for every test
+ * @param workers   Array of n_workers workers
+ * @param engine    Event loop used by all workers
+ */
+void workers_init(struct worker * workers, int n_workers, enum io_engine engine);
+
+/*** Switch the workers to open-loop load generation
+ * Instead of waiting for responses (latency mode) or keeping the
+ *  output buffer full (throughput mode), probes are sent on a fixed
+ *  schedule, spread evenly over the switches of a test.
+ * @param workers   Array of n_workers workers
+ * @param rate      Packet_ins per second offered by all switches together; 0 = closed loop
+ * @param arrivals  Constant or Poisson (exponential) inter-arrival times
+ */
+void workers_set_rate(struct worker * workers, int n_workers, int rate, enum arrival_process arrivals);
+
+/*** Run an echo lane next to the probes, see fakeswitch_send_echo()
+ *  Every connection sends rate ECHO_REQUESTs per second, whatever the
+ *  test mode; a worker takes its connections in turn.
+ * @param workers   Array of n_workers workers
+ * @param rate      Echo requests per second on each connection; 0 = no echo lane
+ */
+void workers_set_echo_rate(struct worker * workers, int n_workers, int rate);
+
+/*** Give the workers the capture that trace arrivals replay
+ *  Frame k of the capture is sent by worker k % n_workers at its captured
+ *  time, sped up or slowed down so all workers together offer the rate
+ *  set with workers_set_rate(); the replay starts over when it runs out.
+ * @param workers   Array of n_workers workers
+ * @param trace     The capture; must stay around as long as the workers
+ */
+void workers_set_trace(struct worker * workers, int n_workers, const struct pcap_trace * trace);
+
+/*** Queue the next overdue open-loop arrival
+ *  Engines call this until it returns -1 and then flush the switches it named.
+ * @param w     Worker running the test
+ * @param now   Current time (from now_ns())
+ * @return      Index of the switch in the shard that got a probe,
+ *              or -1 if no arrival is due (or the worker is closed loop)
+ */
+int worker_pace_next(struct worker * w, uint64_t now);
+
+/*** How long an engine may sleep without missing an arrival
+ * @param w     Worker running the test
+ * @param now   Current time (from now_ns())
+ * @return      ns until the next arrival, UINT64_MAX if closed loop
+ */
+uint64_t worker_pace_wait(struct worker * w, uint64_t now);
+
+/*** Queue the next overdue echo lane request
+ *  Engines call this until it returns -1 and then flush the switches it named.
+ * @param w     Worker running the test
+ * @param now   Current time (from now_ns())
+ * @return      Index of the switch in the shard that got a request,
+ *              or -1 if none is due (or there is no echo lane)
+ */
+int worker_echo_next(struct worker * w, uint64_t now);
+
+/*** How long an engine may sleep without delaying an echo lane request
+ * @return      ns until the next one, UINT64_MAX without an echo lane
+ */
+uint64_t worker_echo_wait(struct worker * w, uint64_t now);
+
+/*** Run one test with the switches split across worker threads
+ * Switches are sharded in contiguous blocks, one block per worker;
+ *  every worker runs its own event loop over its shard for total_wait ms
+ *  and then collects (and resets) the per-switch counters of its shard.
+ *  Round trip times go to each worker's rtt_hist, those of the echo
+ *  lane to its echo_hist.
+ *  Worker 0 runs on the calling thread.
+ * @param workers           Array of at least n_workers workers
+ * @param n_workers         Number of threads to use (clamped to n_fakeswitches)
+ * @param fakeswitches      All initialized fakeswitches
+ * @param n_fakeswitches    Number of switches taking part in this test
+ * @param counts            Array of n_fakeswitches results, filled on return
+ * @param total_wait        Length of the test (in ms)
+ * @return                  Number of workers actually used
+ */
+int workers_run_test(struct worker * workers, int n_workers,
+        struct fakeswitch * fakeswitches, int n_fakeswitches,
+        struct switch_counts * counts, int total_wait);
+
+#endif
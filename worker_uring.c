@@ -0,0 +1,357 @@
+#ifdef HAVE_LIBURING
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <liburing.h>
+
+#include "cbench.h"
+#include "worker.h"
+
+#define URING_ENTRIES       4096        // submission queue entries per worker
+#define URING_RECV_BUFS     1024        // provided receive buffers per worker; power of 2
+#define URING_RECV_BUFSIZE  4096
+#define URING_BGID          0           // buffer group of the receive buffers
+#define URING_SEND_CHUNK    16384       // output goes out as linked sends of at most this size
+#define URING_DRAIN_MS      5000        // how long to wait for in-flight operations after a test
+
+enum uring_op
+{
+    URING_RECV = 1, URING_SEND, URING_CANCEL
+};
+
+#define URING_DATA(i, op)   (((uint64_t) (i) << 8) | (op))
+#define URING_INDEX(data)   ((int) ((data) >> 8))
+#define URING_OP(data)      ((int) ((data) & 0xff))
+
+/* per-switch engine state */
+struct uring_conn
+{
+    struct msgbuf * sending;            // output taken from the switch while it is sent
+    int sends;                          // linked sends from it still in flight
+    int recv_armed;                     // is a multishot receive in flight?
+};
+
+struct uring_ctx
+{
+    struct io_uring ring;
+    struct io_uring_buf_ring * br;
+    char * bufs;                        // URING_RECV_BUFS receive buffers
+    struct uring_conn * conns;
+    struct worker * w;
+    int inflight;                       // operations whose last completion hasn't arrived
+    int stopping;                       // test is over: don't start new work
+    int sweep;                          // some switch is not READY_TO_SEND yet
+};
+
+static struct io_uring_sqe * uring_get_sqe(struct uring_ctx * ctx);
+static void uring_arm_recv(struct uring_ctx * ctx, int i);
+static void uring_flush(struct uring_ctx * ctx, int i);
+static void uring_complete(struct uring_ctx * ctx, struct io_uring_cqe * cqe);
+static void uring_reap(struct uring_ctx * ctx);
+static void uring_stop(struct uring_ctx * ctx);
+static void uring_set_nonblock(struct worker * w, int on);
+
+/***********************************************************************
+ * io_uring: every switch keeps a multishot receive (into a ring of
+ *  provided buffers) in flight for the whole test, and its output is
+ *  handed to the kernel as a chain of linked sends, so one
+ *  io_uring_enter() covers both directions of many sockets.
+ *  Received bytes and send completions feed the same fakeswitch state
+ *  machine the poll and epoll engines use.
+ */
+void worker_uring_loop(struct worker * w)
+{
+    struct uring_ctx ctx;
+    struct io_uring_cqe * cqe;
+    struct __kernel_timespec ts;
+    struct timeval now, then, diff, last_sweep;
+    double elapsed;
+    uint64_t wait;
+    int ret;
+    int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.w = w;
+    ctx.sweep = 1;
+    ret = io_uring_queue_init(URING_ENTRIES, &ctx.ring, 0);
+    if (ret < 0)
+    {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+        exit(1);
+    }
+    ctx.br = io_uring_setup_buf_ring(&ctx.ring, URING_RECV_BUFS, URING_BGID, 0, &ret);
+    if (ctx.br == NULL)
+    {
+        fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-ret));
+        exit(1);
+    }
+    ctx.bufs = malloc(URING_RECV_BUFS * URING_RECV_BUFSIZE);
+    assert(ctx.bufs);
+    for (i = 0; i < URING_RECV_BUFS; i++)
+        io_uring_buf_ring_add(ctx.br, ctx.bufs + i * URING_RECV_BUFSIZE, URING_RECV_BUFSIZE, i,
+                io_uring_buf_ring_mask(URING_RECV_BUFS), i);
+    io_uring_buf_ring_advance(ctx.br, URING_RECV_BUFS);
+    ctx.conns = calloc(w->n_fakeswitches, sizeof(struct uring_conn));
+    assert(ctx.conns);
+
+    // the kernel does the waiting; don't let it bounce EAGAIN back to us
+    uring_set_nonblock(w, 0);
+    for (i = 0; i < w->n_fakeswitches; i++)
+    {
+        uring_arm_recv(&ctx, i);
+        uring_flush(&ctx, i);
+    }
+
+    gettimeofday(&then, NULL);
+    last_sweep = then;
+    while (1)
+    {
+        gettimeofday(&now, NULL);
+        timersub(&now, &then, &diff);
+        elapsed = 1000 * diff.tv_sec + (double)diff.tv_usec/1000;
+        if (elapsed > w->total_wait)
+            break;
+
+        timersub(&now, &last_sweep, &diff);
+        if (ctx.sweep && (diff.tv_sec > 0 || diff.tv_usec >= 1000))
+        {
+            // switches in the handshake or waiting out their delay
+            ctx.sweep = 0;
+            last_sweep = now;
+            for (i = 0; i < w->n_fakeswitches; i++)
+            {
+                if (w->fakeswitches[i].switch_status == READY_TO_SEND)
+                    continue;
+                ctx.sweep = 1;
+                fakeswitch_queue_output(&w->fakeswitches[i]);
+                uring_flush(&ctx, i);
+            }
+        }
+
+        for (i = 0; i < PACE_MAX_BURST && (ret = worker_pace_next(w, now_ns())) >= 0; i++)
+            uring_flush(&ctx, ret);
+        for (i = 0; i < PACE_MAX_BURST && (ret = worker_echo_next(w, now_ns())) >= 0; i++)
+            uring_flush(&ctx, ret);
+
+        wait = 1000000;
+        if (!ctx.sweep)
+            wait = ((uint64_t) (w->total_wait - elapsed) + 1) * 1000000;
+        if (worker_pace_wait(w, now_ns()) < wait)
+            wait = worker_pace_wait(w, now_ns());
+        if (worker_echo_wait(w, now_ns()) < wait)
+            wait = worker_echo_wait(w, now_ns());
+        ts.tv_sec = wait / 1000000000;
+        ts.tv_nsec = wait % 1000000000;
+        ret = io_uring_submit_and_wait_timeout(&ctx.ring, &cqe, 1, &ts, NULL);
+        w->event_syscalls++;
+        if (ret < 0 && ret != -ETIME && ret != -EINTR)
+        {
+            fprintf(stderr, "io_uring_submit_and_wait_timeout: %s\n", strerror(-ret));
+            exit(1);
+        }
+        uring_reap(&ctx);
+    }
+    uring_stop(&ctx);
+}
+
+/***********************************************************************/
+static struct io_uring_sqe * uring_get_sqe(struct uring_ctx * ctx)
+{
+    struct io_uring_sqe * sqe;
+    while ((sqe = io_uring_get_sqe(&ctx->ring)) == NULL)
+    {
+        io_uring_submit(&ctx->ring);    // submission queue full
+        ctx->w->event_syscalls++;
+    }
+    return sqe;
+}
+
+/***********************************************************************/
+static void uring_arm_recv(struct uring_ctx * ctx, int i)
+{
+    struct io_uring_sqe * sqe = uring_get_sqe(ctx);
+    io_uring_prep_recv_multishot(sqe, ctx->w->fakeswitches[i].sock, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    io_uring_sqe_set_data64(sqe, URING_DATA(i, URING_RECV));
+    ctx->conns[i].recv_armed = 1;
+    ctx->inflight++;
+}
+
+/***********************************************************************
+ * Start sending switch i's output unless a send chain is still running.
+ *  The switch's outbuf is taken from it, so the switch can keep queueing
+ *  into a new one while the kernel reads the old one; nothing is copied.
+ */
+static void uring_flush(struct uring_ctx * ctx, int i)
+{
+    struct fakeswitch * fs = &ctx->w->fakeswitches[i];
+    struct uring_conn * conn = &ctx->conns[i];
+    struct io_uring_sqe * sqe;
+    int off, len;
+
+    if (conn->sends > 0 || ctx->stopping)
+        return;
+    if (conn->sending != NULL && msgbuf_count_buffered(conn->sending) == 0)
+    {
+        fakeswitch_sent_output(fs, conn->sending);     // all sent: back to the pool
+        conn->sending = NULL;
+    }
+    if (conn->sending == NULL)
+    {
+        // nothing left over from a broken chain: take the switch's output
+        if (fakeswitch_count_buffered(fs) == 0)
+            return;
+        conn->sending = fakeswitch_take_output(fs);
+    }
+    for (off = conn->sending->start; off < conn->sending->end; off += len)
+    {
+        len = conn->sending->end - off;
+        if (len > URING_SEND_CHUNK)
+            len = URING_SEND_CHUNK;
+        sqe = uring_get_sqe(ctx);
+        io_uring_prep_send(sqe, fs->sock, &conn->sending->buf[off], len, MSG_WAITALL);
+        if (off + len < conn->sending->end)
+            sqe->flags |= IOSQE_IO_LINK;    // keep the chunks in stream order
+        io_uring_sqe_set_data64(sqe, URING_DATA(i, URING_SEND));
+        conn->sends++;
+        ctx->inflight++;
+    }
+}
+
+/***********************************************************************/
+static void uring_complete(struct uring_ctx * ctx, struct io_uring_cqe * cqe)
+{
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    int i = URING_INDEX(data);
+    struct fakeswitch * fs = &ctx->w->fakeswitches[i];
+    struct uring_conn * conn = &ctx->conns[i];
+    int bid;
+
+    switch (URING_OP(data))
+    {
+        case URING_RECV:
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+            {
+                bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                if (cqe->res > 0)
+                    fakeswitch_handle_input(fs, ctx->bufs + bid * URING_RECV_BUFSIZE, cqe->res);
+                io_uring_buf_ring_add(ctx->br, ctx->bufs + bid * URING_RECV_BUFSIZE, URING_RECV_BUFSIZE, bid,
+                        io_uring_buf_ring_mask(URING_RECV_BUFS), 0);
+                io_uring_buf_ring_advance(ctx->br, 1);
+            }
+            if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED))
+                fakeswitch_handle_input(fs, NULL, cqe->res);    // connection lost
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+            {
+                // multishot ended (e.g., out of buffers); re-arm unless we are done
+                conn->recv_armed = 0;
+                ctx->inflight--;
+                if (!ctx->stopping)
+                    uring_arm_recv(ctx, i);
+            }
+            break;
+        case URING_SEND:
+            conn->sends--;
+            ctx->inflight--;
+            if (cqe->res > 0)
+            {
+                msgbuf_pull(conn->sending, NULL, cqe->res);
+                if (fs->handshake.connected == 0)
+                    fakeswitch_connected(fs);
+            }
+            else if (cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -EAGAIN && cqe->res != -EINTR)
+                fakeswitch_handle_input(fs, NULL, cqe->res);    // connection lost
+            // a short send breaks the chain: the rest is resent by uring_flush()
+            break;
+        case URING_CANCEL:
+            ctx->inflight--;
+            return;
+    }
+    if (!ctx->stopping)
+    {
+        fakeswitch_queue_output(fs);
+        uring_flush(ctx, i);
+    }
+    if (fs->switch_status != READY_TO_SEND)
+        ctx->sweep = 1;
+}
+
+/***********************************************************************/
+static void uring_reap(struct uring_ctx * ctx)
+{
+    struct io_uring_cqe * cqe;
+    unsigned head;
+    unsigned n = 0;
+
+    io_uring_for_each_cqe(&ctx->ring, head, cqe)
+    {
+        uring_complete(ctx, cqe);
+        n++;
+    }
+    io_uring_cq_advance(&ctx->ring, n);
+}
+
+/***********************************************************************
+ * Cancel the receives, let the sends finish so no message is cut short
+ *  on the wire, and hand unsent output back to the switches
+ */
+static void uring_stop(struct uring_ctx * ctx)
+{
+    struct worker * w = ctx->w;
+    struct io_uring_cqe * cqe;
+    struct io_uring_sqe * sqe;
+    struct __kernel_timespec ts = { .tv_sec = 0, .tv_nsec = 10000000 };
+    int waited = 0;
+    int i;
+
+    ctx->stopping = 1;
+    for (i = 0; i < w->n_fakeswitches; i++)
+    {
+        if (!ctx->conns[i].recv_armed)
+            continue;
+        sqe = uring_get_sqe(ctx);
+        io_uring_prep_cancel64(sqe, URING_DATA(i, URING_RECV), 0);
+        io_uring_sqe_set_data64(sqe, URING_DATA(i, URING_CANCEL));
+        ctx->inflight++;
+    }
+    while (ctx->inflight > 0 && waited < URING_DRAIN_MS)
+    {
+        io_uring_submit_and_wait_timeout(&ctx->ring, &cqe, 1, &ts, NULL);
+        uring_reap(ctx);
+        waited += 10;
+    }
+    if (ctx->inflight > 0)
+        fprintf(stderr, "io_uring: %d operations still in flight after the test\n", ctx->inflight);
+
+    for (i = 0; i < w->n_fakeswitches; i++)
+        if (ctx->conns[i].sending != NULL)
+            fakeswitch_sent_output(&w->fakeswitches[i], ctx->conns[i].sending);
+    uring_set_nonblock(w, 1);
+    io_uring_free_buf_ring(&ctx->ring, ctx->br, URING_RECV_BUFS, URING_BGID);
+    io_uring_queue_exit(&ctx->ring);
+    free(ctx->bufs);
+    free(ctx->conns);
+}
+
+/***********************************************************************/
+static void uring_set_nonblock(struct worker * w, int on)
+{
+    int i;
+    int flags;
+    for (i = 0; i < w->n_fakeswitches; i++)
+    {
+        flags = fcntl(w->fakeswitches[i].sock, F_GETFL);
+        fcntl(w->fakeswitches[i].sock, F_SETFL, on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    }
+}
+
+#endif
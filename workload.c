@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "workload.h"
+
+static const char * workload_names[WORKLOAD_TYPES] = {
+    "packet_in", "echo", "port_status", "flow_removed", "resource_report"
+};
+
+static int gcd(int a, int b);
+
+/**********************************************************************/
+int workload_parse(struct workload * workload, const char * spec)
+{
+    int current[WORKLOAD_TYPES];
+    const char * p = spec;
+    char * end;
+    long weight;
+    int total = 0, divisor = 0;
+    int len, i, j, best;
+
+    memset(workload, 0, sizeof(*workload));
+    while (*p)
+    {
+        len = strcspn(p, ":");
+        for (i = 0; i < WORKLOAD_TYPES; i++)
+            if (strlen(workload_names[i]) == len && strncmp(p, workload_names[i], len) == 0)
+                break;
+        if (i == WORKLOAD_TYPES || p[len] != ':')
+            return -1;
+        weight = strtol(p + len + 1, &end, 10);
+        if (end == p + len + 1 || weight < 0 || weight > WORKLOAD_MAX_CYCLE || (*end && *end != ','))
+            return -1;
+        workload->weights[i] = weight;
+        p = *end ? end + 1 : end;
+    }
+
+    for (i = 0; i < WORKLOAD_TYPES; i++)
+        divisor = gcd(divisor, workload->weights[i]);
+    if (divisor == 0)
+        return -1;      // nothing to send
+    for (i = 0; i < WORKLOAD_TYPES; i++)
+    {
+        workload->weights[i] /= divisor;
+        total += workload->weights[i];
+    }
+    if (total > WORKLOAD_MAX_CYCLE)
+        return -1;
+
+    // smooth weighted round robin: the type furthest ahead of its share goes next
+    memset(current, 0, sizeof(current));
+    for (j = 0; j < total; j++)
+    {
+        best = 0;
+        for (i = 0; i < WORKLOAD_TYPES; i++)
+        {
+            current[i] += workload->weights[i];
+            if (current[i] > current[best])
+                best = i;
+        }
+        current[best] -= total;
+        workload->cycle[j] = best;
+    }
+    workload->cycle_len = total;
+    return 0;
+}
+
+/**********************************************************************/
+const char * workload_type_name(enum workload_type type)
+{
+    return workload_names[type];
+}
+
+/**********************************************************************/
+int workload_type_answered(enum workload_type type)
+{
+    return type == WORKLOAD_PACKET_IN || type == WORKLOAD_ECHO;
+}
+
+/**********************************************************************/
+static int gcd(int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
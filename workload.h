@@ -0,0 +1,52 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+
+#define WORKLOAD_MAX_CYCLE  1000        // weights are reduced by their gcd and must then sum to at most this
+
+/* what a switch can send in place of a packet_in */
+enum workload_type
+{
+    WORKLOAD_PACKET_IN,                 // answered by a packet_out or flow_mod
+    WORKLOAD_ECHO,                      // ECHO_REQUEST, answered by an ECHO_REPLY
+    WORKLOAD_PORT_STATUS,               // the other three are notifications without an answer
+    WORKLOAD_FLOW_REMOVED,
+    WORKLOAD_RESOURCE_REPORT,
+    WORKLOAD_TYPES
+};
+
+/* A weighted mix of message types
+ *  The weights are laid out as one cycle, interleaved by smooth weighted
+ *  round robin: every cycle holds each type exactly weight times, spread
+ *  as evenly as possible.  Switches walk the cycle from different points.
+ */
+struct workload
+{
+    int weights[WORKLOAD_TYPES];
+    int cycle_len;
+    uint8_t cycle[WORKLOAD_MAX_CYCLE];  // workload_type of each message of a cycle
+};
+
+/* messages of each type sent and answered */
+struct mix_counts
+{
+    unsigned long sent[WORKLOAD_TYPES];
+    unsigned long answered[WORKLOAD_TYPES];
+};
+
+/*** Parse a mix like "packet_in:90,echo:4,port_status:2,flow_removed:2,resource_report:2"
+ *  Types left out get weight 0
+ * @param workload  Filled on success
+ * @param spec      Comma separated type:weight pairs
+ * @return          0, or -1 if the spec is malformed
+ */
+int workload_parse(struct workload * workload, const char * spec);
+
+/*** @return  The name of a type as used in a mix spec */
+const char * workload_type_name(enum workload_type type);
+
+/*** @return  1 if the controller is expected to answer the type, else 0 */
+int workload_type_answered(enum workload_type type);
+
+#endif